@@ -0,0 +1,546 @@
+/*
+ * tab:4
+ *
+ * bench.c - timing harness for maze generation and drawing
+ *
+ * Runs the maze and mode X code against the emulated VGA (MODEX_EMULATED),
+ * so it needs neither port permissions nor /dev/mem, and times:
+ *   make_maze at every level size used by the game
+ *   fill_horiz_buffer and fill_vert_buffer
+ *   draw_full_block, inside the screen and clipped by its edges
+ *   set_view_window one pixel in each direction, with the exposed line
+ *   text_to_graphics
+ *   show_screen copying a whole page
+ *   make_maze, fill_horiz_buffer, fill_vert_buffer, and unveil_space in
+ *   square mazes from 50x50 to 1000x1000, to show how they scale, with
+ *   make_maze also timed joining regions by search (MAZE_GEN_SEARCH),
+ *   and making rows as needed (MAZE_GEN_ELLER) both to the first screen
+ *   of rows and to the last row
+ *   make_maze in a 1000x1000 maze with 1, 2, 4, ... threads digging
+ *   (set_maze_threads), up to the number of processors online
+ *
+ * Each benchmark first calibrates a number of calls per repetition that
+ * takes at least BENCH_MIN_NS, then runs warmup repetitions, then timed
+ * repetitions, and reports the median and minimum time per call.  The
+ * output has one line (or JSON object) per benchmark in a fixed order,
+ * so that results can be compared from commit to commit.
+ *
+ * usage: bench [-j] [-r reps] [-w warmup] [-t threads]
+ *   -j  print JSON instead of text
+ *   -t  most threads to time make_maze with
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "maze.h"
+#include "modex.h"
+#include "text.h"
+
+#define BENCH_MIN_NS    2000000     /* minimum time of one repetition  */
+#define MAX_BENCHES     64          /* benchmarks in one run           */
+#define MAX_REPS        1000        /* repetitions of one benchmark    */
+#define BENCH_MAZE_X    30          /* maze used to draw (level 7 or   */
+#define BENCH_MAZE_Y    20          /*   so of the game)               */
+#define BENCH_SEED      391         /* seed of that maze               */
+#define BENCH_LEVELS    10          /* levels of the game              */
+#define BENCH_THREAD_DIM 1000       /* maze timed with more threads    */
+
+/* a benchmark: fn is called with arg and a call count per repetition */
+typedef void (*bench_fn_t)(int arg, int calls);
+
+/* result of one benchmark */
+typedef struct bench_result_t {
+    char name[32];
+    int calls;                  /* calls per repetition     */
+    int reps;                   /* timed repetitions        */
+    double median_ns;           /* median time per call     */
+    double min_ns;              /* fastest time per call    */
+} bench_result_t;
+
+static bench_result_t results[MAX_BENCHES];
+static int n_results;
+static int warmup_reps = 3;
+static int timed_reps = 15;
+
+/* view position used by the drawing benchmarks */
+static int view_x, view_y;
+
+/* sides of the square mazes used to show scaling */
+static const int scale_dims[] = {50, 125, 250, 500, 1000};
+
+/* local functions--see function headers for details */
+static unsigned long long now_ns();
+static int compare_double(const void* a, const void* b);
+static void run_bench(const char* name, bench_fn_t fn, int arg);
+static void bench_make_maze(int arg, int calls);
+static void bench_make_square(int arg, int calls);
+static void bench_make_rows(int arg, int calls);
+static void bench_unveil(int arg, int calls);
+static void bench_fill_horiz(int arg, int calls);
+static void bench_fill_vert(int arg, int calls);
+static void bench_draw_block(int arg, int calls);
+static void bench_shift(int arg, int calls);
+static void bench_text(int arg, int calls);
+static void bench_show_full(int arg, int calls);
+static void print_text();
+static void print_json();
+
+/*
+ * now_ns
+ *   DESCRIPTION: Read the monotonic clock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the time in nanoseconds
+ *   SIDE EFFECTS: none
+ */
+static unsigned long long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * compare_double
+ *   DESCRIPTION: qsort comparison for doubles.
+ *   INPUTS: a, b -- pointers to the values
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as *a is less than, equal
+ *                 to, or greater than *b
+ *   SIDE EFFECTS: none
+ */
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * run_bench
+ *   DESCRIPTION: Calibrate, warm up, and time one benchmark, and record
+ *                the result.
+ *   INPUTS: name -- name reported for the benchmark
+ *           fn -- benchmark function
+ *           arg -- argument passed to fn
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds to results
+ */
+static void run_bench(const char* name, bench_fn_t fn, int arg) {
+    static double per_call[MAX_REPS];
+    bench_result_t* r;
+    unsigned long long start, elapsed;
+    int calls, i;
+
+    if (n_results == MAX_BENCHES)
+        return;
+
+    /* Double the calls per repetition until one takes long enough. */
+    for (calls = 1; ; calls *= 2) {
+        start = now_ns();
+        fn(arg, calls);
+        elapsed = now_ns() - start;
+        if (elapsed >= BENCH_MIN_NS || calls >= (1 << 24))
+            break;
+    }
+
+    for (i = 0; i < warmup_reps; i++)
+        fn(arg, calls);
+    for (i = 0; i < timed_reps; i++) {
+        start = now_ns();
+        fn(arg, calls);
+        per_call[i] = (double)(now_ns() - start) / calls;
+    }
+    qsort(per_call, timed_reps, sizeof (per_call[0]), compare_double);
+
+    r = &results[n_results++];
+    snprintf(r->name, sizeof (r->name), "%s", name);
+    r->calls = calls;
+    r->reps = timed_reps;
+    r->median_ns = per_call[timed_reps / 2];
+    r->min_ns = per_call[0];
+}
+
+/*
+ * bench_make_maze
+ *   DESCRIPTION: Generate mazes of one level's size.
+ *   INPUTS: arg -- level (from 1)
+ *           calls -- number of mazes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces the maze
+ */
+static void bench_make_maze(int arg, int calls) {
+    int x_dim, y_dim;
+
+    /* the sizes chosen by prepare_maze_level in mazegame.c */
+    if ((x_dim = MAZE_MIN_X_DIM + 2 * (arg - 1)) > MAZE_MAX_X_DIM)
+        x_dim = MAZE_MAX_X_DIM;
+    if ((y_dim = MAZE_MIN_Y_DIM + 2 * (arg - 1)) > MAZE_MAX_Y_DIM)
+        y_dim = MAZE_MAX_Y_DIM;
+    /* a fixed series of seeds, so that every run times the same mazes */
+    while (calls--)
+        (void)make_maze(x_dim, y_dim, 1 + (arg - 1) / 2, calls);
+}
+
+/*
+ * bench_make_square
+ *   DESCRIPTION: Generate square mazes.
+ *   INPUTS: arg -- maze dimension
+ *           calls -- number of mazes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces the maze
+ */
+static void bench_make_square(int arg, int calls) {
+    while (calls--)
+        (void)make_maze(arg, arg, 6, calls);
+}
+
+/*
+ * bench_make_rows
+ *   DESCRIPTION: Generate square mazes with MAZE_GEN_ELLER and make all
+ *                of their rows.
+ *   INPUTS: arg -- maze dimension
+ *           calls -- number of mazes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces the maze
+ */
+static void bench_make_rows(int arg, int calls) {
+    while (calls--) {
+        (void)make_maze(arg, arg, 6, calls);
+        (void)get_maze_block(0, 2 * arg);
+    }
+}
+
+/*
+ * bench_unveil
+ *   DESCRIPTION: Unveil the 3x3 lattice points around (odd,odd) points
+ *                scattered over the maze, as the game does around the
+ *                player.  Most points are seen already after the first
+ *                repetition, so this measures finding that out across
+ *                the whole maze.
+ *   INPUTS: arg -- maze dimension
+ *           calls -- number of points
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unveils parts of the maze and may draw them
+ */
+static void bench_unveil(int arg, int calls) {
+    static unsigned int pos = 1;
+    int x, y, i, j;
+
+    while (calls--) {
+        pos = pos * 1664525 + 1013904223;
+        x = (pos >> 8) % arg * 2 + 1;
+        y = (pos >> 20) % arg * 2 + 1;
+        for (i = -1; i < 2; i++)
+            for (j = -1; j < 2; j++)
+                unveil_space(x + i, y + j);
+    }
+}
+
+/*
+ * bench_fill_horiz
+ *   DESCRIPTION: Fill horizontal lines of the maze at successive rows.
+ *   INPUTS: arg -- unused
+ *           calls -- number of lines
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_fill_horiz(int arg, int calls) {
+    static unsigned char buf[SCROLL_X_DIM];
+    int i;
+
+    for (i = 0; i < calls; i++)
+        fill_horiz_buffer(view_x, view_y + i % SCROLL_Y_DIM, buf);
+}
+
+/*
+ * bench_fill_vert
+ *   DESCRIPTION: Fill vertical lines of the maze at successive columns.
+ *   INPUTS: arg -- unused
+ *           calls -- number of lines
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_fill_vert(int arg, int calls) {
+    static unsigned char buf[SCROLL_Y_DIM];
+    int i;
+
+    for (i = 0; i < calls; i++)
+        fill_vert_buffer(view_x + i % SCROLL_X_DIM, view_y, buf);
+}
+
+/*
+ * bench_draw_block
+ *   DESCRIPTION: Draw a wall block at every phase, either inside the
+ *                screen or straddling its left, right, top, and bottom
+ *                edges in turn.
+ *   INPUTS: arg -- 1 to clip the blocks, 0 to keep them inside
+ *           calls -- number of blocks
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws over the build buffer
+ */
+static void bench_draw_block(int arg, int calls) {
+    int i, x, y;
+
+    for (i = 0; i < calls; i++) {
+        x = view_x + 40 + (i & 3);
+        y = view_y + 40;
+        if (arg) {
+            switch ((i >> 2) & 3) {
+                case 0: x = view_x - BLOCK_X_DIM / 2 + (i & 3); break;
+                case 1: x = view_x + SCROLL_X_DIM - BLOCK_X_DIM / 2 + (i & 3); break;
+                case 2: y = view_y - BLOCK_Y_DIM / 2; break;
+                case 3: y = view_y + SCROLL_Y_DIM - BLOCK_Y_DIM / 2; break;
+            }
+        }
+        draw_full_block(x, y, blocks[BLOCK_URDL][0]);
+    }
+}
+
+/*
+ * bench_shift
+ *   DESCRIPTION: Move the logical view one pixel and draw the line it
+ *                exposes, as the game does for each tick of movement.
+ *                The view moves back and forth so that it stays put.
+ *   INPUTS: arg -- direction (DIR_UP, DIR_RIGHT, DIR_DOWN, or DIR_LEFT)
+ *           calls -- number of moves
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: moves the view and draws over the build buffer
+ */
+static void bench_shift(int arg, int calls) {
+    int i, dx, dy, sign;
+
+    dx = (arg == DIR_RIGHT) - (arg == DIR_LEFT);
+    dy = (arg == DIR_DOWN) - (arg == DIR_UP);
+    for (i = 0; i < calls; i++) {
+        /* Even calls move away in the direction, odd calls move back. */
+        sign = ((i & 1) ? -1 : 1);
+        set_view_window(view_x + ((i & 1) ? 0 : dx),
+                        view_y + ((i & 1) ? 0 : dy));
+        if (sign * dx > 0)
+            (void)draw_vert_line(SCROLL_X_DIM - 1);
+        else if (sign * dx < 0)
+            (void)draw_vert_line(0);
+        else if (sign * dy > 0)
+            (void)draw_horiz_line(SCROLL_Y_DIM - 1);
+        else
+            (void)draw_horiz_line(0);
+    }
+    set_view_window(view_x, view_y);
+}
+
+/*
+ * bench_text
+ *   DESCRIPTION: Draw a full status bar of text into a status buffer.
+ *   INPUTS: arg -- unused
+ *           calls -- number of status bars
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void bench_text(int arg, int calls) {
+    static char text[STATUS_BAR_TEXT_SIZE + 1] =
+        "    LEVEL 7   3 FRUITS   TIME: 01:23    ";
+    static unsigned char build[STATUS_BUILD_SIZE];
+
+    while (calls--)
+        text_to_graphics(text, build, 2, 5);
+}
+
+/*
+ * bench_show_full
+ *   DESCRIPTION: Show the screen with every page needing a full copy
+ *                (the view moves one pixel before each call, which is the
+ *                game's common case while the player walks).
+ *   INPUTS: arg -- unused
+ *           calls -- number of frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: moves the view and writes video memory
+ */
+static void bench_show_full(int arg, int calls) {
+    int i;
+
+    for (i = 0; i < calls; i++) {
+        set_view_window(view_x + (i & 1), view_y);
+        show_screen();
+    }
+    set_view_window(view_x, view_y);
+}
+
+/*
+ * print_text
+ *   DESCRIPTION: Print the results, one line per benchmark.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to stdout
+ */
+static void print_text() {
+    int i;
+
+    printf("%-28s %14s %14s %10s %6s\n",
+           "benchmark", "median ns", "min ns", "calls", "reps");
+    for (i = 0; i < n_results; i++)
+        printf("%-28s %14.1f %14.1f %10d %6d\n", results[i].name,
+               results[i].median_ns, results[i].min_ns, results[i].calls,
+               results[i].reps);
+}
+
+/*
+ * print_json
+ *   DESCRIPTION: Print the results as a JSON object with an array of
+ *                benchmarks.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to stdout
+ */
+static void print_json() {
+    int i;
+
+    printf("{\n  \"warmup_reps\": %d,\n  \"benchmarks\": [\n", warmup_reps);
+    for (i = 0; i < n_results; i++)
+        printf("    {\"name\": \"%s\", \"median_ns\": %.1f, \"min_ns\": %.1f, "
+               "\"calls\": %d, \"reps\": %d}%s\n", results[i].name,
+               results[i].median_ns, results[i].min_ns, results[i].calls,
+               results[i].reps, (i + 1 < n_results ? "," : ""));
+    printf("  ]\n}\n");
+}
+
+/*
+ * main
+ *   DESCRIPTION: Run every benchmark and print the results.
+ *   INPUTS: argc, argv -- command line options (see top of file)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 1 on failure
+ *   SIDE EFFECTS: none
+ */
+int main(int argc, char* argv[]) {
+    static const char* const dir_names[NUM_DIRS] = {
+        "up", "right", "down", "left"
+    };
+    char name[32];
+    int json = 0;
+    int opt, level, dir, i, dim, threads;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "jr:w:t:")) != -1) {
+        switch (opt) {
+            case 'j':
+                json = 1;
+                break;
+            case 'r':
+                timed_reps = atoi(optarg);
+                break;
+            case 'w':
+                warmup_reps = atoi(optarg);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-j] [-r reps] [-w warmup] [-t threads]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (timed_reps < 1 || timed_reps > MAX_REPS || warmup_reps < 0) {
+        fprintf(stderr, "%s: reps must be 1 to %d\n", argv[0], MAX_REPS);
+        return 1;
+    }
+
+    /* Every level size of the game. */
+    for (level = 1; level <= BENCH_LEVELS; level++) {
+        snprintf(name, sizeof (name), "make_maze_level_%02d", level);
+        run_bench(name, bench_make_maze, level);
+    }
+
+    /* The drawing benchmarks use one maze, with the view inside it. */
+    if (make_maze(BENCH_MAZE_X, BENCH_MAZE_Y, 4, BENCH_SEED) != 0 ||
+        set_mode_X(fill_horiz_buffer, fill_vert_buffer, MODEX_EMULATED) != 0) {
+        fprintf(stderr, "%s: cannot set up the display\n", argv[0]);
+        return 1;
+    }
+    view_x = 5 * BLOCK_X_DIM;
+    view_y = 5 * BLOCK_Y_DIM;
+    set_view_window(view_x, view_y);
+    draw_view_tiles(get_maze_block);
+
+    run_bench("fill_horiz_buffer", bench_fill_horiz, 0);
+    run_bench("fill_vert_buffer", bench_fill_vert, 0);
+    run_bench("draw_full_block", bench_draw_block, 0);
+    run_bench("draw_full_block_clipped", bench_draw_block, 1);
+    for (dir = 0; dir < NUM_DIRS; dir++) {
+        snprintf(name, sizeof (name), "set_view_window_%s", dir_names[dir]);
+        run_bench(name, bench_shift, dir);
+    }
+    run_bench("text_to_graphics", bench_text, 0);
+    run_bench("show_screen_full", bench_show_full, 0);
+
+    /*
+     * Larger mazes, with the view at the bottom right so that lines are
+     * drawn from far into the maze arrays.
+     */
+    for (i = 0; i < sizeof (scale_dims) / sizeof (scale_dims[0]); i++) {
+        dim = scale_dims[i];
+        snprintf(name, sizeof (name), "make_maze_%dx%d", dim, dim);
+        run_bench(name, bench_make_square, dim);
+        set_maze_generator(MAZE_GEN_SEARCH);
+        snprintf(name, sizeof (name), "make_maze_search_%dx%d", dim, dim);
+        run_bench(name, bench_make_square, dim);
+        set_maze_generator(MAZE_GEN_ELLER);
+        snprintf(name, sizeof (name), "make_maze_eller_%dx%d", dim, dim);
+        run_bench(name, bench_make_square, dim);
+        snprintf(name, sizeof (name), "eller_all_rows_%dx%d", dim, dim);
+        run_bench(name, bench_make_rows, dim);
+        set_maze_generator(MAZE_GEN_UNION_FIND);
+        if (make_maze(dim, dim, 6, BENCH_SEED) != 0) {
+            fprintf(stderr, "%s: cannot make a %dx%d maze\n",
+                    argv[0], dim, dim);
+            break;
+        }
+        view_x = (2 * dim + 1) * BLOCK_X_DIM - SHOW_MIN - SCROLL_X_DIM - 1;
+        view_y = (2 * dim + 1) * BLOCK_Y_DIM - SHOW_MIN - SCROLL_Y_DIM - 1;
+        set_view_window(view_x, view_y);
+        snprintf(name, sizeof (name), "fill_horiz_buffer_%dx%d", dim, dim);
+        run_bench(name, bench_fill_horiz, 0);
+        snprintf(name, sizeof (name), "fill_vert_buffer_%dx%d", dim, dim);
+        run_bench(name, bench_fill_vert, 0);
+        snprintf(name, sizeof (name), "unveil_space_%dx%d", dim, dim);
+        run_bench(name, bench_unveil, dim);
+    }
+
+    /* Digging with more threads. */
+    if (threads > MAZE_MAX_THREADS)
+        threads = MAZE_MAX_THREADS;
+    for (i = 1; i <= threads; i *= 2) {
+        set_maze_threads(i);
+        snprintf(name, sizeof (name), "make_maze_threads_%d", i);
+        run_bench(name, bench_make_square, BENCH_THREAD_DIM);
+    }
+    set_maze_threads(1);
+
+    clear_mode_X();
+
+    if (json)
+        print_json();
+    else
+        print_text();
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * tab:4
+ *
+ * blend.c - byte blending kernels for compositing masked sprites
+ *
+ * Kernels:
+ *   scalar -- builds a byte mask from each mask byte and combines with
+ *             AND and OR
+ *   sse2   -- the same, sixteen bytes at a time (PCMPEQB, PAND, PANDN,
+ *             POR)
+ *
+ * The SSE2 kernel is built with a target attribute so that the rest of
+ * the program still runs on CPUs without SSE2.
+ */
+
+#include <cpuid.h>
+#include <emmintrin.h>
+
+#include "blend.h"
+
+/* local functions--see function headers for details */
+static void blend_scalar(unsigned char* dst, const unsigned char* src,
+                         const unsigned char* mask, int len);
+static void blend_sse2(unsigned char* dst, const unsigned char* src,
+                       const unsigned char* mask, int len);
+
+/*
+ * blend_scalar
+ *   DESCRIPTION: Replace dst[i] with src[i] where mask[i] is non-zero,
+ *                one byte at a time without branches.
+ *   INPUTS: dst -- background bytes
+ *           src -- sprite bytes
+ *           mask -- sprite mask bytes (zero where the background shows)
+ *           len -- number of bytes
+ *   OUTPUTS: dst -- blended bytes
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void blend_scalar(unsigned char* dst, const unsigned char* src,
+                         const unsigned char* mask, int len) {
+    unsigned char m;    /* 0xFF where the sprite shows, else 0x00 */
+    int i;              /* loop index over bytes                  */
+
+    for (i = 0; i < len; i++) {
+        m = (unsigned char)-(mask[i] != 0);
+        dst[i] = (unsigned char)((dst[i] & ~m) | (src[i] & m));
+    }
+}
+
+/*
+ * blend_sse2
+ *   DESCRIPTION: Replace dst[i] with src[i] where mask[i] is non-zero,
+ *                sixteen bytes at a time.
+ *   INPUTS: dst -- background bytes
+ *           src -- sprite bytes
+ *           mask -- sprite mask bytes (zero where the background shows)
+ *           len -- number of bytes, a multiple of 16
+ *   OUTPUTS: dst -- blended bytes
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+__attribute__((target("sse2")))
+static void blend_sse2(unsigned char* dst, const unsigned char* src,
+                       const unsigned char* mask, int len) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i keep;       /* 0xFF where the background shows */
+    __m128i d, s;
+    int i;              /* loop index over 16-byte groups   */
+
+    for (i = 0; i < len; i += 16) {
+        keep = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + i)),
+                              zero);
+        d = _mm_loadu_si128((const __m128i*)(dst + i));
+        s = _mm_loadu_si128((const __m128i*)(src + i));
+        d = _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, s));
+        _mm_storeu_si128((__m128i*)(dst + i), d);
+    }
+}
+
+/*
+ * blend_select
+ *   DESCRIPTION: Choose the blend kernel: SSE2 if CPUID reports it,
+ *                otherwise the scalar kernel.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the chosen kernel
+ *   SIDE EFFECTS: none
+ */
+blend_fn_t blend_select() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2))
+        return blend_sse2;
+    return blend_scalar;
+}
@@ -0,0 +1,25 @@
+/*
+ * tab:4
+ *
+ * blend.h - byte blending kernels for compositing masked sprites
+ *
+ * draw_sprite and erase_sprite in modex.c combine a sprite with the
+ * background in the build buffer through the sprite's mask.  The kernels
+ * here perform that blend without branches; blend_select picks the
+ * SSE2 kernel when CPUID reports SSE2.
+ */
+
+#ifndef BLEND_H
+#define BLEND_H
+
+/*
+ * for each of len bytes (len a multiple of 16), replace dst[i] with
+ * src[i] where mask[i] is non-zero
+ */
+typedef void (*blend_fn_t)(unsigned char* dst, const unsigned char* src,
+                           const unsigned char* mask, int len);
+
+/* the fastest blend kernel the CPU can run */
+extern blend_fn_t blend_select();
+
+#endif /* BLEND_H */
@@ -0,0 +1,393 @@
+/*
+ * tab:4
+ *
+ * copy_kernel.c - interchangeable kernels for copying planes to video memory
+ *
+ * Kernels:
+ *   rep movsb  -- the copy originally written in copy_image
+ *   rep movsd  -- four bytes per string move, then the remaining bytes
+ *   sse2 nt    -- 16-byte non-temporal stores (MOVNTDQ)
+ *   avx2 nt    -- 32-byte non-temporal stores (VMOVNTDQ)
+ *   memcpy     -- the C library
+ *
+ * Non-temporal stores bypass the cache, which suits video memory (never
+ * read back) and write-combined mappings.  The vector kernels are built
+ * with per-function target attributes so that the rest of the program
+ * still runs on CPUs without SSE2 or AVX2; copy_kernel_select never
+ * chooses a kernel that CPUID does not report.
+ */
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "copy_kernel.h"
+
+#define MAX_COPY_LEN 16384      /* largest copy that can be checked/timed */
+
+/* source and destinations for checks and timing */
+static unsigned char src_buf[MAX_COPY_LEN + 64] __attribute__((aligned(64)));
+static unsigned char dst_buf[MAX_COPY_LEN + 64] __attribute__((aligned(64)));
+static unsigned char ref_buf[MAX_COPY_LEN + 64] __attribute__((aligned(64)));
+
+/* local functions--see function headers for details */
+static int always_supported();
+static int sse2_supported();
+static int avx2_supported();
+static void copy_rep_movsb(unsigned char* dst, const unsigned char* src, int len);
+static void copy_rep_movsd(unsigned char* dst, const unsigned char* src, int len);
+static void copy_sse2_nt(unsigned char* dst, const unsigned char* src, int len);
+static void copy_avx2_nt(unsigned char* dst, const unsigned char* src, int len);
+static void copy_memcpy(unsigned char* dst, const unsigned char* src, int len);
+
+const copy_kernel_t copy_kernels[] = {
+    {"rep movsb", copy_rep_movsb, always_supported},
+    {"rep movsd", copy_rep_movsd, always_supported},
+    {"sse2 nt",   copy_sse2_nt,   sse2_supported},
+    {"avx2 nt",   copy_avx2_nt,   avx2_supported},
+    {"memcpy",    copy_memcpy,    always_supported}
+};
+const int num_copy_kernels = sizeof (copy_kernels) / sizeof (copy_kernels[0]);
+
+/*
+ * always_supported
+ *   DESCRIPTION: Support test for kernels that run on any x86.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1
+ *   SIDE EFFECTS: none
+ */
+static int always_supported() {
+    return 1;
+}
+
+/*
+ * sse2_supported
+ *   DESCRIPTION: Check CPUID leaf 1 for SSE2.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: non-zero if SSE2 is available
+ *   SIDE EFFECTS: none
+ */
+static int sse2_supported() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return ((edx & bit_SSE2) != 0);
+}
+
+/*
+ * avx2_supported
+ *   DESCRIPTION: Check CPUID for AVX2, and check that the operating system
+ *                saves the YMM registers (OSXSAVE set and XCR0 bits 1-2).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: non-zero if AVX2 is available
+ *   SIDE EFFECTS: none
+ */
+static int avx2_supported() {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int xcr0_lo, xcr0_hi;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return 0;
+    asm volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6)
+        return 0;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return ((ebx & bit_AVX2) != 0);
+}
+
+/*
+ * copy_rep_movsb
+ *   DESCRIPTION: Copy with REP MOVSB, as copy_image did originally.
+ *   INPUTS: dst -- destination
+ *           src -- source
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes len bytes at dst
+ */
+static void copy_rep_movsb(unsigned char* dst, const unsigned char* src, int len) {
+    asm volatile ("                                             \n\
+        cld                                                     \n\
+        rep movsb    /* copy ECX bytes from M[ESI] to M[EDI] */ \n\
+        "
+        : "+S"(src), "+D"(dst), "+c"(len)
+        : /* no other inputs */
+        : "memory", "cc"
+    );
+}
+
+/*
+ * copy_rep_movsd
+ *   DESCRIPTION: Copy four bytes at a time with REP MOVSD, then copy the
+ *                last zero to three bytes with REP MOVSB.
+ *   INPUTS: dst -- destination
+ *           src -- source
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes len bytes at dst
+ */
+static void copy_rep_movsd(unsigned char* dst, const unsigned char* src, int len) {
+    int words = (len >> 2);
+    int rest = (len & 3);
+
+    asm volatile ("                                             \n\
+        cld                                                     \n\
+        rep movsl    /* copy ECX words from M[ESI] to M[EDI] */ \n\
+        movl %3, %%ecx                                          \n\
+        rep movsb    /* copy the remaining bytes             */ \n\
+        "
+        : "+S"(src), "+D"(dst), "+c"(words)
+        : "r"(rest)
+        : "memory", "cc"
+    );
+}
+
+/*
+ * copy_sse2_nt
+ *   DESCRIPTION: Copy with 16-byte non-temporal stores.  Bytes before the
+ *                first 16-byte boundary of dst and after the last are
+ *                copied with memcpy; the source may have any alignment.
+ *   INPUTS: dst -- destination
+ *           src -- source
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes len bytes at dst; fences the stores
+ */
+__attribute__((target("sse2")))
+static void copy_sse2_nt(unsigned char* dst, const unsigned char* src, int len) {
+    int head;       /* bytes before dst is aligned */
+    __m128i a, b, c, d;
+
+    head = ((-(uintptr_t)dst) & 15);
+    if (head > len)
+        head = len;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= 64; len -= 64, src += 64, dst += 64) {
+        a = _mm_loadu_si128((const __m128i*)src);
+        b = _mm_loadu_si128((const __m128i*)(src + 16));
+        c = _mm_loadu_si128((const __m128i*)(src + 32));
+        d = _mm_loadu_si128((const __m128i*)(src + 48));
+        _mm_stream_si128((__m128i*)dst, a);
+        _mm_stream_si128((__m128i*)(dst + 16), b);
+        _mm_stream_si128((__m128i*)(dst + 32), c);
+        _mm_stream_si128((__m128i*)(dst + 48), d);
+    }
+    for (; len >= 16; len -= 16, src += 16, dst += 16)
+        _mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+    _mm_sfence();
+
+    memcpy(dst, src, len);
+}
+
+/*
+ * copy_avx2_nt
+ *   DESCRIPTION: Copy with 32-byte non-temporal stores.  Bytes before the
+ *                first 32-byte boundary of dst and after the last are
+ *                copied with memcpy; the source may have any alignment.
+ *   INPUTS: dst -- destination
+ *           src -- source
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes len bytes at dst; fences the stores
+ */
+__attribute__((target("avx2")))
+static void copy_avx2_nt(unsigned char* dst, const unsigned char* src, int len) {
+    int head;       /* bytes before dst is aligned */
+    __m256i a, b;
+
+    head = ((-(uintptr_t)dst) & 31);
+    if (head > len)
+        head = len;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= 64; len -= 64, src += 64, dst += 64) {
+        a = _mm256_loadu_si256((const __m256i*)src);
+        b = _mm256_loadu_si256((const __m256i*)(src + 32));
+        _mm256_stream_si256((__m256i*)dst, a);
+        _mm256_stream_si256((__m256i*)(dst + 32), b);
+    }
+    for (; len >= 32; len -= 32, src += 32, dst += 32)
+        _mm256_stream_si256((__m256i*)dst, _mm256_loadu_si256((const __m256i*)src));
+    _mm_sfence();
+
+    memcpy(dst, src, len);
+}
+
+/*
+ * copy_memcpy
+ *   DESCRIPTION: Copy with the C library's memcpy.
+ *   INPUTS: dst -- destination
+ *           src -- source
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes len bytes at dst
+ */
+static void copy_memcpy(unsigned char* dst, const unsigned char* src, int len) {
+    memcpy(dst, src, len);
+}
+
+/*
+ * copy_kernel_check
+ *   DESCRIPTION: Compare a kernel with the original REP MOVSB copy for
+ *                short and plane-sized lengths at every destination
+ *                alignment up to 32 bytes and several source alignments.
+ *                Bytes around the destination must be left alone.
+ *   INPUTS: k -- kernel to check
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the kernel matches, -1 if not
+ *   SIDE EFFECTS: overwrites the check buffers
+ */
+int copy_kernel_check(const copy_kernel_t* k) {
+    static const int lens[] = {
+        0, 1, 2, 3, 4, 5, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65,
+        127, 128, 129, 255, 1440, 14560
+    };
+    static const int src_offs[] = {0, 1, 3, 16};
+    int l, s, d;    /* loop indices over lengths and alignments */
+    int i;
+    int len;
+
+    for (i = 0; i < MAX_COPY_LEN + 64; i++)
+        src_buf[i] = (unsigned char)(i * 7 + (i >> 8));
+
+    for (l = 0; l < sizeof (lens) / sizeof (lens[0]); l++) {
+        len = lens[l];
+        for (s = 0; s < sizeof (src_offs) / sizeof (src_offs[0]); s++) {
+            for (d = 0; d < 32; d++) {
+                if (d + len > MAX_COPY_LEN + 64 - 16)
+                    continue;
+                memset(dst_buf, 0xAA, d + len + 16);
+                memset(ref_buf, 0xAA, d + len + 16);
+                k->copy(dst_buf + d, src_buf + src_offs[s], len);
+                copy_rep_movsb(ref_buf + d, src_buf + src_offs[s], len);
+                if (memcmp(dst_buf, ref_buf, d + len + 16) != 0)
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * copy_kernel_bench
+ *   DESCRIPTION: Time repeated copies of len bytes into dst.
+ *   INPUTS: k -- kernel to time
+ *           dst -- destination, or NULL for an ordinary (cached) buffer
+ *           len -- bytes per copy (at most MAX_COPY_LEN)
+ *           reps -- number of copies
+ *   OUTPUTS: none
+ *   RETURN VALUE: gigabytes per second (10^9 bytes)
+ *   SIDE EFFECTS: overwrites len bytes at dst
+ */
+double copy_kernel_bench(const copy_kernel_t* k, unsigned char* dst,
+                         int len, int reps) {
+    struct timeval start, end;
+    double secs;
+    int i;
+
+    if (len > MAX_COPY_LEN)
+        len = MAX_COPY_LEN;
+    if (dst == NULL)
+        dst = dst_buf;
+
+    /* one untimed copy to warm up caches and page mappings */
+    k->copy(dst, src_buf, len);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < reps; i++)
+        k->copy(dst, src_buf, len);
+    gettimeofday(&end, NULL);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+    if (secs <= 0)
+        secs = 1e-6;
+    return (double)len * reps / secs / 1e9;
+}
+
+/*
+ * copy_kernel_select
+ *   DESCRIPTION: Choose the fastest kernel that the CPU supports and that
+ *                passes copy_kernel_check.  Video memory is slow, so fewer
+ *                copies are timed there than in ordinary memory.
+ *   INPUTS: dst -- video memory to time copies into (its contents are
+ *                  destroyed), or NULL to time ordinary memory
+ *           len -- bytes per copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: the chosen kernel (the original if no other qualifies)
+ *   SIDE EFFECTS: overwrites len bytes at dst
+ */
+const copy_kernel_t* copy_kernel_select(unsigned char* dst, int len) {
+    const copy_kernel_t* best = &copy_kernels[0];
+    double best_rate = 0;
+    double rate;
+    int i;
+
+    for (i = 0; i < num_copy_kernels; i++) {
+        if (!copy_kernels[i].supported() ||
+            copy_kernel_check(&copy_kernels[i]) != 0)
+            continue;
+        rate = copy_kernel_bench(&copy_kernels[i], dst, len,
+                                 (dst != NULL ? 16 : 256));
+        if (rate > best_rate) {
+            best = &copy_kernels[i];
+            best_rate = rate;
+        }
+    }
+    return best;
+}
+
+/*
+ * copy_kernel_report
+ *   DESCRIPTION: Print each kernel's speed copying len bytes into ordinary
+ *                memory and into dst, or why the kernel was not timed.
+ *   INPUTS: f -- output stream
+ *           dst -- video memory to time copies into (its contents are
+ *                  destroyed), or NULL to time ordinary memory only
+ *           len -- bytes per copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites len bytes at dst
+ */
+void copy_kernel_report(FILE* f, unsigned char* dst, int len) {
+    int i;
+
+    fprintf(f, "%-10s %12s %12s   (%d-byte copies)\n", "kernel", "cached GB/s",
+            "VRAM GB/s", len);
+    for (i = 0; i < num_copy_kernels; i++) {
+        fprintf(f, "%-10s ", copy_kernels[i].name);
+        if (!copy_kernels[i].supported()) {
+            fprintf(f, "%12s\n", "unsupported");
+            continue;
+        }
+        if (copy_kernel_check(&copy_kernels[i]) != 0) {
+            fprintf(f, "%12s\n", "FAILED check");
+            continue;
+        }
+        fprintf(f, "%12.2f ", copy_kernel_bench(&copy_kernels[i], NULL, len, 4096));
+        if (dst != NULL)
+            fprintf(f, "%12.3f\n", copy_kernel_bench(&copy_kernels[i], dst, len, 64));
+        else
+            fprintf(f, "%12s\n", "-");
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * tab:4
+ *
+ * copy_kernel.h - interchangeable kernels for copying planes to video memory
+ *
+ * copy_image and copy_image_status in modex.c move one plane of the
+ * build buffer into video memory for every frame, and copy_image_span
+ * moves the dirty spans of a plane.  The kernels here all
+ * perform the same copy; set_mode_X picks one with copy_kernel_select,
+ * which drops kernels the CPU cannot run (CPUID) or that copy wrongly,
+ * then times the rest.
+ */
+
+#ifndef COPY_KERNEL_H
+#define COPY_KERNEL_H
+
+#include <stdio.h>
+
+/* copy len bytes from src to dst; the areas do not overlap */
+typedef void (*copy_fn_t)(unsigned char* dst, const unsigned char* src, int len);
+
+typedef struct copy_kernel_t {
+    const char* name;
+    copy_fn_t copy;
+    int (*supported)();     /* non-zero if the CPU can run the kernel */
+} copy_kernel_t;
+
+/* all kernels; the first ("rep movsb") is the original copy */
+extern const copy_kernel_t copy_kernels[];
+extern const int num_copy_kernels;
+
+/* compare a kernel against the original over many lengths and alignments */
+extern int copy_kernel_check(const copy_kernel_t* k);
+
+/* time a kernel copying len bytes to dst; returns gigabytes per second */
+extern double copy_kernel_bench(const copy_kernel_t* k, unsigned char* dst,
+                                int len, int reps);
+
+/*
+ * choose the fastest correct kernel for copies of len bytes into dst
+ * (video memory, or NULL to time copies into ordinary memory)
+ */
+extern const copy_kernel_t* copy_kernel_select(unsigned char* dst, int len);
+
+/* print the speed of every kernel into ordinary memory and into dst */
+extern void copy_kernel_report(FILE* f, unsigned char* dst, int len);
+
+#endif /* COPY_KERNEL_H */
@@ -0,0 +1,195 @@
+/*
+ * tab:4
+ *
+ * frame_timing.c - per-stage timing of the frames of the game loop
+ *
+ * Times come from clock_gettime(CLOCK_MONOTONIC), which is read without
+ * a system call and needs no calibration, unlike the TSC.  The game
+ * thread is the only writer of the ring: it fills the record at
+ * ring_head, then publishes it by advancing ring_head with a release
+ * store, so a reader that loads ring_head with an acquire load sees only
+ * complete records.  Counts of frames and missed ticks are kept outside
+ * the ring so that they cover the whole game.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame_timing.h"
+
+static const char* const stage_names[FT_NUM_STAGES] = {
+    "tick wait", "input", "logic", "status bar", "composite", "show"
+};
+
+static ft_record_t ring[FT_RING_SIZE];
+static unsigned int ring_head;          /* frames published so far      */
+static ft_record_t cur;                 /* frame being timed            */
+static unsigned long long last_mark;    /* time of the last mark (ns)   */
+static unsigned long total_frames;      /* frames published             */
+static unsigned long late_frames;       /* frames handling > 1 tick     */
+static unsigned long missed_ticks;      /* ticks beyond one per frame   */
+
+/* local functions--see function headers for details */
+static unsigned long long now_ns();
+static int compare_ns(const void* a, const void* b);
+
+/*
+ * now_ns
+ *   DESCRIPTION: Read the monotonic clock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the time in nanoseconds
+ *   SIDE EFFECTS: none
+ */
+static unsigned long long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * frame_begin
+ *   DESCRIPTION: Start timing a frame, discarding any frame started but
+ *                not finished.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_begin() {
+    memset(&cur, 0, sizeof (cur));
+    last_mark = now_ns();
+}
+
+/*
+ * frame_stage
+ *   DESCRIPTION: Charge the time since the last mark (frame_begin or
+ *                frame_stage) to a stage of the current frame.  A stage
+ *                may be charged more than once per frame.
+ *   INPUTS: stage -- the stage that just ended
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_stage(ft_stage_t stage) {
+    unsigned long long now = now_ns();
+
+    cur.stage_ns[stage] += now - last_mark;
+    last_mark = now;
+}
+
+/*
+ * frame_end
+ *   DESCRIPTION: Publish the current frame to the ring.
+ *   INPUTS: ticks -- RTC ticks handled in the frame (more than one means
+ *                    that ticks were missed)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites the oldest frame when the ring is full
+ */
+void frame_end(int ticks) {
+    unsigned int head = ring_head;
+
+    cur.ticks = ticks;
+    ring[head & (FT_RING_SIZE - 1)] = cur;
+    __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+
+    total_frames++;
+    if (ticks > 1) {
+        late_frames++;
+        missed_ticks += ticks - 1;
+    }
+}
+
+/*
+ * compare_ns
+ *   DESCRIPTION: qsort comparison for nanosecond times.
+ *   INPUTS: a, b -- pointers to the times
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as *a is less than, equal
+ *                 to, or greater than *b
+ *   SIDE EFFECTS: none
+ */
+static int compare_ns(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * frame_timing_report
+ *   DESCRIPTION: Print the median, 99th percentile, and maximum time of
+ *                each stage (and of whole frames) over the frames in the
+ *                ring, and the frame and missed tick counts for the game.
+ *   INPUTS: f -- output stream
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void frame_timing_report(FILE* f) {
+    static unsigned long long ns[FT_RING_SIZE];
+    unsigned int head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    unsigned int n = (head < FT_RING_SIZE ? head : FT_RING_SIZE);
+    unsigned int i;             /* loop index over frames */
+    int s;                      /* loop index over stages */
+    const ft_record_t* r;       /* frame record           */
+
+    fprintf(f, "%lu frames, %lu late, %lu ticks missed\n",
+            total_frames, late_frames, missed_ticks);
+    if (n == 0)
+        return;
+    fprintf(f, "  %-20s %8s %8s %8s   (usec, last %u frames)\n",
+            "stage", "p50", "p99", "max", n);
+
+    /* Stage FT_NUM_STAGES stands for the whole frame. */
+    for (s = 0; s <= FT_NUM_STAGES; s++) {
+        for (i = 0; i < n; i++) {
+            r = &ring[(head - n + i) & (FT_RING_SIZE - 1)];
+            if (s < FT_NUM_STAGES) {
+                ns[i] = r->stage_ns[s];
+            } else {
+                int t;
+                for (ns[i] = 0, t = 0; t < FT_NUM_STAGES; t++)
+                    ns[i] += r->stage_ns[t];
+            }
+        }
+        qsort(ns, n, sizeof (ns[0]), compare_ns);
+        fprintf(f, "  %-20s %8.1f %8.1f %8.1f\n",
+                (s < FT_NUM_STAGES ? stage_names[s] : "frame"),
+                ns[n / 2] / 1e3, ns[(n * 99ULL) / 100] / 1e3,
+                ns[n - 1] / 1e3);
+    }
+}
+
+/*
+ * frame_timing_dump
+ *   DESCRIPTION: Write the frames in the ring to a file in the binary
+ *                format described in frame_timing.h.
+ *   INPUTS: path -- file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates or replaces the file
+ */
+int frame_timing_dump(const char* path) {
+    static const char magic[8] = "MAZEFT1";
+    unsigned int head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    unsigned int n = (head < FT_RING_SIZE ? head : FT_RING_SIZE);
+    unsigned int hdr[2] = {FT_NUM_STAGES, n};
+    unsigned int i;             /* loop index over frames */
+    FILE* f;
+    int ok;
+
+    if ((f = fopen(path, "wb")) == NULL)
+        return -1;
+    ok = (fwrite(magic, sizeof (magic), 1, f) == 1 &&
+          fwrite(hdr, sizeof (hdr), 1, f) == 1);
+    for (i = 0; ok && i < n; i++)
+        ok = (fwrite(&ring[(head - n + i) & (FT_RING_SIZE - 1)],
+                     sizeof (ft_record_t), 1, f) == 1);
+    if (fclose(f) != 0)
+        ok = 0;
+    return (ok ? 0 : -1);
+}
@@ -0,0 +1,59 @@
+/*
+ * tab:4
+ *
+ * frame_timing.h - per-stage timing of the frames of the game loop
+ *
+ * rtc_thread in mazegame.c marks the end of each stage of a frame with
+ * frame_stage; the time since the previous mark is charged to the stage.
+ * frame_end publishes the frame to a fixed-size ring buffer with a
+ * single writer (the game thread) and no locks.  At exit, the frames
+ * still in the ring are summarized per stage (median, 99th percentile,
+ * and maximum), and can be dumped in binary for offline analysis.
+ */
+
+#ifndef FRAME_TIMING_H
+#define FRAME_TIMING_H
+
+#include <stdio.h>
+
+/* stages of a frame, in the order they usually run */
+typedef enum {
+    FT_TICK_WAIT,       /* waiting for the RTC tick                 */
+    FT_INPUT,           /* merging the direction from the keyboard  */
+    FT_LOGIC,           /* movement, unveiling, and fruits          */
+    FT_STATUS,          /* draw_status_bar                          */
+    FT_COMPOSITE,       /* scrolling and drawing the player         */
+    FT_SHOW,            /* show_screen                              */
+    FT_NUM_STAGES
+} ft_stage_t;
+
+/* number of frames kept; must be a power of two */
+#define FT_RING_SIZE 4096
+
+/*
+ * one frame as kept in the ring and written by frame_timing_dump, which
+ * writes the 8-byte magic "MAZEFT1\0", the stage count and record count
+ * as 32-bit integers, and then the records from oldest to newest
+ */
+typedef struct ft_record_t {
+    unsigned long long stage_ns[FT_NUM_STAGES];  /* time in each stage */
+    unsigned int ticks;                           /* RTC ticks handled  */
+    unsigned int pad;
+} ft_record_t;
+
+/* start timing a frame */
+extern void frame_begin();
+
+/* charge the time since the last mark to a stage */
+extern void frame_stage(ft_stage_t stage);
+
+/* finish the frame, which handled the given number of RTC ticks */
+extern void frame_end(int ticks);
+
+/* print per-stage percentiles and missed tick counts */
+extern void frame_timing_report(FILE* f);
+
+/* write the frames in the ring to a file; returns 0, or -1 on failure */
+extern int frame_timing_dump(const char* path);
+
+#endif /* FRAME_TIMING_H */
@@ -36,6 +36,7 @@
  *        Integrated Nate Taylor's "god mode."
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -54,222 +55,894 @@
 //I CHANGED THIS TO TEST SCROLLING!!!! 2/16/19
 #define GOD_MODE 0
 
+/* rows of (odd,odd) points in a tile of the worm phase, roughly */
+#define MAZE_TILE_ROWS 64
+#define MAZE_MAX_TILES ((MAZE_MAX_Y_DIM + MAZE_TILE_ROWS - 1) / MAZE_TILE_ROWS)
+
+/*
+ * a tile of the worm phase: rows first_row to end_row - 1 of (odd,odd)
+ * points across the maze, with its own random number generator
+ */
+typedef struct maze_tile_t {
+    int first_row, end_row;
+    unsigned int rng[4];
+    int last_x, last_y;         /* where the last worm stopped */
+} maze_tile_t;
+
 /* local functions--see function headers for details */
-static int mark_maze_area(int x, int y);
-static void add_a_fruit_internal();
+static int alloc_maze(maze_t* m, int x_dim, int y_dim);
+static void seed_random(maze_t* m, unsigned int seed);
+static unsigned int step_random(unsigned int s[4]);
+static unsigned int next_random(maze_t* m);
+static int random_below_from(unsigned int s[4], int n);
+static int random_below(maze_t* m, int n);
+static int mark_maze_area(maze_t* m, int x, int y);
+static void connect_by_search(maze_t* m, int x, int y);
+static int find_set(int* set, int cell);
+static int join_sets(int* set, int a, int b);
+static void connect_by_union(maze_t* m);
+static int row_coin(maze_t* m);
+static void make_eller_row(maze_t* m);
+static void make_maze_rows(maze_t* m, int y);
+static void dig_tile(maze_t* m, maze_tile_t* tile);
+static void* dig_tiles(void* arg);
+static void place_fruits(maze_t* m, int start_fruits);
+static void add_a_fruit_internal(maze_t* m);
 #if (TEST_MAZE_GEN == 0) /* not used when testing maze generation */
-static unsigned char* find_block(int x, int y);
-static void _add_a_fruit(int show);
+static int resolve_block(maze_t* m, int x, int y);
+static void update_block(maze_t* m, int x, int y);
+static void build_block_grid(maze_t* m);
+static void show_block(maze_t* m, int x, int y);
+static void _add_a_fruit(maze_t* m, int show);
 extern int get_num_fruit();
 #endif
 
 /*
- * The maze array contains a one byte bit vector (maze_bit_t) for each
- * location in a maze.  The left and right boundaries of the maze are unified,
- * i.e., column 0 also forms the right boundary via wraparound.  Drawings
- * for each block in the maze are chosen based on a five-point stencil
- * that includes north, east, south, and west neighbor blocks.  For
- * simplicity, the maze array is extended with additional rows on the top
- * and bottom to avoid boundary conditions.
+ * The maze is kept as bitplanes with one bit for each location in the
+ * maze, packed into 64-bit words: wall_plane holds MAZE_WALL, and
+ * reach_plane holds MAZE_REACH.  The other maze_bit_t bits are kept
+ * apart, as only (odd,odd) lattice points hold fruit: fruit_map holds the
+ * MAZE_FRUIT bits of each such point, and the one MAZE_EXIT point is
+ * (exit_x,exit_y).  Drawings for each block in the maze are chosen
+ * based on a five-point stencil that includes north, east, south, and
+ * west neighbor blocks.  For simplicity, the planes are extended with
+ * additional rows on the top and bottom and additional columns on the
+ * right to avoid boundary conditions.
  *
- * Under these assumptions, the upper left boundary of the maze is at (0,1),
- * and the lower right boundary is at (2 X_DIM, 2 Y_DIM + 1).  The stencil
- * calculation for the lower right boundary includes the point below it,
- * which is (2 X_DIM, 2 Y_DIM + 2).  As the width of the maze is 2 X_DIM,
- * the index of this point is 2 X_DIM + (2 Y_DIM + 2) * 2 X_DIM, or
- * 2 X_DIM (2 Y_DIM + 3), and the space allocated is one larger than this
- * maximum index value.
+ * Under these assumptions, the upper left boundary of the maze is at (0,0),
+ * and the lower right boundary is at (2 X_DIM, 2 Y_DIM).  Each row holds
+ * the 2 X_DIM + 1 lattice points from the left boundary to the right
+ * boundary, padded with open space (MAZE_NONE) out to maze_stride points,
+ * a multiple of MAZE_ROW_ALIGN; the padding is also the neighbor to the
+ * left of the next row's left boundary.  With the rows above (y = -1) and
+ * below (y = 2 Y_DIM + 1) the maze, the planes have 2 Y_DIM + 3 rows.
+ * As every row starts a new word, the words of a row lie at a fixed
+ * offset from those of the rows above and below, and word operations
+ * apply to 64 neighboring locations at once (see mark_maze_area).
+ *
+ * The planes are allocated by make_maze_in for the size of each maze,
+ * along with block_grid and maze_queue.  Indices (bit numbers) are 32-bit
+ * ints, which is ample for any maze up to MAZE_MAX_X_DIM by
+ * MAZE_MAX_Y_DIM.
  */
-static unsigned char maze[2 * MAZE_MAX_X_DIM * (2 * MAZE_MAX_Y_DIM + 3) + 1];
-static int maze_x_dim;          /* horizontal dimension of maze */
-static int maze_y_dim;          /* vertical dimension of maze   */
-static int n_fruits;            /* number of fruits in maze     */
-static int exit_x, exit_y;      /* lattice point of maze exit   */
+#define MAZE_ROW_ALIGN 64
+typedef unsigned long long maze_word_t;
 
 /*
- * maze array index calculation macro; maze dimensions are valid only
- * after a call to make_maze
+ * A maze and everything kept with it, so that one maze can be made (by
+ * make_maze_in) while another is played.  The other functions in maze.h
+ * act on the current maze, cur_maze (see use_maze).  Here, functions take
+ * the maze they work on as m, to which the macros below refer.
  */
-#define MAZE_INDEX(a,b) ((a) + ((b) + 1) * maze_x_dim * 2)
+struct maze_t {
+    maze_word_t* wall_plane;
+    maze_word_t* reach_plane;
+    unsigned char* fruit_map;
+    int maze_size;              /* locations allocated per plane */
+    int maze_stride;            /* locations per row of maze     */
+    int maze_x_dim;             /* horizontal dimension of maze  */
+    int maze_y_dim;             /* vertical dimension of maze    */
+    int n_fruits;               /* number of fruits in maze      */
+    int exit_x, exit_y;         /* lattice point of maze exit    */
+
+    /*
+     * State of the generator behind maze layout and fruit placement
+     * (xoshiro128**; see seed_random).  Kept here rather than in libc's
+     * random() so that a seed always gives the same maze and fruits,
+     * however the rest of the program uses random numbers.
+     */
+    unsigned int rng_state[4];
+
+    /*
+     * Mazes made with MAZE_GEN_ELLER are generated a row at a time as
+     * they are needed (see make_maze_rows), so their rows draw on a
+     * stream of their own, seeded from rng_state by make_maze_in.  The
+     * maze then comes out the same however its rows are interleaved
+     * with fruits added during play.  row_bits holds n_row_bits random
+     * bits not yet used by row_coin.
+     */
+    unsigned int row_rng_state[4];
+    unsigned int row_bits;
+    int n_row_bits;
+    int eller_row;              /* next row of points to generate */
+
+    /*
+     * lattice rows from the top whose walls and blocks are complete; all
+     * of the maze unless it is still being made by make_maze_rows
+     */
+    int maze_rows_made;
+
+    /*
+     * The block number drawn at each lattice point, laid out like the
+     * maze array (and indexed with MAZE_INDEX).  The grid is built by
+     * make_maze_in and updated wherever a lattice point's drawing can
+     * change (unveiling, eating and adding fruits, and the exit appearing
+     * or disappearing), so that drawing lines of the maze needs only
+     * lookups.
+     */
+    unsigned char* block_grid;
+
+    /*
+     * scratch space with room for two entries for every (odd,odd)
+     * lattice point of the maze: the list of worm starting points in
+     * make_maze_in, the stack for the search in mark_maze_area, or the
+     * sets for connect_by_union; mazes made with MAZE_GEN_ELLER need only
+     * ELLER_ENTRIES for each column, for make_eller_row
+     */
+    int* maze_queue;
+    int queue_size;             /* entries allocated for queue     */
+    int fruit_size;             /* entries allocated for fruit_map */
+
+    /* tiles of the worm phase, and the next one to be dug */
+    maze_tile_t maze_tiles[MAZE_MAX_TILES];
+    int n_tiles;
+    int next_tile;
+};
+#define ELLER_ENTRIES 5
+
+static maze_t* cur_maze;        /* maze played (see use_maze)    */
+static maze_gen_t maze_gen = MAZE_GEN_UNION_FIND; /* see make_maze_in */
+static int maze_threads = 1;    /* threads digging with worms    */
+
+/*
+ * maze array index calculation macro for the maze m; maze dimensions are
+ * valid only after a call to make_maze_in
+ */
+#define MAZE_INDEX(a,b) ((a) + ((b) + 1) * m->maze_stride)
+
+/* bit operations on a plane at an index */
+#define PLANE_WORD(p,i)  ((p)[(i) >> 6])
+#define PLANE_BIT(i)     (1ULL << ((i) & 63))
+#define PLANE_TEST(p,i)  ((PLANE_WORD(p, i) & PLANE_BIT(i)) != 0)
+#define PLANE_SET(p,i)   (PLANE_WORD(p, i) |= PLANE_BIT(i))
+#define PLANE_CLEAR(p,i) (PLANE_WORD(p, i) &= ~PLANE_BIT(i))
+
+/* maze bits at a lattice point */
+#define IS_WALL(a,b)     PLANE_TEST(m->wall_plane, MAZE_INDEX(a, b))
+#define IS_REACHED(a,b)  PLANE_TEST(m->reach_plane, MAZE_INDEX(a, b))
+
+/*
+ * MAZE_FRUIT bits of an (odd,odd) lattice point; other points share
+ * entries with their (odd,odd) neighbors, so callers check x and y first
+ */
+#define FRUIT_BITS(a,b) \
+    (m->fruit_map[((b) >> 1) * m->maze_x_dim + ((a) >> 1)])
+
+/*
+ * the locations of a word at odd x (maze_stride is even, so bit numbers
+ * have the parity of x), which are the (odd,odd) points in odd rows
+ */
+#define ODD_BITS 0xAAAAAAAAAAAAAAAAULL
+
+/*
+ * Make sure that lattice row y is complete before it is read (which also
+ * settles the walls of the row below it).  Rows are made a screen ahead
+ * of need, so that the view never waits on them.
+ */
+#define MAZE_ROWS_AHEAD (SCROLL_Y_DIM / BLOCK_Y_DIM + 1)
+#define NEED_ROWS(y) \
+    do { if ((y) >= m->maze_rows_made) make_maze_rows(m, y); } while (0)
 
 
 extern int get_num_fruit(){
-  return n_fruits;
+  return cur_maze->n_fruits;
 }
 
 
 
 /*
  * mark_maze_area
- *   DESCRIPTION: Uses a breadth-first search to marks all parts of the
- *                maze accessible from (x,y) with the MAZE_REACH bit.
+ *   DESCRIPTION: Uses a flood fill to mark all parts of the maze
+ *                accessible from (x,y) with the MAZE_REACH bit.
  *                Stops at walls and at maze locations already marked
  *                as reached.
- *   INPUTS: (x,y) -- starting coordinate within maze
+ *
+ *                The fill works on horizontal runs of open locations
+ *                rather than single locations: the walls on either side
+ *                of a run are found a word at a time from wall_plane,
+ *                the run's (odd,odd) points are marked a word at a time
+ *                in reach_plane, and the openings from the run to the
+ *                rows above and below are found with the same masks
+ *                over the words at the same place in those rows.
+ *   INPUTS: m -- the maze to mark
+ *           (x,y) -- starting coordinate within maze
  *   OUTPUTS: none
  *   RETURN VALUE: number of maze locations marked
  *   SIDE EFFECTS: leaves MAZE_REACH markers on marked portion of maze
  */
-static int mark_maze_area(int x, int y) {
+static int mark_maze_area(maze_t* m, int x, int y) {
     /*
-     * queue for breadth-first search
+     * stack of (odd,odd) locations from which to fill
      *
-     * The queue holds pointers to maze locations in memory.  It is
-     * large enough to hold the whole maze, although it should never
-     * hold more than twice the minimum of rows and columns at any
-     * time with our maze graphs.
+     * A location is pushed only when the opening to it is found and it
+     * is not yet reached, which happens at most from above, from below,
+     * and for the start, so the stack cannot overflow.
      *
-     * q_start is the index of the first unexplored location in the queue
-     * q_end is the index just after the last unexplored location in the
-     *       queue
-     * cur is the maze location being explored
+     * n is the number of locations on the stack
+     * at is the location being filled from
+     * (first,last) are the ends of the run of open locations around it
+     * words is the number of words in a row of each plane
+     * marked is the number of locations marked so far
      */
-    unsigned char* q[MAZE_MAX_X_DIM * MAZE_MAX_Y_DIM];
-    int q_start, q_end;
-    unsigned char* cur;
+    int* stack = m->maze_queue;
+    int n, at, first, last, w, words, marked, side;
+    maze_word_t bits, mask, found;
+
+    words = m->maze_stride / 64;
+    marked = 0;
+    stack[0] = MAZE_INDEX(x, y);
+    n = 1;
+
+    /* Loop until stack is empty. */
+    while (n != 0) {
+        /* Get location from top of stack, unless reached since pushed. */
+        at = stack[--n];
+        if (PLANE_TEST(m->reach_plane, at))
+            continue;
+
+        /*
+         * Find the walls on either side of the location; the maze
+         * boundaries make sure that both exist within the row.
+         */
+        w = at >> 6;
+        bits = m->wall_plane[w] & (~0ULL << (at & 63));
+        while (bits == 0)
+            bits = m->wall_plane[++w];
+        last = w * 64 + __builtin_ctzll(bits) - 1;
+        w = at >> 6;
+        bits = m->wall_plane[w] & (PLANE_BIT(at) - 1);
+        while (bits == 0)
+            bits = m->wall_plane[--w];
+        first = w * 64 + 63 - __builtin_clzll(bits) + 1;
+
+        /*
+         * Mark the run's (odd,odd) points a word at a time, and push the
+         * unreached (odd,odd) points beyond openings above and below.
+         * Maze construction guarantees that an open location above or
+         * below implies that the location beyond it exists and is open.
+         */
+        for (w = first >> 6; w <= (last >> 6); w++) {
+            mask = ODD_BITS;
+            if (w == (first >> 6))
+                mask &= ~0ULL << (first & 63);
+            if (w == (last >> 6))
+                mask &= ~0ULL >> (63 - (last & 63));
+            marked += __builtin_popcountll(mask & ~m->reach_plane[w]);
+            m->reach_plane[w] |= mask;
+            for (side = -words; side <= words; side += 2 * words) {
+                found = mask & ~m->wall_plane[w + side] &
+                        ~m->reach_plane[w + 2 * side];
+                while (found != 0) {
+                    stack[n++] = (w + 2 * side) * 64 + __builtin_ctzll(found);
+                    found &= found - 1;
+                }
+            }
+        }
+    }
+
+    /* Return the number of locations marked. */
+    return marked;
+}
+
+/*
+ * alloc_maze
+ *   DESCRIPTION: Allocate the maze planes, fruit map, block grid, and
+ *                scratch space for a maze of a given size, and fill the
+ *                maze with walls and the row padding with open space.
+ *                The storage belongs to m: it is kept from maze to maze
+ *                made in m and replaced only when a larger maze needs more.
+ *   INPUTS: m -- the maze whose storage to allocate
+ *           (x_dim,y_dim) -- size of maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if out of memory
+ *   SIDE EFFECTS: sets m's maze_stride; may free and allocate m's planes,
+ *                 fruit_map, block_grid, and maze_queue
+ */
+static int alloc_maze(maze_t* m, int x_dim, int y_dim) {
+    int stride, size, entries, row, i;
+    void* mem;
+
+    stride = (2 * x_dim + 1 + MAZE_ROW_ALIGN - 1) & ~(MAZE_ROW_ALIGN - 1);
+    size = stride * (2 * y_dim + 3);
+    if (size > m->maze_size) {
+        free(m->wall_plane);
+        free(m->reach_plane);
+        free(m->block_grid);
+        m->wall_plane = m->reach_plane = NULL;
+        m->block_grid = NULL;
+        m->maze_size = 0;
+        if ((m->wall_plane = malloc(size / 8)) == NULL ||
+            (m->reach_plane = malloc(size / 8)) == NULL)
+            return -1;
+        if (posix_memalign(&mem, MAZE_ROW_ALIGN, size) != 0)
+            return -1;
+        m->block_grid = mem;
+        m->maze_size = size;
+    }
+    if (x_dim * y_dim > m->fruit_size) {
+        free(m->fruit_map);
+        m->fruit_size = 0;
+        if ((m->fruit_map = malloc(x_dim * y_dim)) == NULL)
+            return -1;
+        m->fruit_size = x_dim * y_dim;
+    }
+    if (maze_gen == MAZE_GEN_ELLER)
+        entries = ELLER_ENTRIES * x_dim;
+    else
+        entries = 2 * x_dim * y_dim;
+    if (entries > m->queue_size) {
+        free(m->maze_queue);
+        m->queue_size = 0;
+        if ((m->maze_queue = malloc(entries * sizeof (*m->maze_queue))) == NULL)
+            return -1;
+        m->queue_size = entries;
+    }
+    m->maze_stride = stride;
+
+    /* All walls, but for the padding after the right boundary. */
+    memset(m->wall_plane, 0xFF, size / 8);
+    for (row = 0; row < size; row += stride)
+        for (i = row + 2 * x_dim + 1; i < row + stride; i++)
+            PLANE_CLEAR(m->wall_plane, i);
+    memset(m->reach_plane, 0, size / 8);
+    memset(m->fruit_map, 0, x_dim * y_dim);
+    return 0;
+}
 
-    /* Mark the starting location as reached, then put it into the queue. */
-    q[0] = &maze[MAZE_INDEX(x, y)];
-    *(q[0]) |= MAZE_REACH;
-    q_start = 0;
-    q_end = 1;
+/*
+ * set_maze_generator
+ *   DESCRIPTION: Choose how make_maze generates mazes.
+ *   INPUTS: gen -- MAZE_GEN_UNION_FIND (the default), MAZE_GEN_SEARCH,
+ *                  or MAZE_GEN_ELLER
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: affects later calls to make_maze
+ */
+void set_maze_generator(maze_gen_t gen) {
+    maze_gen = gen;
+}
 
-    /* Loop until queue is empty. */
-    while (q_start != q_end) {
-        /* Get location from front of queue. */
-        cur = q[q_start++];
+/*
+ * set_maze_threads
+ *   DESCRIPTION: Choose the number of threads that dig mazes with worms.
+ *                The mazes made are the same for any number of threads.
+ *   INPUTS: n -- number of threads, limited to 1 to MAZE_MAX_THREADS
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: affects later calls to make_maze
+ */
+void set_maze_threads(int n) {
+    if (n < 1)
+        n = 1;
+    if (n > MAZE_MAX_THREADS)
+        n = MAZE_MAX_THREADS;
+    maze_threads = n;
+}
+
+/*
+ * seed_random
+ *   DESCRIPTION: Seed the maze's random number generator.  The four words
+ *                of state are spread from the seed with the SplitMix32
+ *                mixing function, which never leaves them all zero.
+ *   INPUTS: m -- the maze whose generator to seed
+ *           seed -- the seed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces rng_state
+ */
+static void seed_random(maze_t* m, unsigned int seed) {
+    unsigned int z;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        z = (seed += 0x9E3779B9);
+        z = (z ^ (z >> 16)) * 0x85EBCA6B;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35;
+        m->rng_state[i] = z ^ (z >> 16);
+    }
+}
+
+/*
+ * step_random
+ *   DESCRIPTION: Step a random number generator (xoshiro128**, by
+ *                Blackman and Vigna).
+ *   INPUTS: s -- the generator's state
+ *   OUTPUTS: s -- the next state
+ *   RETURN VALUE: 32 random bits
+ *   SIDE EFFECTS: none
+ */
+static unsigned int step_random(unsigned int s[4]) {
+    unsigned int r = s[1] * 5;
+    unsigned int t = s[1] << 9;
+
+    r = ((r << 7) | (r >> 25)) * 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 11) | (s[3] >> 21);
+    return r;
+}
 
+/*
+ * next_random
+ *   DESCRIPTION: Step the maze's random number generator.
+ *   INPUTS: m -- the maze whose generator to step
+ *   OUTPUTS: none
+ *   RETURN VALUE: 32 random bits
+ *   SIDE EFFECTS: advances rng_state
+ */
+static unsigned int next_random(maze_t* m) {
+    return step_random(m->rng_state);
+}
+
+/*
+ * random_below_from
+ *   DESCRIPTION: Pick a random integer in [0,n) with no bias.  The 32-bit
+ *                random value is scaled to the range with a multiply
+ *                (Lemire's method) instead of a division; values falling
+ *                in the short partial interval that would favor some
+ *                results are rejected, which rarely happens for small n.
+ *   INPUTS: s -- state of the random number generator to use
+ *           n -- size of range (positive)
+ *   OUTPUTS: s -- the next state
+ *   RETURN VALUE: the random integer
+ *   SIDE EFFECTS: none
+ */
+static int random_below_from(unsigned int s[4], int n) {
+    unsigned long long m = (unsigned long long)step_random(s) * n;
+    unsigned int threshold;
+
+    if ((unsigned int)m < (unsigned int)n) {
+        threshold = -(unsigned int)n % (unsigned int)n;
+        while ((unsigned int)m < threshold)
+            m = (unsigned long long)step_random(s) * n;
+    }
+    return (int)(m >> 32);
+}
+
+/*
+ * random_below
+ *   DESCRIPTION: Pick a random integer in [0,n) with no bias from the
+ *                maze's random number generator.
+ *   INPUTS: m -- the maze whose generator to use
+ *           n -- size of range (positive)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the random integer
+ *   SIDE EFFECTS: advances rng_state
+ */
+static int random_below(maze_t* m, int n) {
+    return random_below_from(m->rng_state, n);
+}
+
+/*
+ * connect_by_search
+ *   DESCRIPTION: Second phase of make_maze with MAZE_GEN_SEARCH.  Those
+ *                points connected to the point (1,1) are marked as
+ *                reachable.  Next, an unconnected point adjacent to a
+ *                connected point is chosen at random, and the wall between
+ *                them is removed, making another section of the maze
+ *                reachable from (1,1).  This process continues until most
+ *                of the maze is reachable or a certain number of attempts
+ *                have been made, at which point we scan the maze for such
+ *                adjacent pairs (rather than choosing randomly) until the
+ *                entire maze is reachable from (1,1).  Each new section
+ *                is marked with another search.
+ *   INPUTS: m -- the maze being made
+ *           (x,y) -- (odd,odd) lattice point at which to start scanning
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: removes walls; uses and then clears reach_plane
+ */
+static void connect_by_search(maze_t* m, int x, int y) {
+    int remaining, trials, at;
+
+    /* Start by marking everything connected to (1,1). */
+    remaining = m->maze_x_dim * m->maze_y_dim - mark_maze_area (m, 1, 1);
+    trials = 0;
+    do {
         /*
-         * Explore four directions from current position.  Maze
-         * construction guarantees that an adjacent open space implies
-         * that the subsequent space in the same direction both exists
-         * and is open (not a MAZE_WALL).
-         *
-         * Newly found locations are marked as reached before being
-         * added to the queue, which prevents the same location from
-         * being added when reached by multiple paths of equal length
-         * from the starting point.
+         * Once most of the maze is connected, or we have tried randomly
+         * "enough" times (arbitrarily defined as 100 times here, we scan
+         * the rest of the maze for opportunities for connecting new regions
+         * of the maze to the (1,1) lattice point.
          */
-        if ((cur[-2 * maze_x_dim] & MAZE_WALL) == 0 &&
-            (cur[-4 * maze_x_dim] & MAZE_REACH) == 0) {
-            cur[-4 * maze_x_dim] |= MAZE_REACH;
-            q[q_end++] = &cur[-4 * maze_x_dim];
+        if (remaining < 20 || ++trials > 100) {
+            if ((x += 2) > m->maze_x_dim * 2) {
+                x -= m->maze_x_dim * 2;
+                if ((y += 2) > 2 * m->maze_y_dim)
+                    y -= 2 * m->maze_y_dim;
+            }
+            at = MAZE_INDEX(x, y);
+            if (PLANE_TEST(m->reach_plane, at))
+                continue;
+        } else {
+            /* Pick an unconnected (odd,odd) lattice point at random. */
+            do {
+                x = random_below(m, m->maze_x_dim) * 2 + 1;
+                y = random_below(m, m->maze_y_dim) * 2 + 1;
+                at = MAZE_INDEX(x, y);
+            } while (PLANE_TEST(m->reach_plane, at));
         }
-        if ((cur[1] & MAZE_WALL) == 0 &&
-            (cur[2] & MAZE_REACH) == 0) {
-            cur[2] |= MAZE_REACH;
-            q[q_end++] = &cur[2];
+        /*
+         * Try to connect the unconnected point by knocking down a wall
+         * in some direction.
+         */
+        if (y > 1 && PLANE_TEST(m->reach_plane, at - 2 * m->maze_stride))
+            PLANE_CLEAR(m->wall_plane, at - m->maze_stride);
+        else if (x > 1 && PLANE_TEST(m->reach_plane, at - 2))
+            PLANE_CLEAR(m->wall_plane, at - 1);
+        else if (x < 2 * m->maze_x_dim - 1 && PLANE_TEST(m->reach_plane, at + 2))
+            PLANE_CLEAR(m->wall_plane, at + 1);
+        else if (y < 2 * m->maze_y_dim - 1 && PLANE_TEST(m->reach_plane, at + 2 * m->maze_stride))
+            PLANE_CLEAR(m->wall_plane, at + m->maze_stride);
+        else
+            continue;
+        /*
+         * Success!  Mark the newly connected portion of the maze
+         * as reachable.
+         */
+        remaining -= mark_maze_area(m, x, y);
+    } while (remaining > 0);
+
+    /*
+     * Remove the MAZE_REACH markers--these are reused to mark those
+     * portions of the maze already seen by the player.
+     */
+    memset(m->reach_plane, 0, m->maze_size / 8);
+}
+
+/*
+ * find_set
+ *   DESCRIPTION: Find the representative of a point's set for
+ *                connect_by_union, halving the path to it on the way.
+ *   INPUTS: set -- parent of each (odd,odd) point, by cell number
+ *           cell -- the point
+ *   OUTPUTS: none
+ *   RETURN VALUE: cell number of the representative
+ *   SIDE EFFECTS: shortens paths in set
+ */
+static int find_set(int* set, int cell) {
+    while (set[cell] != cell) {
+        set[cell] = set[set[cell]];
+        cell = set[cell];
+    }
+    return cell;
+}
+
+/*
+ * join_sets
+ *   DESCRIPTION: Join the sets of two points for connect_by_union.  The
+ *                representative with the larger cell number is put under
+ *                the other, so that every parent has a smaller cell number
+ *                than its child.
+ *   INPUTS: set -- parent of each (odd,odd) point, by cell number
+ *           a, b -- the points
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the sets were joined, 0 if a and b were already
+ *                 in the same set
+ *   SIDE EFFECTS: changes set
+ */
+static int join_sets(int* set, int a, int b) {
+    a = find_set(set, a);
+    b = find_set(set, b);
+    if (a == b)
+        return 0;
+    if (a < b)
+        set[b] = a;
+    else
+        set[a] = b;
+    return 1;
+}
+
+/*
+ * connect_by_union
+ *   DESCRIPTION: Second phase of make_maze with MAZE_GEN_UNION_FIND.  A
+ *                disjoint-set forest over the (odd,odd) points is built
+ *                from the openings left by the worms, so that each set is
+ *                one region of the maze.  The walls to the right of and
+ *                below each point are then taken in order from a random
+ *                starting point, and each one separating two sets is
+ *                removed, joining them, until one set remains.  Each
+ *                wall is considered at most once, so the phase takes
+ *                nearly linear time in the size of the maze, where
+ *                searching again after each removal can take time
+ *                quadratic in it.
+ *
+ *                The worms leave regions numbering about a tenth of the
+ *                points, so the work is in telling whether the two sides
+ *                of a wall are in the same set.  As parents always have
+ *                smaller cell numbers, one pass in cell order points every
+ *                point straight at its representative, and most walls are
+ *                then settled by comparing two entries.  (Taking the walls
+ *                in random order instead spends most of its time on cache
+ *                misses.)
+ *   INPUTS: m -- the maze being made
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: removes walls; uses maze_queue
+ */
+static void connect_by_union(maze_t* m) {
+    /*
+     * set is the parent of each (odd,odd) point, by cell number
+     * (x / 2 + y / 2 * maze_x_dim)
+     */
+    int* set = m->maze_queue;
+    int n_cells, n_sets, cell, x, y, i;
+
+    /*
+     * Put each point in the set of the point to its left if the worms
+     * opened the wall between them, or in a set of its own if not.
+     * Then join the sets of points opened to the points above them.
+     */
+    n_cells = n_sets = m->maze_x_dim * m->maze_y_dim;
+    for (y = 1, cell = 0; y < 2 * m->maze_y_dim; y += 2) {
+        for (x = 1; x < 2 * m->maze_x_dim; x += 2, cell++) {
+            if (x > 1 && !IS_WALL(x - 1, y)) {
+                set[cell] = set[cell - 1];
+                n_sets--;
+            } else {
+                set[cell] = cell;
+            }
+            if (y > 1 && !IS_WALL(x, y - 1))
+                n_sets -= join_sets(set, cell - m->maze_x_dim, cell);
         }
-        if ((cur[2 * maze_x_dim] & MAZE_WALL) == 0 &&
-            (cur[4 * maze_x_dim] & MAZE_REACH) == 0) {
-            cur[4 * maze_x_dim] |= MAZE_REACH;
-            q[q_end++] = &cur[4 * maze_x_dim];
+    }
+    for (cell = 0; cell < n_cells; cell++)
+        set[cell] = set[set[cell]];
+
+    /*
+     * Take the walls to the right of and below each point in turn until
+     * the sets are joined.
+     */
+    i = random_below(m, n_cells);
+    x = i % m->maze_x_dim * 2 + 1;
+    y = i / m->maze_x_dim * 2 + 1;
+    while (n_sets > 1) {
+        if (x < 2 * m->maze_x_dim - 1 && IS_WALL(x + 1, y) &&
+            set[i] != set[i + 1] && join_sets(set, i, i + 1)) {
+            PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x + 1, y));
+            n_sets--;
         }
-        if ((cur[-1] & MAZE_WALL) == 0 &&
-            (cur[-2] & MAZE_REACH) == 0) {
-            cur[-2] |= MAZE_REACH;
-            q[q_end++] = &cur[-2];
+        if (y < 2 * m->maze_y_dim - 1 && IS_WALL(x, y + 1) &&
+            set[i] != set[i + m->maze_x_dim] && join_sets(set, i, i + m->maze_x_dim)) {
+            PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x, y + 1));
+            n_sets--;
         }
+        i++;
+        if ((x += 2) > 2 * m->maze_x_dim) {
+            x = 1;
+            if ((y += 2) > 2 * m->maze_y_dim) {
+                y = 1;
+                i = 0;
+            }
+        }
+    }
+}
+
+/*
+ * row_coin
+ *   DESCRIPTION: Flip a coin from Eller's stream of random bits.
+ *   INPUTS: m -- the maze whose rows are being made
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 or 1, each with probability one half
+ *   SIDE EFFECTS: uses row_bits; may advance row_rng_state
+ */
+static int row_coin(maze_t* m) {
+    int coin;
+
+    if (m->n_row_bits == 0) {
+        m->row_bits = step_random(m->row_rng_state);
+        m->n_row_bits = 32;
+    }
+    coin = m->row_bits & 1;
+    m->row_bits >>= 1;
+    m->n_row_bits--;
+    return coin;
+}
+
+/*
+ * make_eller_row
+ *   DESCRIPTION: Generate the next row of (odd,odd) points with Eller's
+ *                algorithm, and complete the blocks of the lattice rows
+ *                that it settles.  The points of the row carry labels of
+ *                the sets they are connected to through the rows above.
+ *                Neighbors in different sets are joined at random (or
+ *                always, in the last row, which leaves one set), then
+ *                each set is opened downward at one or more random points
+ *                of the row.  The points below those openings keep their
+ *                labels in the next row, and the rest take labels no
+ *                longer in use.  As no wall is opened between points of
+ *                the same set, the maze has exactly one path between any
+ *                two points.
+ *
+ *                Labels are column numbers, and the sets of a row are a
+ *                disjoint-set forest over them (see join_sets), so the
+ *                state kept between rows is a few entries per column.
+ *   INPUTS: m -- the maze whose rows are being made
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: removes walls; advances eller_row and maze_rows_made;
+ *                 uses maze_queue
+ */
+static void make_eller_row(maze_t* m) {
+    int* label = m->maze_queue;             /* set of each point in the row */
+    int* set = label + m->maze_x_dim;       /* forest over the labels       */
+    int* last = set + m->maze_x_dim;        /* last column with each label  */
+    int* opened = last + m->maze_x_dim;     /* label opened downward        */
+    int* unused = opened + m->maze_x_dim;   /* labels free for the next row */
+    int last_row = (m->eller_row == m->maze_y_dim - 1);
+    int y = 2 * m->eller_row + 1;
+    int col, a, b, n_unused, bottom;
+
+    /* Open the points of the row, and join neighbors. */
+    for (col = 0; col < m->maze_x_dim; col++)
+        PLANE_CLEAR(m->wall_plane, MAZE_INDEX(2 * col + 1, y));
+    for (col = 0; col + 1 < m->maze_x_dim; col++) {
+        a = find_set(set, label[col]);
+        b = find_set(set, label[col + 1]);
+        if (a != b && (last_row || row_coin(m))) {
+            join_sets(set, a, b);
+            PLANE_CLEAR(m->wall_plane, MAZE_INDEX(2 * col + 2, y));
+        }
+    }
+
+    if (!last_row) {
+        /* Settle each point's set, and find where each set ends. */
+        for (col = 0; col < m->maze_x_dim; col++) {
+            label[col] = find_set(set, label[col]);
+            last[label[col]] = col;
+            opened[col] = 0;
+        }
+
+        /*
+         * Open points downward at random, and always at the last point of
+         * a set not yet opened.  Points left closed lose their labels.
+         */
+        for (col = 0; col < m->maze_x_dim; col++) {
+            a = label[col];
+            if (row_coin(m) || (col == last[a] && !opened[a])) {
+                opened[a] = 1;
+                PLANE_CLEAR(m->wall_plane, MAZE_INDEX(2 * col + 1, y + 1));
+            } else {
+                label[col] = -1;
+            }
+        }
+
+        /*
+         * Labels of sets not opened are free; there are as many as there
+         * are closed points, or more.  Every label starts the next row as
+         * a set of its own.
+         */
+        n_unused = 0;
+        for (a = 0; a < m->maze_x_dim; a++) {
+            if (!opened[a])
+                unused[n_unused++] = a;
+            set[a] = a;
+        }
+        for (col = 0; col < m->maze_x_dim; col++)
+            if (label[col] < 0)
+                label[col] = unused[--n_unused];
     }
+    m->eller_row++;
 
     /*
-     * The queue is empty.  The number of locations marked is just q_end,
-     * the number that passed through the queue.
+     * The blocks of a lattice row depend on the walls of the rows above
+     * and below it, so the row of walls under the points is complete
+     * only once the next row is made, unless this row is the last.
      */
-    return q_end;
+    bottom = (last_row ? 2 * m->maze_y_dim : y);
+#if (TEST_MAZE_GEN == 0)
+    for (a = m->maze_rows_made; a <= bottom; a++)
+        for (col = 0; col <= 2 * m->maze_x_dim; col++)
+            update_block(m, col, a);
+#endif
+    m->maze_rows_made = bottom + 1;
 }
 
 /*
- * make_maze
- *   DESCRIPTION: Create a maze of specified dimensions.  The maze is
- *                built as a two-dimensional lattice in which the points
- *       01234      with odd indices in both dimensions are always open,
- *     0 -----      those with even indices in both dimensions are always
- *     1 - ? -      walls, and other points are either open or walls to form
- *     2 -?*?-      the maze.  The maze to the left is a 2x2 example.  The
- *     3 - ? -      spaces are the four (odd,odd) lattice points.  The
- *     4 -----      boundary is marked with minus signs (these are always
- *            walls).  The one (even,even) lattice point--also always
- *            a wall--is marked with an asterisk.  Finally, the
- *            four question marks may or may not be walls; these
- *            four options are used to create different mazes.
- *
- *                The algorithm used consists of two phases.  In the first
- *                phase, metaphorical worms are dropped into the maze and
- *                allowed to wander about randomly, digging out the maze,
- *                until they decide to stop.  More worms are added until
- *                all of the (odd,odd) points have been cleared.  Each worm
- *              starts on an (odd,odd) point still marked as a wall.
- *
- *                Once the worms have done their work, the second phase
- *                of the algorithm begins.  This phase ensures that a path
- *                exists from any (odd,odd) lattice point to any other
- *                (odd,odd) point.  First, those points connected to the
- *                point (1,1) are marked as reachable.  Next, an unconnected
- *                point adjacent to a connected point is chosen at random,
- *                and the wall between them is removed, making another
- *                section of the maze reachable from (1,1).  This process
- *                continues until most of the maze is reachable or a
- *                certain number of attempts have been made, at which point
- *                we scan the maze for such adjacent pairs (rather than
- *                choosing randomly) until the entire maze is reachable
- *                from (1,1).
- *   INPUTS: (x_dim,y_dim) -- size of maze
- *           start_fruits -- number of fruits to place in maze
+ * make_maze_rows
+ *   DESCRIPTION: Generate rows of a maze made with MAZE_GEN_ELLER until
+ *                lattice row y and MAZE_ROWS_AHEAD rows after it are
+ *                complete, or the maze is.  Called through NEED_ROWS by
+ *                each function that reads the maze.
+ *   INPUTS: m -- the maze
+ *           y -- lattice row needed
  *   OUTPUTS: none
- *   RETURN VALUE: 0 on success, -1 on failure (if requested maze size
- *              exceeds limits set by defined values, with minimum
- *              (MAZE_MIN_X_DIM,MAZE_MIN_Y_DIM) and maximum
- *              (MAZE_MAX_X_DIM,MAZE_MAX_Y_DIM))
- *   SIDE EFFECTS: leaves MAZE_REACH markers on marked portion of maze
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: generates rows of the maze
  */
-int make_maze(int x_dim, int y_dim, int start_fruits) {
+static void make_maze_rows(maze_t* m, int y) {
+    while (m->maze_rows_made <= y + MAZE_ROWS_AHEAD && m->eller_row < m->maze_y_dim)
+        make_eller_row(m);
+}
+
+/*
+ * dig_tile
+ *   DESCRIPTION: The worm phase of make_maze for one tile, a band of rows
+ *                of (odd,odd) points.  Worms stay inside the tile, so the
+ *                walls between tiles are left standing, and the tile's
+ *                walls and start list share no words with other tiles;
+ *                tiles can thus be dug at the same time by different
+ *                threads.
+ *   INPUTS: m -- the maze being made
+ *           tile -- the tile to dig
+ *   OUTPUTS: tile -- the point at which the last worm stopped, and the
+ *                    next state of the tile's random number generator
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: removes walls in the tile; uses the tile's part of
+ *                 maze_queue
+ */
+static void dig_tile(maze_t* m, maze_tile_t* tile) {
     /*
      * worm turn weights; the first dimension is relative direction
      * (number of 90-degree turns clockwise from up); the second is
      * whether the resulting space is open (not a wall) or a wall.
      */
-    static int turn_wt[4][2] = {{1, 84}, {1, 9}, {3, 3}, {1, 9}};
+    static const int turn_wt[4][2] = {{1, 84}, {1, 9}, {3, 3}, {1, 9}};
 
-    int remaining, trials;
+    int y_min = 2 * tile->first_row + 1;    /* rows of points in tile */
+    int y_max = 2 * tile->end_row - 1;
+    int remaining;
     int x, y, wt[4], pick, dir, pref_dir, total, i;
-    unsigned char* cur;
-
-    /* Check the requested size, and save in local state if it is valid. */
-    if (x_dim < MAZE_MIN_X_DIM || x_dim > MAZE_MAX_X_DIM ||
-        y_dim < MAZE_MIN_Y_DIM || y_dim > MAZE_MAX_Y_DIM)
-        return -1;
-    maze_x_dim = x_dim;
-    maze_y_dim = y_dim;
-
-    /* Fill the maze with walls. */
-    memset(maze, MAZE_WALL, sizeof (maze));
-
-    /* Seed the random number generator. */
-    srandom(time (NULL));
+    int n_starts, at, *starts;
 
     /*
-     * 'worm' phase of maze generation
+     * Track the number of (odd,odd) lattice points still marked
+     * as MAZE_WALL.
      */
+    remaining = m->maze_x_dim * (tile->end_row - tile->first_row);
 
     /*
-     * Track the number of (odd,odd) lattice points still marked
-     * as MAZE_WALL.
+     * Worms start from points drawn out of a list of all (odd,odd)
+     * points in the tile (held in the tile's part of the search queue,
+     * which is not yet in use).  Points eaten by earlier worms are
+     * dropped from the list when drawn, so each start is uniform over
+     * the walls left, and the draws do not grow with the maze as picking
+     * points until one is a wall does.
      */
-    remaining = maze_x_dim * maze_y_dim;
+    starts = &m->maze_queue[tile->first_row * m->maze_x_dim];
+    n_starts = 0;
+    for (y = y_min; y <= y_max; y += 2)
+        for (x = 1; x < 2 * m->maze_x_dim; x += 2)
+            starts[n_starts++] = MAZE_INDEX(x, y);
     do {
     /* Pick an (odd,odd) lattice point still marked as a MAZE_WALL. */
         do {
-            x = (random() % maze_x_dim) * 2 + 1;
-            y = (random() % maze_y_dim) * 2 + 1;
-        } while ((maze[MAZE_INDEX(x, y)] & MAZE_WALL) == 0);
+            i = random_below_from(tile->rng, n_starts);
+            at = starts[i];
+            starts[i] = starts[--n_starts];
+        } while (!PLANE_TEST(m->wall_plane, at));
+        x = at % m->maze_stride;
+        y = at / m->maze_stride - 1;
 
         /* Empty the starting point. */
-        maze[MAZE_INDEX(x, y)] = MAZE_NONE;
+        PLANE_CLEAR(m->wall_plane, at);
         remaining--;
 
         /* The worm's initial preferred direction is random. */
-        pref_dir = (random() % 4);
+        pref_dir = random_below_from(tile->rng, 4);
 
         /* Move around the maze until worm turns back on itself. */
         while (1) {
@@ -285,19 +958,19 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
              * This code
              */
             total = 0;
-            if (y > 1)
-                total += turn_wt[pref_dir][maze[MAZE_INDEX(x, y - 2)] == MAZE_WALL];
+            if (y > y_min)
+                total += turn_wt[pref_dir][IS_WALL(x, y - 2)];
             wt[0] = total;
-            if (x < maze_x_dim * 2 - 1)
-                total += turn_wt[(pref_dir + 3) % 4][maze[MAZE_INDEX(x + 2, y)] == MAZE_WALL];
+            if (x < m->maze_x_dim * 2 - 1)
+                total += turn_wt[(pref_dir + 3) % 4][IS_WALL(x + 2, y)];
             wt[1] = total;
-            if (y < maze_y_dim * 2 - 1)
-                total += turn_wt[(pref_dir + 2) % 4][maze[MAZE_INDEX(x, y + 2)] == MAZE_WALL];
+            if (y < y_max)
+                total += turn_wt[(pref_dir + 2) % 4][IS_WALL(x, y + 2)];
             wt[2] = total;
             if (x > 1)
-                total += turn_wt[(pref_dir + 1) % 4][maze[MAZE_INDEX(x - 2, y)] == MAZE_WALL];
+                total += turn_wt[(pref_dir + 1) % 4][IS_WALL(x - 2, y)];
             wt[3] = total;
-            pick = (random() % total);
+            pick = random_below_from(tile->rng, total);
             for (dir = 0; pick >= wt[dir]; dir++);
 
             /* If worm decides to turn around, it's done. */
@@ -308,27 +981,27 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
             pref_dir = dir;
             switch (pref_dir) {
                 case 0:
-                    maze[MAZE_INDEX(x, y - 1)] = MAZE_NONE;
+                    PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x, y - 1));
                     y -=2;
                     break;
                 case 1:
-                    maze[MAZE_INDEX(x + 1, y)] = MAZE_NONE;
+                    PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x + 1, y));
                     x += 2;
                     break;
                 case 2:
-                    maze[MAZE_INDEX(x, y + 1)] = MAZE_NONE;
+                    PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x, y + 1));
                     y +=2;
                     break;
                 case 3:
-                    maze[MAZE_INDEX(x - 1, y)] = MAZE_NONE;
+                    PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x - 1, y));
                     x -= 2;
                     break;
             }
 
             /* If necessary, the worm 'eats' the wall at the new space. */
-            if (maze[MAZE_INDEX(x, y)] == MAZE_WALL)
+            if (IS_WALL(x, y))
             remaining--;
-            maze[MAZE_INDEX(x, y)] = MAZE_NONE;
+            PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x, y));
         } /* loop for one worm */
 
         /*
@@ -337,101 +1010,305 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
          */
     } while (remaining > 0);
 
-    /*
-     * Begin the second phase of the algorithm, in which we guarantee
-     * connectivity between all (odd,odd) lattice points in the maze.
-     * We start by marking everything connected to (1,1).
-     */
-    remaining = maze_x_dim * maze_y_dim - mark_maze_area (1, 1);
-    trials = 0;
+    tile->last_x = x;
+    tile->last_y = y;
+}
+
+/*
+ * dig_tiles
+ *   DESCRIPTION: Dig tiles of the maze until none are left; run by each
+ *                thread of the worm phase.
+ *   INPUTS: arg -- the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: digs tiles; advances next_tile
+ */
+static void* dig_tiles(void* arg) {
+    maze_t* m = arg;
+    int t;
+
+    while ((t = __sync_fetch_and_add(&m->next_tile, 1)) < m->n_tiles)
+        dig_tile(m, &m->maze_tiles[t]);
+    return NULL;
+}
+
+/*
+ * place_fruits
+ *   DESCRIPTION: Put the fruits and the exit of a new maze at random
+ *                (odd,odd) lattice points, the exit on a point with no
+ *                fruit.
+ *   INPUTS: m -- the maze to place fruits in
+ *           start_fruits -- number of fruits to place in maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets n_fruits, fruit_map, and the exit
+ */
+static void place_fruits(maze_t* m, int start_fruits) {
+    int x, y, i;
+
+    /* Put the required number of fruits in the maze. */
+    m->n_fruits = 0;
+    for (i = 0; i < start_fruits; i++)
+        add_a_fruit_internal(m);
+
+    /* Find an unfruited maze point and put the maze exit there. */
     do {
+        x = random_below(m, m->maze_x_dim) * 2 + 1;
+        y = random_below(m, m->maze_y_dim) * 2 + 1;
+    } while (FRUIT_BITS(x, y) != 0);
+    m->exit_x = x;
+    m->exit_y = y;
+}
+
+/*
+ * make_maze_in
+ *   DESCRIPTION: Create a maze of specified dimensions.  The maze is
+ *                built as a two-dimensional lattice in which the points
+ *       01234      with odd indices in both dimensions are always open,
+ *     0 -----      those with even indices in both dimensions are always
+ *     1 - ? -      walls, and other points are either open or walls to form
+ *     2 -?*?-      the maze.  The maze to the left is a 2x2 example.  The
+ *     3 - ? -      spaces are the four (odd,odd) lattice points.  The
+ *     4 -----      boundary is marked with minus signs (these are always
+ *            walls).  The one (even,even) lattice point--also always
+ *            a wall--is marked with an asterisk.  Finally, the
+ *            four question marks may or may not be walls; these
+ *            four options are used to create different mazes.
+ *
+ *                The algorithm used consists of two phases.  In the first
+ *                phase, metaphorical worms are dropped into the maze and
+ *                allowed to wander about randomly, digging out the maze,
+ *                until they decide to stop.  More worms are added until
+ *                all of the (odd,odd) points have been cleared.  Each worm
+ *              starts on an (odd,odd) point still marked as a wall.
+ *                A tall maze is dug in tiles, bands of rows that worms
+ *                do not leave, by as many threads as set_maze_threads
+ *                allows, and some walls between the tiles are then
+ *                removed at random.
+ *
+ *                Once the worms have done their work, the second phase
+ *                of the algorithm begins.  This phase ensures that a path
+ *                exists from any (odd,odd) lattice point to any other
+ *                (odd,odd) point, by removing walls between the regions
+ *                dug by the worms until they are all joined.  The regions
+ *                are tracked with a disjoint-set forest (connect_by_union)
+ *                or, as set by set_maze_generator, by searching the maze
+ *                again after each wall is removed (connect_by_search).
+ *
+ *                With MAZE_GEN_ELLER, neither phase is used.  Instead,
+ *                the rows of the maze are made one at a time with Eller's
+ *                algorithm (see make_eller_row) as the functions that read
+ *                the maze first need them, so that the time to start a
+ *                maze does not grow with its height.  Fruits and the exit
+ *                are placed at the start all the same.
+ *
+ *                Only the maze m is touched, so a maze may be made while
+ *                another is played (on another thread), as long as the
+ *                generator and threads are not changed meanwhile.
+ *   INPUTS: m -- the maze to make (from new_maze)
+ *           (x_dim,y_dim) -- size of maze
+ *           start_fruits -- number of fruits to place in maze
+ *           seed -- random seed; the same seed and size always give the
+ *                   same maze, and the same fruits added afterward
+ *   OUTPUTS: m -- the new maze
+ *   RETURN VALUE: 0 on success, -1 on failure (if requested maze size
+ *              exceeds limits set by defined values, with minimum
+ *              (MAZE_MIN_X_DIM,MAZE_MIN_Y_DIM) and maximum
+ *              (MAZE_MAX_X_DIM,MAZE_MAX_Y_DIM), or if memory for the
+ *              maze cannot be allocated)
+ *   SIDE EFFECTS: none
+ */
+int make_maze_in(maze_t* m, int x_dim, int y_dim, int start_fruits,
+                 unsigned int seed) {
+    pthread_t threads[MAZE_MAX_THREADS];
+    int x, y, i, t, n_threads;
+
+    /* Check the requested size, and save in local state if it is valid. */
+    if (x_dim < MAZE_MIN_X_DIM || x_dim > MAZE_MAX_X_DIM ||
+        y_dim < MAZE_MIN_Y_DIM || y_dim > MAZE_MAX_Y_DIM)
+        return -1;
+
+    /* Allocate the maze and fill it with walls. */
+    if (alloc_maze(m, x_dim, y_dim) != 0) {
+        m->maze_x_dim = m->maze_y_dim = 0;
+        return -1;
+    }
+    m->maze_x_dim = x_dim;
+    m->maze_y_dim = y_dim;
+
+    /* Seed the random number generator. */
+    seed_random(m, seed);
+
+    if (maze_gen == MAZE_GEN_ELLER) {
         /*
-         * Once most of the maze is connected, or we have tried randomly
-         * "enough" times (arbitrarily defined as 100 times here, we scan
-         * the rest of the maze for opportunities for connecting new regions
-         * of the maze to the (1,1) lattice point.
+         * Start the rows' own stream, and give each column of the
+         * first row a set of its own.  No rows are made yet.
          */
-        if (remaining < 20 || ++trials > 100) {
-            if ((x += 2) > maze_x_dim * 2) {
-                x -= maze_x_dim * 2;
-                if ((y += 2) > 2 * maze_y_dim)
-                    y -= 2 * maze_y_dim;
-            }
-            cur = &maze[MAZE_INDEX(x, y)];
-            if ((cur[0] & MAZE_REACH) != 0)
-                continue;
+        for (i = 0; i < 4; i++)
+            m->row_rng_state[i] = next_random(m);
+        m->row_rng_state[0] |= 1;
+        m->n_row_bits = 0;
+        for (i = 0; i < m->maze_x_dim; i++)
+            m->maze_queue[i] = m->maze_queue[m->maze_x_dim + i] = i;
+        m->eller_row = 0;
+        m->maze_rows_made = 0;
+        place_fruits(m, start_fruits);
+        return 0;
+    }
+
+    /*
+     * 'worm' phase of maze generation, tile by tile (see dig_tile).
+     * Tiles are MAZE_TILE_ROWS rows of points or so, whatever the number
+     * of threads, so a seed gives the same maze with any number of
+     * threads.  A maze with one tile is dug with the maze's own random
+     * number generator; otherwise each tile takes a generator of its own,
+     * seeded from the maze's.
+     */
+    m->n_tiles = (m->maze_y_dim + MAZE_TILE_ROWS - 1) / MAZE_TILE_ROWS;
+    for (t = 0; t < m->n_tiles; t++) {
+        m->maze_tiles[t].first_row = t * m->maze_y_dim / m->n_tiles;
+        m->maze_tiles[t].end_row = (t + 1) * m->maze_y_dim / m->n_tiles;
+        if (m->n_tiles == 1) {
+            memcpy(m->maze_tiles[t].rng, m->rng_state, sizeof (m->rng_state));
         } else {
-            /* Pick an unconnected (odd,odd) lattice point at random. */
-            do {
-                x = (random() % maze_x_dim) * 2 + 1;
-                y = (random() % maze_y_dim) * 2 + 1;
-                cur = &maze[MAZE_INDEX(x, y)];
-            } while ((cur[0] & MAZE_REACH) != 0);
+            for (i = 0; i < 4; i++)
+                m->maze_tiles[t].rng[i] = next_random(m);
+            m->maze_tiles[t].rng[0] |= 1;
         }
-        /*
-         * Try to connect the unconnected point by knocking down a wall
-         * in some direction.
-         */
-        if (y > 1 && (cur[-4 * maze_x_dim] & MAZE_REACH) != 0)
-            cur[-2 * maze_x_dim] = MAZE_NONE;
-        else if (x > 1 && (cur[-2] & MAZE_REACH) != 0)
-            cur[-1] = MAZE_NONE;
-        else if (x < 2 * maze_x_dim - 1 && (cur[2] & MAZE_REACH) != 0)
-            cur[1] = MAZE_NONE;
-        else if (y < 2 * maze_y_dim - 1 && (cur[4 * maze_x_dim] & MAZE_REACH) != 0)
-            cur[2 * maze_x_dim] = MAZE_NONE;
-        else
-            continue;
-        /*
-         * Success!  Mark the newly connected portion of the maze
-         * as reachable.
-         */
-        remaining -= mark_maze_area(x, y);
-    } while (remaining > 0);
+    }
+    m->next_tile = 0;
+    n_threads = (maze_threads < m->n_tiles ? maze_threads : m->n_tiles);
+    for (t = 1; t < n_threads; t++)
+        if (pthread_create(&threads[t], NULL, dig_tiles, m) != 0)
+            break;
+    n_threads = t;
+    (void)dig_tiles(m);
+    for (t = 1; t < n_threads; t++)
+        pthread_join(threads[t], NULL);
+    if (m->n_tiles == 1)
+        memcpy(m->rng_state, m->maze_tiles[0].rng, sizeof (m->rng_state));
 
     /*
-     * Remove the MAZE_REACH markers--these are reused to mark those
-     * portions of the maze already seen by the player.
+     * Stitch the tiles together, opening about as many walls across each
+     * seam as worms open between rows inside a tile (a little over half).
      */
-    for (x = 1; x < 2 * maze_x_dim; x += 2)
-        for (y = 1; y < 2 * maze_y_dim; y += 2)
-            maze[MAZE_INDEX(x, y)] &= ~MAZE_REACH;
+    for (t = 1; t < m->n_tiles; t++) {
+        y = 2 * m->maze_tiles[t].first_row;
+        for (x = 1; x < 2 * m->maze_x_dim; x += 2)
+            if (next_random(m) & 1)
+                PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x, y));
+    }
+    x = m->maze_tiles[m->n_tiles - 1].last_x;
+    y = m->maze_tiles[m->n_tiles - 1].last_y;
+
+    /*
+     * Begin the second phase of the algorithm, in which we guarantee
+     * connectivity between all (odd,odd) lattice points in the maze.
+     */
+    if (maze_gen == MAZE_GEN_SEARCH)
+        connect_by_search(m, x, y);
+    else
+        connect_by_union(m);
 
 #if 0 /* Be kind and show the maze boundary at start. */
-    for (x = 0; x < 2 * maze_x_dim; x++) {
-        maze[MAZE_INDEX(x, 0)] |= MAZE_REACH;
-        maze[MAZE_INDEX(x, 2 * maze_y_dim)] |= MAZE_REACH;
+    for (x = 0; x <= 2 * m->maze_x_dim; x++) {
+        PLANE_SET(m->reach_plane, MAZE_INDEX(x, 0));
+        PLANE_SET(m->reach_plane, MAZE_INDEX(x, 2 * m->maze_y_dim));
+    }
+    for (y = 0; y <= 2 * m->maze_y_dim; y++) {
+        PLANE_SET(m->reach_plane, MAZE_INDEX(0, y));
+        PLANE_SET(m->reach_plane, MAZE_INDEX(2 * m->maze_x_dim, y));
     }
-    /* The value at y == 2 * maze_y_dim is the bottom of the right boundary. */
-    for (y = 0; y <= 2 * maze_y_dim + 1; y++)
-        maze[MAZE_INDEX(0, y)] |= MAZE_REACH;
 #endif
 
+    /* The maze is complete. */
+    m->maze_rows_made = 2 * m->maze_y_dim + 1;
+
 #if GOD_MODE /* Remove all walls! */
-    for (x = 1; x < 2 * maze_x_dim; x++) {
-        for (y = 1; y < 2 * maze_y_dim; y++) {
-            maze[MAZE_INDEX(x, y)] = MAZE_NONE;
+    for (x = 1; x < 2 * m->maze_x_dim; x++) {
+        for (y = 1; y < 2 * m->maze_y_dim; y++) {
+            PLANE_CLEAR(m->wall_plane, MAZE_INDEX(x, y));
         }
     }
 #endif
 
-    /* Put the required number of fruits in the maze. */
-    n_fruits = 0;
-    for (i = 0; i < start_fruits; i++)
-        add_a_fruit_internal();
+    place_fruits(m, start_fruits);
 
-    /* Find an unfruited maze point and put the maze exit there. */
-    do {
-        x = (random() % maze_x_dim) * 2 + 1;
-        y = (random() % maze_y_dim) * 2 + 1;
-    } while ((maze[MAZE_INDEX(x, y)] & MAZE_FRUIT));
-    maze[MAZE_INDEX(x, y)] |= MAZE_EXIT;
-    exit_x = x;
-    exit_y = y;
+#if (TEST_MAZE_GEN == 0)
+    /* Record the block to be drawn at every lattice point. */
+    build_block_grid(m);
+#endif
 
     return 0;
 }
 
+/*
+ * make_maze
+ *   DESCRIPTION: Create a maze of specified dimensions as the current
+ *                maze (see make_maze_in).
+ *   INPUTS: (x_dim,y_dim) -- size of maze
+ *           start_fruits -- number of fruits to place in maze
+ *           seed -- random seed
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: replaces the current maze's contents, allocating the
+ *                 current maze if there is none
+ */
+int make_maze(int x_dim, int y_dim, int start_fruits, unsigned int seed) {
+    if (cur_maze == NULL && (cur_maze = new_maze()) == NULL)
+        return -1;
+    return make_maze_in(cur_maze, x_dim, y_dim, start_fruits, seed);
+}
+
+/*
+ * new_maze
+ *   DESCRIPTION: Allocate a maze with no contents; make_maze_in fills it.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the maze, or NULL if out of memory
+ *   SIDE EFFECTS: allocates memory
+ */
+maze_t* new_maze() {
+    return calloc(1, sizeof (maze_t));
+}
+
+/*
+ * free_maze
+ *   DESCRIPTION: Free a maze and its storage.  The maze must not be the
+ *                current maze.
+ *   INPUTS: m -- the maze (from new_maze), or NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees memory
+ */
+void free_maze(maze_t* m) {
+    if (m == NULL)
+        return;
+    free(m->wall_plane);
+    free(m->reach_plane);
+    free(m->block_grid);
+    free(m->fruit_map);
+    free(m->maze_queue);
+    free(m);
+}
+
+/*
+ * use_maze
+ *   DESCRIPTION: Make a maze the current maze, on which the rest of the
+ *                functions in maze.h act.  Swapping in a maze made ahead
+ *                of time with make_maze_in costs nothing more.
+ *   INPUTS: m -- the maze (from new_maze)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the maze that was current, or NULL if none
+ *   SIDE EFFECTS: changes the current maze
+ */
+maze_t* use_maze(maze_t* m) {
+    maze_t* old = cur_maze;
+
+    cur_maze = m;
+    return old;
+}
+
 /*
  * The functions inside the preprocessor block below rely on block image
  * data in blocks.s.  These external data are neither available nor
@@ -441,51 +1318,116 @@ int make_maze(int x_dim, int y_dim, int start_fruits) {
 #if (TEST_MAZE_GEN == 0)
 
 /*
- * find_block
- *   DESCRIPTION: Find the appropriate image to be used for a given maze
+ * get_maze_block
+ *   DESCRIPTION: Find the appropriate block to be used for a given maze
  *                lattice point.
  *   INPUTS: (x,y) -- the maze lattice point
  *   OUTPUTS: none
- *   RETURN VALUE: a pointer to an image of a BLOCK_X_DIM x BLOCK_Y_DIM
- *                 block of data with one byte per pixel laid out as a
- *                 C array of dimension [BLOCK_Y_DIM][BLOCK_X_DIM]
+ *   RETURN VALUE: the block number (an index into blocks)
+ *   SIDE EFFECTS: may generate rows of the maze (see make_maze_rows)
+ */
+int get_maze_block(int x, int y) {
+    maze_t* m = cur_maze;  /* maze played */
+
+    NEED_ROWS(y);
+    return m->block_grid[MAZE_INDEX(x, y)];
+}
+
+/*
+ * resolve_block
+ *   DESCRIPTION: Work out the block to be used for a given maze lattice
+ *                point from the maze bits at the point and its four
+ *                neighbors.
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the maze lattice point
+ *   OUTPUTS: none
+ *   RETURN VALUE: the block number (an index into blocks)
  *   SIDE EFFECTS: none
  */
-static unsigned char* find_block(int x, int y) {
+static int resolve_block(maze_t* m, int x, int y) {
     int fnum;     /* fruit found                           */
     int pattern;  /* stencil pattern for surrounding walls */
 
     /* Record whether fruit is present. */
-    fnum = (maze[MAZE_INDEX(x, y)] & MAZE_FRUIT) / MAZE_FRUIT_1;
+    fnum = ((x & y & 1) ? FRUIT_BITS(x, y) / MAZE_FRUIT_1 : 0);
 
     /* The exit is always visible once the last fruit is collected. */
-    if (n_fruits == 0 && (maze[MAZE_INDEX(x, y)] & MAZE_EXIT) != 0)
-        return (unsigned char*)blocks[BLOCK_EXIT];
+    if (m->n_fruits == 0 && x == m->exit_x && y == m->exit_y)
+        return BLOCK_EXIT;
 
     /*
      * Everything else not reached is shrouded in mist, although fruits
      * show up as bumps.
      */
-    if ((maze[MAZE_INDEX(x, y)] & MAZE_REACH) == 0) {
+    if (!IS_REACHED(x, y)) {
         if (fnum != 0)
-            return (unsigned char*)blocks[BLOCK_FRUIT_SHADOW];
-        return (unsigned char*)blocks[BLOCK_SHADOW];
+            return BLOCK_FRUIT_SHADOW;
+        return BLOCK_SHADOW;
     }
 
     /* Show fruit. */
     if (fnum != 0)
-        return (unsigned char*)blocks[BLOCK_FRUIT_1 + fnum - 1];
+        return BLOCK_FRUIT_1 + fnum - 1;
 
     /* Show empty space. */
-    if ((maze[MAZE_INDEX(x, y)] & MAZE_WALL) == 0)
-        return (unsigned char*)blocks[BLOCK_EMPTY];
+    if (!IS_WALL(x, y))
+        return BLOCK_EMPTY;
 
     /* Show different types of walls. */
-    pattern = (((maze[MAZE_INDEX(x, y - 1)] & MAZE_WALL) != 0) << 0) |
-              (((maze[MAZE_INDEX(x + 1, y)] & MAZE_WALL) != 0) << 1) |
-              (((maze[MAZE_INDEX(x, y + 1)] & MAZE_WALL) != 0) << 2) |
-              (((maze[MAZE_INDEX(x - 1, y)] & MAZE_WALL) != 0) << 3);
-    return (unsigned char*)blocks[pattern];
+    pattern = (IS_WALL(x, y - 1) << 0) |
+              (IS_WALL(x + 1, y) << 1) |
+              (IS_WALL(x, y + 1) << 2) |
+              (IS_WALL(x - 1, y) << 3);
+    return pattern;
+}
+
+/*
+ * update_block
+ *   DESCRIPTION: Record the block for a lattice point after its maze bits
+ *                (or the number of fruits, for the exit) change.
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the maze lattice point
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes block_grid
+ */
+static void update_block(maze_t* m, int x, int y) {
+    m->block_grid[MAZE_INDEX(x, y)] = resolve_block(m, x, y);
+}
+
+/*
+ * show_block
+ *   DESCRIPTION: Draw the block recorded for a lattice point.  Rows of a
+ *                maze not yet made cannot be in view (see NEED_ROWS), so
+ *                their blocks are not drawn; the blocks are recorded
+ *                again when the rows are made.
+ *   INPUTS: m -- the maze
+ *           (x,y) -- the maze lattice point
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may draw to the screen
+ */
+static void show_block(maze_t* m, int x, int y) {
+    if (y < m->maze_rows_made)
+        draw_tile(x * BLOCK_X_DIM, y * BLOCK_Y_DIM,
+                  m->block_grid[MAZE_INDEX(x, y)]);
+}
+
+/*
+ * build_block_grid
+ *   DESCRIPTION: Record the block for every lattice point of the maze,
+ *                including the bottom and right boundaries.
+ *   INPUTS: m -- the maze
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills block_grid
+ */
+static void build_block_grid(maze_t* m) {
+    int x, y;   /* loop indices over lattice points */
+
+    for (y = 0; y <= 2 * m->maze_y_dim; y++)
+        for (x = 0; x <= 2 * m->maze_x_dim; x++)
+            update_block(m, x, y);
 }
 
 /*
@@ -497,25 +1439,29 @@ static unsigned char* find_block(int x, int y) {
  *   INPUTS: (x,y) -- leftmost pixel of line to be drawn
  *   OUTPUTS: buf -- buffer holding image data for the line
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may generate rows of the maze (see make_maze_rows)
  */
 void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]) {
+    maze_t* m = cur_maze; /* maze played                                   */
     int map_x, map_y;     /* maze lattice point of the first block on line */
     int sub_x, sub_y;     /* sub-block address                             */
     int idx;              /* loop index over pixels in the line            */
     unsigned char* block; /* pointer to current maze block image           */
+    unsigned char* grid;  /* block number of current lattice point         */
 
     /* Find the maze lattice point and the pixel address within that block. */
     map_x = x / BLOCK_X_DIM;
     map_y = y / BLOCK_Y_DIM;
     sub_x = x - map_x * BLOCK_X_DIM;
     sub_y = y - map_y * BLOCK_Y_DIM;
+    NEED_ROWS(map_y);
+    grid = &m->block_grid[MAZE_INDEX(map_x, map_y)];
 
     /* Loop over pixels in line. */
     for (idx = 0; idx < SCROLL_X_DIM; ) {
 
         /* Find address of block to be drawn. */
-        block = find_block(map_x++, map_y) + sub_y * BLOCK_X_DIM + sub_x;
+        block = &blocks[*grid++][sub_y][sub_x];
 
         /* Write block colors from one line into buffer. */
         for (; idx < SCROLL_X_DIM && sub_x < BLOCK_X_DIM; idx++, sub_x++)
@@ -538,25 +1484,29 @@ void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]) {
  *   INPUTS: (x,y) -- top pixel of line to be drawn
  *   OUTPUTS: buf -- buffer holding image data for the line
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may generate rows of the maze (see make_maze_rows)
  */
 void fill_vert_buffer(int x, int y, unsigned char buf[SCROLL_Y_DIM]) {
+    maze_t* m = cur_maze; /* maze played                                   */
     int map_x, map_y;     /* maze lattice point of the first block on line */
     int sub_x, sub_y;     /* sub-block address                             */
     int idx;              /* loop index over pixels in the line            */
     unsigned char* block; /* pointer to current maze block image           */
+    unsigned char* grid;  /* block number of current lattice point         */
 
     /* Find the maze lattice point and the pixel address within that block. */
     map_x = x / BLOCK_X_DIM;
     map_y = y / BLOCK_Y_DIM;
     sub_x = x - map_x * BLOCK_X_DIM;
     sub_y = y - map_y * BLOCK_Y_DIM;
+    NEED_ROWS(map_y + SCROLL_Y_DIM / BLOCK_Y_DIM + 1);
+    grid = &m->block_grid[MAZE_INDEX(map_x, map_y)];
 
     /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; ) {
+    for (idx = 0; idx < SCROLL_Y_DIM; grid += m->maze_stride) {
 
         /* Find address of block to be drawn. */
-        block = find_block(map_x, map_y++) + sub_y * BLOCK_X_DIM + sub_x;
+        block = &blocks[*grid][sub_y][sub_x];
 
         /* Write block colors from one line into buffer. */
         for (; idx < SCROLL_Y_DIM && sub_y < BLOCK_Y_DIM;
@@ -581,37 +1531,26 @@ void fill_vert_buffer(int x, int y, unsigned char buf[SCROLL_Y_DIM]) {
  *   INPUTS: (x,y) -- the lattice point to be unveiled
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: may draw to the screen
+ *   SIDE EFFECTS: may draw to the screen; may generate rows of the maze
  */
 void unveil_space(int x, int y) {
-    unsigned char* cur; /* pointer to the maze lattice point */
-
-    /*
-     * There's a wee bitty little bug in this function in the sense
-     * that, if the left boundary is exposed, and the player reaches
-     * the right boundary without scrolling the screen, the right
-     * boundary will not be redrawn, and will appear to remain obscured.
-     * One fix is to draw both left and right boundaries when unveiling
-     * a left/right boundary block.  But it doesn't matter much, since
-     * left and right boundaries aren't on the screen at the same time
-     * anyway for our mazes.
-     */
+    maze_t* m = cur_maze;  /* maze played                     */
+    int at;                /* index of the maze lattice point */
 
-    /*
-     * Allow exposure of bottom and right boundaries (left and right
-     * boundaries are the same lattice point in the maze).
-     */
-    if (x < 0 || x > 2 * maze_x_dim || y < 0 || y > 2 * maze_y_dim)
+    /* Allow exposure of bottom and right boundaries. */
+    if (x < 0 || x > 2 * m->maze_x_dim || y < 0 || y > 2 * m->maze_y_dim)
         return;
 
     /* Has the location already been seen?  If so, do nothing. */
-    cur = &maze[MAZE_INDEX(x, y)];
-    if (*cur & MAZE_REACH)
+    NEED_ROWS(y);
+    at = MAZE_INDEX(x, y);
+    if (PLANE_TEST(m->reach_plane, at))
         return;
 
     /* Unveil the location and redraw it. */
-    *cur |= MAZE_REACH;
-    draw_full_block (x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(x, y));
+    PLANE_SET(m->reach_plane, at);
+    update_block(m, x, y);
+    show_block(m, x, y);
 }
 
 /*
@@ -626,29 +1565,35 @@ void unveil_space(int x, int y) {
  *                 is eaten, the maze exit)
  */
 int check_for_fruit(int x, int y) {
-    int fnum;  /* fruit number found */
+    maze_t* m = cur_maze;  /* maze played        */
+    int fnum;              /* fruit number found */
 
     /* If outside the feasible fruit range, return no fruit. */
-    if (x < 0 || x >= 2 * maze_x_dim || y < 0 || y >= 2 * maze_y_dim)
+    if (x < 0 || x >= 2 * m->maze_x_dim || y < 0 || y >= 2 * m->maze_y_dim)
         return 0;
 
-    /* Calculate the fruit number. */
-    fnum = (maze[MAZE_INDEX(x, y)] & MAZE_FRUIT) / MAZE_FRUIT_1;
+    /* Calculate the fruit number; only (odd,odd) points hold fruit. */
+    if ((x & y & 1) == 0)
+        return 0;
+    fnum = FRUIT_BITS(x, y) / MAZE_FRUIT_1;
 
     /* If fruit was present... */
     if (fnum != 0) {
         /* ...remove it. */
-        maze[MAZE_INDEX(x, y)] &= ~MAZE_FRUIT;
+        FRUIT_BITS(x, y) = MAZE_NONE;
+        update_block(m, x, y);
 
     /* Update the count of fruits. */
-    --n_fruits;
+    --m->n_fruits;
 
     /* The exit may appear. */
-    if (n_fruits == 0)
-        draw_full_block (exit_x * BLOCK_X_DIM, exit_y * BLOCK_Y_DIM, find_block(exit_x, exit_y));
+    if (m->n_fruits == 0) {
+        update_block(m, m->exit_x, m->exit_y);
+        show_block(m, m->exit_x, m->exit_y);
+    }
 
         /* Redraw the space with no fruit. */
-        draw_full_block (x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(x, y));
+        show_block(m, x, y);
     }
 
     /* Return the fruit number found. */
@@ -666,12 +1611,14 @@ int check_for_fruit(int x, int y) {
  *   SIDE EFFECTS: none
  */
 int check_for_win(int x, int y) {
+    maze_t* m = cur_maze;  /* maze played */
+
     /* Check that position falls within valid boundaries for exit. */
-    if (x < 0 || x >= 2 * maze_x_dim || y < 0 || y >= 2 * maze_y_dim)
+    if (x < 0 || x >= 2 * m->maze_x_dim || y < 0 || y >= 2 * m->maze_y_dim)
         return 0;
 
     /* Return win condition. */
-    return (n_fruits == 0 && (maze[MAZE_INDEX(x, y)] & MAZE_EXIT) != 0);
+    return (m->n_fruits == 0 && x == m->exit_x && y == m->exit_y);
 }
 
 /*
@@ -679,12 +1626,13 @@ int check_for_win(int x, int y) {
  *   DESCRIPTION: Add a fruit to a random (odd,odd) lattice point in the
  *                maze.  Update the number of fruits, including the displayed
  *                value.  If requested, draw the new fruit on the screen.
- *   INPUTS: show -- 1 if new fruit should be drawn, 0 if not
+ *   INPUTS: m -- the maze to add the fruit to
+ *           show -- 1 if new fruit should be drawn, 0 if not
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: changes displayed fruit value, may draw to screen
  */
-static void _add_a_fruit(int show) {
+static void _add_a_fruit(maze_t* m, int show) {
     int x, y;    /* lattice point for new fruit */
 
     /*
@@ -692,19 +1640,20 @@ static void _add_a_fruit(int show) {
      * maze exit, if that is already defined.
      */
     do {
-        x = (random() % maze_x_dim) * 2 + 1;
-        y = (random() % maze_y_dim) * 2 + 1;
-    } while ((maze[MAZE_INDEX(x, y)] & MAZE_FRUIT));
+        x = random_below(m, m->maze_x_dim) * 2 + 1;
+        y = random_below(m, m->maze_y_dim) * 2 + 1;
+    } while (FRUIT_BITS(x, y) != 0);
 
     /* Add a random fruit to that location. */
-    maze[MAZE_INDEX(x, y)] |= ((random() % NUM_FRUIT_TYPES) + 1) * MAZE_FRUIT_1;
+    FRUIT_BITS(x, y) = (random_below(m, NUM_FRUIT_TYPES) + 1) * MAZE_FRUIT_1;
 
     /* Update the number of fruits. */
-    ++n_fruits;
+    ++m->n_fruits;
+    update_block(m, x, y);
 
     /* If necessary, draw the fruit on the screen. */
     if (show)
-    draw_full_block (x * BLOCK_X_DIM, y * BLOCK_Y_DIM, find_block(x, y));
+        show_block(m, x, y);
 }
 
 /*
@@ -719,16 +1668,19 @@ static void _add_a_fruit(int show) {
  *   SIDE EFFECTS: changes displayed fruit value, may draw to screen
  */
 int add_a_fruit() {
+    maze_t* m = cur_maze;  /* maze played */
+
     /* Most of the work is done by a helper function. */
-    _add_a_fruit(1);
+    _add_a_fruit(m, 1);
 
     /* The exit may disappear. */
-    if (n_fruits == 1)
-    draw_full_block (exit_x * BLOCK_X_DIM, exit_y * BLOCK_Y_DIM,
-             find_block(exit_x, exit_y));
+    if (m->n_fruits == 1) {
+        update_block(m, m->exit_x, m->exit_y);
+        show_block(m, m->exit_x, m->exit_y);
+    }
 
     /* Return the current number of fruits in the maze. */
-    return n_fruits;
+    return m->n_fruits;
 }
 
 /*
@@ -736,17 +1688,17 @@ int add_a_fruit() {
  *   DESCRIPTION: Add a fruit to a random (odd,odd) lattice point in the
  *                maze.  Update the number of fruits, including the displayed
  *                value.
- *   INPUTS: none
+ *   INPUTS: m -- the maze to add the fruit to
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: changes displayed fruit value
  */
-static void add_a_fruit_internal() {
+static void add_a_fruit_internal(maze_t* m) {
     /*
      * Call a helper function, indicating that fruit should not be drawn
      * on the screen at this point.
      */
-    _add_a_fruit(0);
+    _add_a_fruit(m, 0);
 }
 
 /*
@@ -789,13 +1741,16 @@ unsigned char* get_player_mask(dir_t cur_dir) {
  *   OUTPUTS: open[] -- array of boolean values indicating that a direction
  *                   is open; indexed by DIR_* enumeration values
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may generate rows of the maze (see make_maze_rows)
  */
 void find_open_directions(int x, int y, int op[NUM_DIRS]) {
-    op[DIR_UP]    = (0 == (maze[MAZE_INDEX(x, y - 1)] & MAZE_WALL));
-    op[DIR_RIGHT] = (0 == (maze[MAZE_INDEX(x + 1, y)] & MAZE_WALL));
-    op[DIR_DOWN]  = (0 == (maze[MAZE_INDEX(x, y + 1)] & MAZE_WALL));
-    op[DIR_LEFT]  = (0 == (maze[MAZE_INDEX(x - 1, y)] & MAZE_WALL));
+    maze_t* m = cur_maze;  /* maze played */
+
+    NEED_ROWS(y);
+    op[DIR_UP]    = !IS_WALL(x, y - 1);
+    op[DIR_RIGHT] = !IS_WALL(x + 1, y);
+    op[DIR_DOWN]  = !IS_WALL(x, y + 1);
+    op[DIR_LEFT]  = !IS_WALL(x - 1, y);
 }
 
 #else /* TEST_MAZE_GEN == 1 */
@@ -813,23 +1768,27 @@ void find_open_directions(int x, int y, int op[NUM_DIRS]) {
  *   SIDE EFFECTS: prints to stdout
  */
 void print_maze() {
-    int i;  /* vertical loop index   */
-    int j;  /* horizontal loop index */
+    maze_t* m = cur_maze;  /* maze played           */
+    int i;                 /* vertical loop index   */
+    int j;                 /* horizontal loop index */
+
+    /* Make the whole maze first. */
+    NEED_ROWS(2 * m->maze_y_dim);
 
     /* Loop over maze rows. */
-    for (i = 0; i <= 2 * maze_y_dim; i++) {
+    for (i = 0; i <= 2 * m->maze_y_dim; i++) {
 
         /* Loop over maze columns. */
-        for (j = 0; j <= 2 * maze_x_dim; j++) {
+        for (j = 0; j <= 2 * m->maze_x_dim; j++) {
 
             /*
              * Print open spaces and walls, reached and unreached, as
              * distinct characters.
              */
             printf("%c",
-                  ((maze[MAZE_INDEX(j, i)] & MAZE_WALL) ?
-                  ((maze[MAZE_INDEX(j, i)] & MAZE_REACH) ? '*' : '%') :
-                  ((maze[MAZE_INDEX(j, i)] & MAZE_REACH) ? '.' : ' ')));
+                  (IS_WALL(j, i) ?
+                  (IS_REACHED(j, i) ? '*' : '%') :
+                  (IS_REACHED(j, i) ? '.' : ' ')));
         }
 
         /* End the printed line. */
@@ -841,7 +1800,7 @@ void print_maze() {
  * This function is called in maze generation. We define a stub to keep
  * the linker happy.
  */
-static void add_a_fruit_internal() {}
+static void add_a_fruit_internal(maze_t* m) {}
 
 /*
  * main
@@ -852,7 +1811,7 @@ static void add_a_fruit_internal() {}
  *   RETURN VALUE: 0 on success (always!)
  */
 int main() {
-    make_maze(20, 20, 0);
+    make_maze(20, 20, 0, time(NULL));
     print_maze();
     return 0;
 }
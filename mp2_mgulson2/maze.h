@@ -46,12 +46,13 @@
  * Define maze minimum and maximum dimensions.  The description of make_maze
  * in maze.c gives details on the layout of the maze.  Minimum values are
  * chosen to ensure that a maze fills the scrolling region of the screen.
- * Maximum values are somewhat arbitrary.
+ * Maximum values only bound the memory make_maze allocates (about 64 MB
+ * each for the maze and its block grid at the maximum).
  */
 #define MAZE_MIN_X_DIM ((SCROLL_X_DIM + (BLOCK_X_DIM - 1) + 2 * SHOW_MIN) / (2 * BLOCK_X_DIM))
-#define MAZE_MAX_X_DIM 50
+#define MAZE_MAX_X_DIM 4096
 #define MAZE_MIN_Y_DIM ((SCROLL_Y_DIM + (BLOCK_Y_DIM - 1) + 2 * SHOW_MIN) / (2 * BLOCK_Y_DIM))
-#define MAZE_MAX_Y_DIM 30
+#define MAZE_MAX_Y_DIM 4096
 
 /* bit vector of properties for spaces in the maze */
 typedef enum {
@@ -66,8 +67,45 @@ typedef enum {
     MAZE_REACH          = 128   /* seen already (not shrouded in mist)      */
 } maze_bit_t;
 
-/* create a maze and place some fruits inside it */
-extern int make_maze(int x_dim, int y_dim, int start_fruits);
+/* ways for make_maze to generate a maze */
+typedef enum {
+    MAZE_GEN_UNION_FIND,        /* worms, then disjoint sets joined     */
+    MAZE_GEN_SEARCH,            /* worms, then searches after each join */
+    MAZE_GEN_ELLER              /* rows made as needed, by Eller's      */
+} maze_gen_t;
+
+/* choose how make_maze generates later mazes */
+extern void set_maze_generator(maze_gen_t gen);
+
+/* most threads that make_maze uses to dig a maze with worms */
+#define MAZE_MAX_THREADS 64
+
+/* choose the number of threads that make_maze uses (1 by default) */
+extern void set_maze_threads(int n);
+
+/*
+ * a maze with everything kept for it; the functions below other than
+ * make_maze_in act on the current maze (see use_maze)
+ */
+typedef struct maze_t maze_t;
+
+/* allocate an empty maze, or free one that is not current */
+extern maze_t* new_maze();
+extern void free_maze(maze_t* m);
+
+/* make a maze current, returning the one that was */
+extern maze_t* use_maze(maze_t* m);
+
+/* create a maze in m, which need not be current (may run on any thread) */
+extern int make_maze_in(maze_t* m, int x_dim, int y_dim, int start_fruits,
+                        unsigned int seed);
+
+/* create the current maze from a random seed and place some fruits inside it */
+extern int make_maze(int x_dim, int y_dim, int start_fruits,
+                     unsigned int seed);
+
+/* find the block number (BLOCK_*) to draw at a maze lattice point */
+extern int get_maze_block(int x, int y);
 
 /* fill a buffer with the pixels for a horizontal line of the maze */
 extern void fill_horiz_buffer(int x, int y, unsigned char buf[SCROLL_X_DIM]);
@@ -38,9 +38,12 @@
 #include <string.h>
 
 #include "blocks.h"
+#include "frame_timing.h"
 #include "maze.h"
 #include "modex.h"
+#include "replay.h"
 #include "text.h"
+#include "vga_emu.h"
 
 // New Includes and Defines
 #include <linux/rtc.h>
@@ -61,31 +64,7 @@
 #define LEFT      68
 
 
-//For draw_status_bar from modex.h and modex.c
-
-#define IMAGE_X_DIM     320   /* pixels; must be divisible by 4             */
-//#define IMAGE_Y_DIM     200   /* pixels                                     */
-#define IMAGE_X_WIDTH   (IMAGE_X_DIM / 4)          /* addresses (bytes)     */
-//#define SCROLL_X_DIM    IMAGE_X_DIM                /* full image width      */
-//#define SCROLL_Y_DIM    IMAGE_Y_DIM               /* full image width      */
-#define SCROLL_X_WIDTH  (IMAGE_X_DIM / 4)          /* addresses (bytes)     */
-
-
-
-#define SCROLL_SIZE             (SCROLL_X_WIDTH * SCROLL_Y_DIM)
-#define NEW_SCROLL_SIZE         (SCROLL_X_WIDTH * SCROLL_Y_DIM-18)
-#define SCREEN_SIZE             (SCROLL_SIZE * 4 + 1)
-#define NEW_SCREEN_SIZE         (NEW_SCROLL_SIZE * 4 + 1)
-#define BUILD_BUF_SIZE          (NEW_SCREEN_SIZE + 20000)
-#define BUILD_BASE_INIT         ((BUILD_BUF_SIZE - NEW_SCREEN_SIZE) / 2)
-//#define STATUS_BAR_LOCATION 200-18
-
-
-
-//constants for status bar
-#define STATUS_BAR_HEIGHT		    18
-#define STATUS_BUILD_SIZE  		 (STATUS_BAR_HEIGHT*IMAGE_X_DIM)
-#define NEW_MEMORY_SIZE         1600-STATUS_BUILD_SIZE
+//status bar character positions
 #define LEVEL                   10
 #define FRUIT                   14
 #define TIMEMIN1                31
@@ -131,7 +110,21 @@ typedef struct {
 
 static game_info_t game_info;
 
+/* seed of the game; each level's maze is made from it and the level */
+static unsigned int game_seed;
+
+/* next level's maze, made by a worker thread while a level is played */
+static maze_t* next_maze;        /* spare maze, swapped in by use_maze */
+static game_info_t next_info;    /* parameters next_maze is made with  */
+static int next_maze_ret;        /* make_maze_in result for next_maze  */
+static int next_maze_busy;       /* 1 while the worker must be joined  */
+static pthread_t next_maze_tid;
+
 /* local functions--see function headers for details */
+static void set_level_params(game_info_t* info, int level);
+static void* next_maze_thread(void* arg);
+static void start_next_maze(int level);
+static int take_next_maze(int level);
 static int prepare_maze_level(int level);
 static void move_up(int* ypos);
 static void move_right(int* xpos);
@@ -144,13 +137,20 @@ static void *keyboard_thread(void *arg);
 static unsigned char status_build[STATUS_BUILD_SIZE];
 static void set_status_bar_text(char * status_bar_text, int levelNum, int fruit, int timeMin0, int timeMin1, int timeSec0, int timeSec1);
 static void set_status_bar_text_test(char * status_bar_text, char * testString);
-static unsigned char bitmaskResult[BLOCK_X_DIM*BLOCK_Y_DIM];
+// Background under the player, which is drawn only while the screen is shown
+static sprite_under_t player_under;
 
-static char fruit_string[8][12]={
- "  NO FRUIT  ", "   Apple    ","   Grapes   ","White peach ","Strawberry ","   Banana   "," Watermelon ","    Dew     "
+static char fruit_string[8][13]={
+ "  NO FRUIT  ", "   Apple    ","   Grapes   ","White peach ","Strawberry  ","   Banana   "," Watermelon ","    Dew     "
 };
 static char status_bar_text[40]="    LEVEL -   - FRUITS   TIME: --:--    ";
-static unsigned fruit_text_build[TEXT_WIDTH * TEXT_HEIGHT * 12];
+// Name of the last fruit eaten, shown over the maze where it was eaten
+// for FRUIT_TEXT_TICKS ticks.  Like the player, it is drawn only while
+// the screen is shown, so that scrolling never draws over it
+#define FRUIT_TEXT_TICKS 96
+static text_overlay_t fruit_text;
+static int fruit_text_ticks;
+static int fruit_text_num, fruit_text_x, fruit_text_y;
 
 
 
@@ -242,50 +242,126 @@ void set_status_bar_text_test(char * status_bar_text, char * testString){
 
 
 
+/*
+ * set_level_params
+ *   DESCRIPTION: Set the parameter values of a given level.
+ *   INPUTS: level -- level to be used for selecting parameter values
+ *   OUTPUTS: info -- number and per-level parameters filled in
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void set_level_params(game_info_t* info, int level) {
+    /*
+     * Record level in info; other calculations use offset from
+     * level 1.
+     */
+    info->number = level--;
+
+    /* Set per-level parameter values. */
+    if ((info->maze_x_dim = MAZE_MIN_X_DIM + 2 * level) > MAZE_MAX_X_DIM)
+        info->maze_x_dim = MAZE_MAX_X_DIM;
+    if ((info->maze_y_dim = MAZE_MIN_Y_DIM + 2 * level) > MAZE_MAX_Y_DIM)
+        info->maze_y_dim = MAZE_MAX_Y_DIM;
+    if ((info->initial_fruit_count = 1 + level / 2) > 6)
+        info->initial_fruit_count = 6;
+    if ((info->time_to_first_fruit = 300 - 30 * level) < 120)
+        info->time_to_first_fruit = 120;
+    if ((info->time_between_fruits = 300 - 60 * level) < 60)
+        info->time_between_fruits = 60;
+    if ((info->tick_usec = 20000 - 1750 * level) < 5000)
+        info->tick_usec = 5000;
+}
+
+/*
+ * next_maze_thread
+ *   DESCRIPTION: Worker that makes the next level's maze in next_maze
+ *                from the parameters in next_info.  The maze depends
+ *                only on the seed and level, so a game is the same
+ *                whether its mazes are made here or in prepare_maze_level.
+ *   INPUTS: arg -- unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: writes next_maze and next_maze_ret
+ */
+static void* next_maze_thread(void* arg) {
+    next_maze_ret = make_maze_in(next_maze, next_info.maze_x_dim, next_info.maze_y_dim,
+                                 next_info.initial_fruit_count, game_seed + next_info.number);
+    return NULL;
+}
+
+/*
+ * start_next_maze
+ *   DESCRIPTION: Start making the maze of a given level in the background.
+ *                Nothing is started if the spare maze cannot be allocated
+ *                or the thread cannot be created; the level's maze is
+ *                then made when the level begins.
+ *   INPUTS: level -- level whose maze to make
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may allocate next_maze; writes next_info; starts a thread
+ */
+static void start_next_maze(int level) {
+    if (next_maze == NULL && (next_maze = new_maze()) == NULL)
+        return;
+    set_level_params(&next_info, level);
+    next_maze_busy = (pthread_create(&next_maze_tid, NULL, next_maze_thread, NULL) == 0);
+}
+
+/*
+ * take_next_maze
+ *   DESCRIPTION: Wait for the background maze, if one is being made, and
+ *                make it the current maze if it is the one for a given level.
+ *   INPUTS: level -- level about to be played, or 0 to only wait
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the level's maze is now current, -1 if it must
+ *                 still be made
+ *   SIDE EFFECTS: joins the worker thread; may swap next_maze with the
+ *                 current maze
+ */
+static int take_next_maze(int level) {
+    if (!next_maze_busy)
+        return -1;
+    pthread_join(next_maze_tid, NULL);
+    next_maze_busy = 0;
+    if (next_info.number != level || next_maze_ret != 0)
+        return -1;
+    /* The old current maze becomes the spare for the level after. */
+    next_maze = use_maze(next_maze);
+    return 0;
+}
+
 /*
  * prepare_maze_level
  *   DESCRIPTION: Prepare for a maze of a given level.  Fills the game_info
- *          structure, creates a maze, and initializes the display.
+ *          structure, takes the maze made in the background during the
+ *          last level (or creates one), and initializes the display.
+ *          The maze of the following level is then started in the
+ *          background.
  *   INPUTS: level -- level to be used for selecting parameter values
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
  *   SIDE EFFECTS: writes entire game_info structure; changes maze;
- *                 initializes display
+ *                 initializes display; starts a worker thread
  */
 static int prepare_maze_level(int level) {
-    int i; /* loop index for drawing display */
-
-    /*
-     * Record level in game_info; other calculations use offset from
-     * level 1.
-     */
-    game_info.number = level--;
-
-    /* Set per-level parameter values. */
-    if ((game_info.maze_x_dim = MAZE_MIN_X_DIM + 2 * level) > MAZE_MAX_X_DIM)
-        game_info.maze_x_dim = MAZE_MAX_X_DIM;
-    if ((game_info.maze_y_dim = MAZE_MIN_Y_DIM + 2 * level) > MAZE_MAX_Y_DIM)
-        game_info.maze_y_dim = MAZE_MAX_Y_DIM;
-    if ((game_info.initial_fruit_count = 1 + level / 2) > 6)
-        game_info.initial_fruit_count = 6;
-    if ((game_info.time_to_first_fruit = 300 - 30 * level) < 120)
-        game_info.time_to_first_fruit = 120;
-    if ((game_info.time_between_fruits = 300 - 60 * level) < 60)
-        game_info.time_between_fruits = 60;
-    if ((game_info.tick_usec = 20000 - 1750 * level) < 5000)
-        game_info.tick_usec = 5000;
+    /* Record level and set per-level parameter values. */
+    set_level_params(&game_info, level);
 
     /* Initialize dynamic values. */
     game_info.map_x = game_info.map_y = SHOW_MIN;
 
-    /* Create a maze. */
-    if (make_maze(game_info.maze_x_dim, game_info.maze_y_dim, game_info.initial_fruit_count) != 0)
+    /* Use the maze made during the last level, or create one now. */
+    if (take_next_maze(level) != 0 &&
+        make_maze(game_info.maze_x_dim, game_info.maze_y_dim, game_info.initial_fruit_count, game_seed + game_info.number) != 0)
         return -1;
 
     /* Set logical view and draw initial screen. */
     set_view_window(game_info.map_x, game_info.map_y);
-    for (i = 0; i < SCROLL_Y_DIM; i++)
-        (void)draw_horiz_line (i);
+    draw_view_tiles(get_maze_block);
+
+    /* Make the next level's maze while this one is played. */
+    if (level < MAX_LEVEL)
+        start_next_maze(level + 1);
 
     /* Return success. */
     return 0;
@@ -297,7 +373,8 @@ static int prepare_maze_level(int level) {
  *   INPUTS: ypos -- pointer to player's y position (pixel) in the maze
  *   OUTPUTS: *ypos -- reduced by one from initial value
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: moves the logical view window (game_info.map_x/y) by
+ *                 one pixel when appropriate
  */
 static void move_up(int* ypos) {
     /*
@@ -307,11 +384,10 @@ static void move_up(int* ypos) {
      */
     if (--(*ypos) < game_info.map_y + BLOCK_Y_DIM * PAN_BORDER && game_info.map_y > SHOW_MIN) {
         /*
-         * Shift the logical view upwards by one pixel and draw the
-         * new line.
+         * Shift the logical view upwards by one pixel; the view window
+         * and new line are drawn once per frame by scroll_view_window.
          */
-        set_view_window(game_info.map_x, --game_info.map_y);
-        (void)draw_horiz_line(0);
+        --game_info.map_y;
     }
 }
 
@@ -321,7 +397,8 @@ static void move_up(int* ypos) {
  *   INPUTS: xpos -- pointer to player's x position (pixel) in the maze
  *   OUTPUTS: *xpos -- increased by one from initial value
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: moves the logical view window (game_info.map_x/y) by
+ *                 one pixel when appropriate
  */
 static void move_right(int* xpos) {
     /*
@@ -332,11 +409,11 @@ static void move_right(int* xpos) {
     if (++(*xpos) > game_info.map_x + SCROLL_X_DIM - BLOCK_X_DIM * (PAN_BORDER + 1) &&
         game_info.map_x + SCROLL_X_DIM < (2 * game_info.maze_x_dim + 1) * BLOCK_X_DIM - SHOW_MIN) {
         /*
-         * Shift the logical view to the right by one pixel and draw the
-         * new line.
+         * Shift the logical view to the right by one pixel; the view
+         * window and new line are drawn once per frame by
+         * scroll_view_window.
          */
-        set_view_window(++game_info.map_x, game_info.map_y);
-        (void)draw_vert_line(SCROLL_X_DIM - 1);
+        ++game_info.map_x;
     }
 }
 
@@ -346,7 +423,8 @@ static void move_right(int* xpos) {
  *   INPUTS: ypos -- pointer to player's y position (pixel) in the maze
  *   OUTPUTS: *ypos -- increased by one from initial value
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: moves the logical view window (game_info.map_x/y) by
+ *                 one pixel when appropriate
  */
 static void move_down(int* ypos) {
     /*
@@ -357,11 +435,10 @@ static void move_down(int* ypos) {
     if (++(*ypos) > game_info.map_y + SCROLL_Y_DIM - BLOCK_Y_DIM * (PAN_BORDER + 1) &&
         game_info.map_y + SCROLL_Y_DIM < (2 * game_info.maze_y_dim + 1) * BLOCK_Y_DIM - SHOW_MIN) {
         /*
-         * Shift the logical view downwards by one pixel and draw the
-         * new line.
+         * Shift the logical view downwards by one pixel; the view window
+         * and new line are drawn once per frame by scroll_view_window.
          */
-        set_view_window(game_info.map_x, ++game_info.map_y);
-        (void)draw_horiz_line(SCROLL_Y_DIM - 1);
+        ++game_info.map_y;
     }
 }
 
@@ -371,7 +448,8 @@ static void move_down(int* ypos) {
  *   INPUTS: xpos -- pointer to player's x position (pixel) in the maze
  *   OUTPUTS: *xpos -- decreased by one from initial value
  *   RETURN VALUE: none
- *   SIDE EFFECTS: pans display by one pixel when appropriate
+ *   SIDE EFFECTS: moves the logical view window (game_info.map_x/y) by
+ *                 one pixel when appropriate
  */
 static void move_left(int* xpos) {
     /*
@@ -381,11 +459,11 @@ static void move_left(int* xpos) {
      */
     if (--(*xpos) < game_info.map_x + BLOCK_X_DIM * PAN_BORDER && game_info.map_x > SHOW_MIN) {
         /*
-         * Shift the logical view to the left by one pixel and draw the
-         * new line.
+         * Shift the logical view to the left by one pixel; the view
+         * window and new line are drawn once per frame by
+         * scroll_view_window.
          */
-        set_view_window(--game_info.map_x, game_info.map_y);
-        (void)draw_vert_line (0);
+        --game_info.map_x;
     }
 }
 
@@ -454,6 +532,8 @@ int play_x, play_y, last_dir, dir;
 int move_cnt = 0;
 int fd;
 unsigned long data;
+static unsigned long update_rate = 32; /* in Hz */
+static int headless = 0;        /* no terminal on stdin (emulated display) */
 static struct termios tio_orig;
 static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
 
@@ -473,6 +553,12 @@ static void *keyboard_thread(void *arg) {
         // Get Keyboard Input
         key = getc(stdin);
 
+        // Without a terminal, input may be exhausted; don't spin on it
+        if (headless && key == (char)EOF) {
+            usleep(1000000 / update_rate);
+            continue;
+        }
+
         // Check for '`' to quit
         if (key == BACKQUOTE) {
             quit_flag = 1;
@@ -514,10 +600,32 @@ static void *keyboard_thread(void *arg) {
 }
 
 /* some stats about how often we take longer than a single timer tick */
-static int goodcount = 0;
-static int badcount = 0;
 static int total = 0;
 
+/* ticks of game logic so far; the clock for recordings (see replay.h) */
+static unsigned long game_tick = 0;
+
+/*
+ * wait_for_tick
+ *   DESCRIPTION: Waits for the next RTC periodic interrupt and stores the
+ *                RTC data (interrupt count in bits 8 and up) in data.
+ *                Without an RTC, as in headless runs, sleeps for one tick;
+ *                when replaying a recording, returns one tick at once.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read
+ *   SIDE EFFECTS: none
+ */
+static int wait_for_tick() {
+    if (fd < 0) {
+        if (replay_mode() != REPLAY_PLAY)
+            usleep(1000000 / update_rate);
+        data = (1 << 8);
+        return sizeof (data);
+    }
+    return read(fd, &data, sizeof(unsigned long));
+}
+
 /*
  * rtc_thread
  *   DESCRIPTION: Thread that handles updating the screen
@@ -533,6 +641,7 @@ static void *rtc_thread(void *arg) {
     int open[NUM_DIRS];
     int need_redraw = 0;
     int goto_next_level = 0;
+    int frame_ticks;
 
 
 	//char playerColorAddress;
@@ -561,14 +670,18 @@ static void *rtc_thread(void *arg) {
         // Initialize the current direction of motion to stopped
         dir = DIR_STOP;
         next_dir = DIR_STOP;
+        replay_level_start();
+
+        // No fruit text carries over from the last level
+        fruit_text_ticks = 0;
 
         // Show maze around the player's original position
         (void)unveil_around_player(play_x, play_y);
 
-		bitmaskResultBlock(get_player_block(last_dir), get_player_mask(last_dir), get_player_block(-2), bitmaskResult); //-2 for BLOCK_EMPTY
         //draw_full_block(play_x, play_y, get_player_block(last_dir));
-		draw_full_block(play_x, play_y, bitmaskResult);
+        draw_sprite(&player_under, play_x, play_y, get_player_block(last_dir), get_player_mask(last_dir));
         show_screen();
+        erase_sprite(&player_under);
 //		draw_status_bar(status_bar_text, get_player_mask(list_dir);
         int levelNum, fruit, timeMin0, timeMin1, timeSec0, timeSec1;
         levelNum = 0;
@@ -579,7 +692,7 @@ static void *rtc_thread(void *arg) {
         timeSec1=0;
 
 
-        ret = read(fd, &data, sizeof(unsigned long));
+        ret = wait_for_tick();
 
 		int totalSecs, totalMins;
 		unsigned char playerColorAddress = 32; 	//0x21
@@ -588,6 +701,12 @@ static void *rtc_thread(void *arg) {
     int statusColor1, statusColor2;
 
     while ((quit_flag == 0) && (goto_next_level == 0)) {
+        // A replay stops where the recorded game was quit
+        if (replay_ended(game_tick)) {
+            quit_flag = 1;
+            break;
+        }
+        frame_begin();
 
 			//where shit happens!!!!
 
@@ -614,47 +733,54 @@ static void *rtc_thread(void *arg) {
       if(check_for_fruit((play_x / BLOCK_X_DIM),(play_y / BLOCK_Y_DIM))!=0){
         fruitTypeNum = check_for_fruit((play_x / BLOCK_X_DIM),(play_y / BLOCK_Y_DIM));
         set_status_bar_text_test(status_bar_text, fruit_string[fruitTypeNum]);
-        //draw_fruit_text_block(pos_x-5, pos_y_-5, fruit_string[fruitTypeNum])
-		
-		/*
-		NOTE: TA SAID YOU WERE CONVERTING TO PLANES TWICE, ONCE IN TEXTTOGRAPHICS AND ANOTHER IN DRAW_FRUIT_TEXT_BLOCK
-		DON'T USE DRAW_FRUIT_TEXT_BLOCK INSTEAD JUST DO SOMETHING LIKE BUILD[PLAY_X+PLAY_Y*IMAGE_X_DIM]=FRUIT_TEXT[I]
-		
-		*/
-        draw_fruit_text(fruit_string[fruitTypeNum], fruit_text_build, play_x-5, play_y-5, 1, 5);//, statusColor1, statusColor2);
+        // Name the fruit just above the player, centered on it
+        fruit_text_num = fruitTypeNum;
+        fruit_text_x = play_x + BLOCK_X_DIM / 2 - TEXT_OVERLAY_LEN * FONT_WIDTH / 2;
+        fruit_text_y = play_y - STATUS_BAR_HEIGHT;
+        fruit_text_ticks = FRUIT_TEXT_TICKS;
+        need_redraw = 1;
 
         //set_status_bar_text_test(status_bar_text, fruit_string[3]); //should display White Peach
       }
+        frame_stage(FT_LOGIC);
         //set_status_bar_text(status_bar_text, level, get_num_fruit(), timeMin0, timeMin1, timeSec0, timeSec1);
         //char status_bar_text[40] = "               My  status               ";
         draw_status_bar(status_bar_text, status_build, statusColor1, statusColor2);
+        frame_stage(FT_STATUS);
 
         // get first Periodic Interrupt
         // Wait for Periodic Interrupt
-        ret = read(fd, &data, sizeof(unsigned long));
+        ret = wait_for_tick();
+        frame_stage(FT_TICK_WAIT);
 
         // Update tick to keep track of time.  If we missed some
         // interrupts we want to update the player multiple times so
         // that player velocity is smooth
-        ticks = data >> 8;
+        ticks = replay_ticks(game_tick, data >> 8);
 
         total += ticks;
 
+        // Take the fruit text down once it has been up long enough
+        if (fruit_text_ticks > 0 && (fruit_text_ticks -= ticks) <= 0) {
+            fruit_text_ticks = 0;
+            need_redraw = 1;
+        }
+
+        // Frames that handle more than one tick missed some
+        frame_ticks = ticks;
+
         // If the system is completely overwhelmed we better slow down:
         if (ticks > 8) ticks = 8;
 
-        if (ticks > 1) {
-            badcount++;
-        }
-        else {
-            goodcount++;
-        }
-
         while (ticks--) {
+            game_tick++;
 
                 // Lock the mutex
             pthread_mutex_lock(&mtx);
 
+                // Record the key, or take it from the recording
+                next_dir = replay_dir(game_tick, next_dir);
+
                 // Check to see if a key has been pressed
                 if (next_dir != dir) {
                     // Check if new direction is backwards...if so, do immediately
@@ -671,6 +797,8 @@ static void *rtc_thread(void *arg) {
                         dir = next_dir;
                     }
                 }
+                frame_stage(FT_INPUT);
+
                 // New Maze Square!
                 if (move_cnt == 0) {
                     // The player has reached a new maze square; unveil nearby maze
@@ -725,22 +853,38 @@ static void *rtc_thread(void *arg) {
                             move_left(&play_x);
                             break;
                     }
-					bitmaskResultBlock(get_player_block(last_dir), get_player_mask(last_dir), get_player_block(-2), bitmaskResult); //-2 for BLOCK_EMPTY
-					//draw_full_block(play_x, play_y, get_player_block(last_dir));
-					draw_full_block(play_x, play_y, bitmaskResult);
                     need_redraw = 1;
                 }
+                frame_stage(FT_LOGIC);
             }
             if (need_redraw){
+                // Pan by the total of this frame's moves in one step
+                scroll_view_window(game_info.map_x, game_info.map_y);
+                frame_stage(FT_COMPOSITE);
 				draw_status_bar(status_bar_text, status_build, statusColor1, statusColor2);
+                frame_stage(FT_STATUS);
+                // Composite the fruit text and then the player over
+                // whatever is under them (maze or fruit), show
+                // them, and take them back out in reverse order so that
+                // the line fills of the next scroll never draw over them
+                if (fruit_text_ticks > 0)
+                    draw_text_overlay(&fruit_text, fruit_text_x, fruit_text_y, fruit_string[fruit_text_num]);
+                draw_sprite(&player_under, play_x, play_y, get_player_block(last_dir), get_player_mask(last_dir));
+                frame_stage(FT_COMPOSITE);
                 show_screen();
+                frame_stage(FT_SHOW);
+                erase_sprite(&player_under);
+                erase_text_overlay(&fruit_text);
+                frame_stage(FT_COMPOSITE);
 				//draw_status_bar(status_bar_text, get_player_mask(list_dir);
             }
             need_redraw = 0;
+            frame_end(frame_ticks);
         }
     }
     if (quit_flag == 0)
         winner = 1;
+    replay_finish(game_tick);
 
     return 0;
 }
@@ -748,21 +892,122 @@ static void *rtc_thread(void *arg) {
 /*
  * main
  *   DESCRIPTION: Initializes and runs the two threads
- *   INPUTS: none
+ *   INPUTS: argc, argv -- command line options:
+ *             -H  scroll with the CRTC start address (MODEX_HW_SCROLL)
+ *             -e  emulate the VGA in memory (MODEX_EMULATED); the RTC
+ *                 and a terminal are optional, and access counts are
+ *                 printed at exit
+ *             -T  draw maze blocks from copies kept in video memory
+ *                 (MODEX_TILE_CACHE)
+ *             -3  triple buffer, synchronized with the vertical retrace
+ *                 (MODEX_TRIPLE_BUFFER); wait times are printed at exit
+ *             -b  print the speed of the plane copy kernels and of
+ *                 block drawing, and exit
+ *             -t  print the time taken by each stage of a frame at exit
+ *             -d file  write the frame times to file at exit (see
+ *                 frame_timing.h for the format)
+ *             -r file  record the game's seed and keys to file
+ *             -p file  replay a game recorded with -r, without the RTC
+ *                 or keyboard and as fast as it can be drawn (see
+ *                 replay.h) with the generator it was recorded with
+ *             -g gen  generate mazes with worms joined by union-find
+ *                 ("union", the default) or by search ("search"), or
+ *                 row by row as they are seen ("eller"; see make_maze);
+ *                 with -p, must match the recording if given
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
  *   SIDE EFFECTS: none
  */
-int main() {
+int main(int argc, char* argv[]) {
     int ret;
     struct termios tio_new;
-    unsigned long update_rate = 32; /* in Hz */
+    int opt;
+    int mode_options = 0;
+    int bench_copy = 0;
+    int report_timing = 0;
+    const char* timing_dump = NULL;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    maze_gen_t maze_gen = MAZE_GEN_UNION_FIND;
+    int gen_given = 0;
+    int replay_gen;
 
     pthread_t tid1;
     pthread_t tid2;
 
-    // Initialize RTC
-    fd = open("/dev/rtc", O_RDONLY, 0);
+    // Parse command line options
+    while ((opt = getopt(argc, argv, "HT3ebtd:r:p:g:")) != -1) {
+        switch (opt) {
+            case 'H':
+                mode_options |= MODEX_HW_SCROLL;
+                break;
+            case 'T':
+                mode_options |= MODEX_TILE_CACHE;
+                break;
+            case '3':
+                mode_options |= MODEX_TRIPLE_BUFFER;
+                break;
+            case 'e':
+                mode_options |= MODEX_EMULATED;
+                break;
+            case 'b':
+                bench_copy = 1;
+                break;
+            case 't':
+                report_timing = 1;
+                break;
+            case 'd':
+                timing_dump = optarg;
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 'p':
+                replay_path = optarg;
+                break;
+            case 'g':
+                if (strcmp(optarg, "union") == 0)
+                    maze_gen = MAZE_GEN_UNION_FIND;
+                else if (strcmp(optarg, "search") == 0)
+                    maze_gen = MAZE_GEN_SEARCH;
+                else if (strcmp(optarg, "eller") == 0)
+                    maze_gen = MAZE_GEN_ELLER;
+                else {
+                    fprintf(stderr, "%s: unknown maze generator %s\n", argv[0], optarg);
+                    return -1;
+                }
+                gen_given = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-H] [-T] [-3] [-e] [-b] [-t] [-d file] [-r file | -p file] [-g union|search|eller]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    // A recording fixes the maze seed and generator; a new game starts
+    // from the time
+    game_seed = time(NULL);
+    if (replay_path != NULL) {
+        if (record_path != NULL || replay_play(replay_path, &game_seed, &replay_gen) != 0)
+            return -1;
+        if (replay_gen > (int)MAZE_GEN_ELLER) {
+            fprintf(stderr, "%s: unknown maze generator %d\n", replay_path, replay_gen);
+            return -1;
+        }
+        if (replay_gen >= 0 && gen_given && replay_gen != (int)maze_gen) {
+            fprintf(stderr, "%s: recorded with another maze generator than -g\n", replay_path);
+            return -1;
+        }
+        if (replay_gen >= 0)
+            maze_gen = (maze_gen_t)replay_gen;
+    } else if (record_path != NULL && replay_record(record_path, game_seed, maze_gen) != 0) {
+        perror(record_path);
+        return -1;
+    }
+    set_maze_generator(maze_gen);
+
+    // Initialize RTC; a replay does not wait for it
+    fd = (replay_path == NULL ? open("/dev/rtc", O_RDONLY, 0) : -1);
 
     // Enable RTC periodic interrupts at update_rate Hz
     // Default max is 64...must change in /proc/sys/dev/rtc/max-user-freq
@@ -776,8 +1021,13 @@ int main() {
         return -1;
     }
 
+    // An emulated display may run without a terminal (input from a file)
+    // A replay takes no input at all
+    headless = ((mode_options & MODEX_EMULATED) && !isatty(fileno(stdin)));
+    headless |= (replay_path != NULL);
+
     // Save current terminal attributes for stdin.
-    if (tcgetattr(fileno(stdin), &tio_orig) != 0) {
+    if (!headless && tcgetattr(fileno(stdin), &tio_orig) != 0) {
         perror("tcgetattr to read stdin terminal settings");
         return -1;
     }
@@ -788,32 +1038,65 @@ int main() {
     tio_new.c_lflag &= ~(ICANON | ECHO);
     tio_new.c_cc[VMIN] = 1;
     tio_new.c_cc[VTIME] = 0;
-    if (tcsetattr(fileno(stdin), TCSANOW, &tio_new) != 0) {
+    if (!headless && tcsetattr(fileno(stdin), TCSANOW, &tio_new) != 0) {
         perror("tcsetattr to set stdin terminal settings");
         return -1;
     }
 
     // Perform Sanity Checks and then initialize input and display
-    if ((sanity_check() != 0) || (set_mode_X(fill_horiz_buffer, fill_vert_buffer) != 0)){
+    if ((sanity_check() != 0) || (set_mode_X(fill_horiz_buffer, fill_vert_buffer, mode_options) != 0)){
         return 3;
     }
 
+    // The maze is made of blocks, so scrolled-in lines can be drawn a
+    // block row or column at a time instead of through the fill buffers
+    set_line_tiles(get_maze_block);
+
+    // Time the plane copy kernels and block drawing; the report is held
+    // until text mode
+    if (bench_copy) {
+        FILE* report = tmpfile();
+        int c;
+        if (report != NULL) {
+            report_copy_kernels(report);
+            report_block_speed(report);
+        }
+        clear_mode_X();
+        if (!headless)
+            (void)tcsetattr(fileno(stdin), TCSANOW, &tio_orig);
+        if (report == NULL)
+            return -1;
+        rewind(report);
+        while ((c = getc(report)) != EOF)
+            putchar(c);
+        fclose(report);
+        return 0;
+    }
+
     // Create the threads
     pthread_create(&tid1, NULL, rtc_thread, NULL);
-    pthread_create(&tid2, NULL, keyboard_thread, NULL);
+    if (replay_path == NULL)
+        pthread_create(&tid2, NULL, keyboard_thread, NULL);
 
     // Wait for all the threads to end
     pthread_join(tid1, NULL);
-    pthread_join(tid2, NULL);
+    if (replay_path == NULL)
+        pthread_join(tid2, NULL);
+
+    // Wait for a maze still being made in the background, then free the spare
+    (void)take_next_maze(0);
+    free_maze(next_maze);
 
     // Shutdown Display
     clear_mode_X();
 
     // Close Keyboard
-    (void)tcsetattr(fileno(stdin), TCSANOW, &tio_orig);
+    if (!headless)
+        (void)tcsetattr(fileno(stdin), TCSANOW, &tio_orig);
 
     // Close RTC
-    close(fd);
+    if (fd >= 0)
+        close(fd);
 
     // Print outcome of the game
     if (winner == 1) {
@@ -826,6 +1109,38 @@ int main() {
         printf ("Sorry, you lose...\n");
     }
 
+    // Report the cost of drawing on the emulated display
+    if (mode_options & MODEX_EMULATED) {
+        vga_emu_stats_t stats;
+        vga_emu_get_stats(&stats);
+        if (stats.frames > 0) {
+            printf("%lu frames: %lu video memory bytes written, %lu read, "
+                   "and %lu port writes per frame\n", stats.frames,
+                   stats.vram_bytes / stats.frames,
+                   stats.vram_reads / stats.frames,
+                   stats.port_writes / stats.frames);
+        }
+    }
+
+    // Report how long the game thread waited for a free page
+    if ((mode_options & MODEX_TRIPLE_BUFFER) &&
+        !(mode_options & MODEX_HW_SCROLL)) {
+        present_stats_t present;
+        get_present_stats(&present);
+        if (present.frames > 0) {
+            printf("%lu frames: waited for retrace in %lu, %lu usec in all, "
+                   "%ld usec at most (refresh period %ld usec)\n",
+                   present.frames, present.waits, present.wait_usec,
+                   present.max_wait_usec, present.refresh_usec);
+        }
+    }
+
+    // Report where the frame time went
+    if (report_timing)
+        frame_timing_report(stdout);
+    if (timing_dump != NULL && frame_timing_dump(timing_dump) != 0)
+        perror(timing_dump);
+
     // Return success
     return 0;
 }
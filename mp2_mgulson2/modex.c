@@ -28,15 +28,20 @@
  */
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/io.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+#include "blend.h"
 #include "blocks.h"
+#include "copy_kernel.h"
 #include "modex.h"
 #include "text.h"
+#include "vga_emu.h"
 
 /*
  * Calculate the image build buffer parameters.  SCROLL_SIZE is the space
@@ -57,12 +62,9 @@
  * middle of the available buffer area.
  */
 #define SCROLL_SIZE             (SCROLL_X_WIDTH * SCROLL_Y_DIM)
-#define NEW_SCROLL_SIZE         (SCROLL_X_WIDTH * SCROLL_Y_DIM-18)
 #define SCREEN_SIZE             (SCROLL_SIZE * 4 + 1)
-#define NEW_SCREEN_SIZE         (NEW_SCROLL_SIZE * 4 + 1)
-#define BUILD_BUF_SIZE          (NEW_SCREEN_SIZE + 20000)
-#define BUILD_BASE_INIT         ((BUILD_BUF_SIZE - NEW_SCREEN_SIZE) / 2)
-//#define STATUS_BAR_LOCATION 200-18
+#define BUILD_BUF_SIZE          (SCREEN_SIZE + 20000)
+#define BUILD_BASE_INIT         ((BUILD_BUF_SIZE - SCREEN_SIZE) / 2)
 
 
 /* Mode X and general VGA parameters */
@@ -73,14 +75,8 @@
 #define NUM_GRAPHICS_REGS       9
 #define NUM_ATTR_REGS           22
 
-//constants for status bar
-#define STATUS_BAR_HEIGHT		    18
-#define STATUS_BUILD_SIZE  		 (STATUS_BAR_HEIGHT*IMAGE_X_DIM)
-#define STATUS_PLANE_BUILD_SIZE STATUS_BUILD_SIZE/4
-#define NEW_MEMORY_SIZE         1600-STATUS_BUILD_SIZE
-#define TEXT_WIDTH                8
-#define TEXT_WIDTH                8
-#define TEXT_HEIGHT               16
+#define TEXT_WIDTH              FONT_WIDTH
+#define TEXT_HEIGHT             FONT_HEIGHT
 
 /* VGA register settings for mode X */
 static unsigned short mode_X_seq[NUM_SEQUENCER_REGS] = {
@@ -93,17 +89,18 @@ static unsigned short mode_X_seq[NUM_SEQUENCER_REGS] = {
     (0xFF18)changed
 };*/
 
-//change LCR to 364 =x16C FOR STATUS BAR
-
+/*
+ * The line compare register (0x18, with bit 8 in 0x07 and bit 9 in 0x09)
+ * is filled in by set_line_compare to split the screen above the status
+ * bar.
+ */
 static unsigned short mode_X_CRTC[NUM_CRTC_REGS] = {
     0x5F00, 0x4F01, 0x5002, 0x8203, 0x5404, 0x8005, 0xBF06, 0x1F07,
     0x0008, 0x0109, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F,
     0x9C10, 0x8E11, 0x8F12, 0x2813, 0x0014, 0x9615, 0xB916, 0xE317,
-    0x6B18
+    0xFF18
 };
 
-//6B may help with black line
-
 /*
 static unsigned char mode_X_attr[NUM_ATTR_REGS * 2] = {
     0x00, 0x00, 0x01, 0x01, 0x02, 0x02, 0x03, 0x03,
@@ -122,7 +119,7 @@ static unsigned char mode_X_attr[NUM_ATTR_REGS * 2] = {
     0x04, 0x04, 0x05, 0x05, 0x06, 0x06, 0x07, 0x07,
     0x08, 0x08, 0x09, 0x09, 0x0A, 0x0A, 0x0B, 0x0B,
     0x0C, 0x0C, 0x0D, 0x0D, 0x0E, 0x0E, 0x0F, 0x0F,
-    0x11, 0x41, 0x11, 0x00, 0x12, 0x0F, 0x13, 0x00,
+    0x10, 0x61, 0x11, 0x00, 0x12, 0x0F, 0x13, 0x00,
     0x14, 0x00, 0x15, 0x00
 };
 
@@ -191,6 +188,51 @@ extern unsigned char palette_RGB[64][3] = {
     { 0x3F, 0x30, 0x10 },{ 0x3F, 0x20, 0x10 }
 };
 
+/*
+ * Block atlas.  A block drawn at x coordinate pos_x has its pixel dx in
+ * plane (pos_x + dx) & 3 at address (pos_x + dx) >> 2, so the bytes of
+ * one plane in a block row are contiguous, and their layout depends only
+ * on the phase pos_x & 3.  set_mode_X converts every image in blocks
+ * (walls, player and masks, fruits) into all four phases, each stored
+ * plane-major as BLOCK_Y_DIM rows of TILE_X_WIDTH bytes per plane, so
+ * that draw_full_block copies short rows within each plane rather than
+ * computing an address per pixel.  Bytes outside the block are zero and
+ * are never drawn.
+ */
+#define TILE_X_WIDTH            BLOCK_PLANE_WIDTH
+typedef unsigned char planar_block_t[4][BLOCK_Y_DIM][TILE_X_WIDTH];
+static planar_block_t block_atlas[NUM_BLOCKS][4];
+
+/* kernel used to blend sprites with the background (see blend.h) */
+static blend_fn_t blend;
+
+/*
+ * Shadow palette.  set_palette_color and the other palette calls change
+ * only this copy of the DAC palette and mark the colors that differ as
+ * dirty; show_screen calls flush_palette, which writes each contiguous
+ * run of dirty colors to the DAC during vertical retrace.  Fades and
+ * cycles (palette_anims) are advanced there too, one step per frame.
+ * The lock lets any thread change the palette.
+ */
+#define PALETTE_SIZE            256
+#define MAX_PALETTE_ANIMS       8
+typedef enum {
+    PALETTE_IDLE, PALETTE_FADE, PALETTE_CYCLE
+} palette_anim_kind_t;
+typedef struct palette_anim_t {
+    palette_anim_kind_t kind;       /* PALETTE_IDLE if the slot is free */
+    int first, count;               /* colors changed                   */
+    int period;                     /* frames per fade or per rotation  */
+    int frame;                      /* frames since start or rotation   */
+    unsigned char from[PALETTE_SIZE][3];    /* fade start colors        */
+    unsigned char to[PALETTE_SIZE][3];      /* fade end colors          */
+} palette_anim_t;
+static pthread_mutex_t palette_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char shadow_palette[PALETTE_SIZE][3];
+static unsigned char palette_dirty[PALETTE_SIZE];   /* 1 if not in DAC  */
+static int palette_changed;         /* 1 if any color is dirty          */
+static palette_anim_t palette_anims[MAX_PALETTE_ANIMS];
+
 /* local functions--see function headers for details */
 static int open_memory_and_ports();
 static void VGA_blank(int blank_bit);
@@ -199,11 +241,65 @@ static void set_CRTC_registers(unsigned short table[NUM_CRTC_REGS]);
 static void set_attr_registers(unsigned char table[NUM_ATTR_REGS * 2]);
 static void set_graphics_registers(unsigned short table[NUM_GRAPHICS_REGS]);
 static void fill_palette();
+static void init_shadow_palette();
+static void set_shadow_color(int index, const unsigned char rgb[3]);
+static void stop_palette_anims(int first, int count);
+static palette_anim_t* new_palette_anim(int first, int count);
+static void step_palette_anims();
+static void flush_palette();
 static void write_font_data();
 static void set_text_mode_3(int clear_scr);
 static void copy_image(unsigned char* img, unsigned short scr_addr);
 static void copy_image_status(unsigned char* img, unsigned short scr_addr);
+static void copy_image_span(unsigned char* img, unsigned short scr_addr, int len);
+static void select_copy_kernel();
+static void planarize_block(const unsigned char* blk, int phase,
+                            planar_block_t out);
+static void build_block_atlas();
+static planar_block_t* atlas_entry(const unsigned char* blk);
+static int clip_rect(int pos_x, int pos_y, int width, int height,
+                     int* x_left, int* x_right, int* y_top, int* y_bottom);
+static int clip_block(int pos_x, int pos_y, int* x_left, int* x_right,
+                      int* y_top, int* y_bottom);
+static void move_planar_rect(unsigned char* planar, int row_width,
+                             int height, int pos_x, int pos_y,
+                             int x_left, int x_right, int y_top,
+                             int y_bottom, int to_build);
+static void move_planar(unsigned char* planar, int pos_x, int pos_y,
+                        int x_left, int x_right, int y_top, int y_bottom,
+                        int to_build);
+static void draw_block(int pos_x, int pos_y, unsigned char* blk, int mark);
+static void draw_block_pixels(int pos_x, int pos_y, unsigned char* blk);
+static void draw_planar(planar_block_t img, int pos_x, int pos_y,
+                        int x_left, int x_right, int y_top, int y_bottom);
+#ifndef TEXT_RESTORE_PROGRAM
+static void draw_tile_rect(int x, int y, int width, int height);
+static void draw_view_rect(int x, int y, int width, int height);
+static void draw_vert_tiles(int x);
+#endif
+static void upload_tile_cache();
+static void latch_tile(int tile, int phase, int dst, int row_width,
+                       int r0, int r1, int k0, int k1);
+#ifndef TEXT_RESTORE_PROGRAM
+static int queue_latch_tile(int tile, int phase, int dst,
+                            int r0, int r1, int k0, int k1);
+#endif
+static void flush_latch_tiles();
+static void mark_dirty(int x, int y, int width, int height);
+static void mark_page_dirty(int page, int x, int y, int width, int height);
+static void mark_all_dirty();
+static void copy_dirty_spans(unsigned char* addr, int p_off, int page);
+static void shift_dirty(int d_col, int d_row);
+static void show_hw_scroll();
+static void set_display_start(unsigned short addr, int pan);
+static void set_line_compare(unsigned short crtc[NUM_CRTC_REGS]);
+static unsigned char read_input_status();
+static long long now_usec();
+static int wait_for_retrace_start();
+static void measure_refresh();
+static void wait_for_latch();
 void draw_status_bar(char * status_bar_text, unsigned char * status_build, int statusColor1, int statusColor2);
+static void copy_status_cell(unsigned char* status_build, int cell);
 
 
 
@@ -253,6 +349,139 @@ static int show_x, show_y;          /* logical view coordinates     */
                                     /* displayed video memory variables */
 static unsigned char* mem_image;    /* pointer to start of video memory */
 static unsigned short target_img;   /* offset of displayed screen image */
+static int cur_page;                /* index of displayed screen image  */
+
+/*
+ * The status bar is shown from video memory address 0 (see modex.h), with
+ * rows as wide as those of the scrolling region (HW_ROW_WIDTH when
+ * scrolling in hardware).  The video pages start at PAGE_BASE, the first
+ * multiple of 256 addresses past the widest status bar.
+ */
+#define STATUS_MEM_SIZE         (STATUS_BAR_HEIGHT * HW_ROW_WIDTH)
+#define PAGE_BASE               ((STATUS_MEM_SIZE + 0xFF) & ~0xFF)
+
+/*
+ * status bar text and colors in video memory, valid only if status_valid
+ * is set; draw_status_bar uses them to redraw only the cells that change
+ */
+static char status_text[STATUS_BAR_TEXT_SIZE];
+static int status_colors[2];
+static int status_valid;
+
+/*
+ * Dirty region tracking.  Each of the video pages keeps, for every
+ * row of the scrolling region, the span of screen addresses (groups of
+ * four pixels) that have been drawn into the build buffer since that
+ * page was last filled.  Spans are stored as inclusive [lo,hi] pairs;
+ * a row with lo equal to DIRTY_CLEAN is clean.  Tracking the pages apart is
+ * necessary because a page that was not shown in the last frame still
+ * holds the image from two frames ago.
+ *
+ * A page marked full is copied as a whole, as the original code did
+ * every frame.  Moving the logical view window shifts every pixel on
+ * the screen, so set_view_window marks all pages full; frames in which
+ * the view does not move copy only the dirty spans, which is typically
+ * a few hundred bytes (the player block and any unveiled squares).
+ */
+#define NUM_PAGES               3
+#define DIRTY_CLEAN             0xFF
+static unsigned char dirty_lo[NUM_PAGES][SCROLL_Y_DIM];
+static unsigned char dirty_hi[NUM_PAGES][SCROLL_Y_DIM];
+static int page_full[NUM_PAGES];
+static int num_pages;               /* pages in use (1 when scrolling */
+                                    /*    in hardware, 3 when triple  */
+                                    /*    buffered, else 2)           */
+
+/*
+ * Triple buffering (MODEX_TRIPLE_BUFFER).  A third page at 0x8700 lets
+ * show_screen fill a page while the page it committed last is still
+ * waiting for the vertical retrace that latches the CRTC start address.
+ * The start address is written only outside retrace, so both bytes are
+ * latched together.  Before committing a new page, show_screen makes
+ * sure the last commit has been latched (otherwise the page on display
+ * would be the one filled next); a retrace is known to have happened if
+ * the retrace timing measured at startup predicts one, or if one is seen
+ * on input status register 0x3DA, for which show_screen waits if need
+ * be.  The time spent waiting is kept in present_stats.
+ */
+#define RETRACE_TIMEOUT         50000   /* usec; give up on retrace  */
+static int triple;                  /* 1 if triple buffered          */
+static int pending_page;            /* page committed but maybe not  */
+                                    /*    yet latched, or -1         */
+static long long pending_since;     /* time of that commit (usec)    */
+static long long last_retrace;      /* time a retrace was seen start */
+static long refresh_usec;           /* time between retraces, or 0   */
+static present_stats_t present_stats;
+
+/*
+ * Hardware scrolling (MODEX_HW_SCROLL).  Video memory above the status
+ * bar holds one image of the logical space with rows HW_ROW_WIDTH bytes
+ * apart, wider than the SCROLL_X_WIDTH + 1 bytes that the CRTC reads for
+ * a panned screen.  Moving the view only changes the CRTC start address
+ * (hw_start) and the pixel panning register; the lines exposed by the
+ * move are drawn into the build buffer as usual and copied from there
+ * as dirty spans of page 0.  Each logical address keeps the same place
+ * in video memory until the image drifts out of [HW_MEM_START,
+ * HW_MEM_END), at which point it is moved back to the middle and copied
+ * in full.  The status bar uses the same row width, so it occupies
+ * STATUS_BAR_HEIGHT * HW_ROW_WIDTH bytes at the bottom of memory.  The
+ * top 8kB of memory are left for the tile cache.
+ */
+#define HW_ROW_WIDTH            96
+#define HW_VIEW_WIDTH           (SCROLL_X_WIDTH + 1)
+#define HW_VIEW_SIZE            ((SCROLL_Y_DIM - 1) * HW_ROW_WIDTH + HW_VIEW_WIDTH)
+#define HW_MEM_START            PAGE_BASE
+#define HW_MEM_END              0xE000
+static int hw_scroll;               /* 1 if scrolling in hardware      */
+static int hw_start;                /* video memory offset of view     */
+static int hw_pan;                  /* pixel panning written, or -1    */
+static int hw_shown_x, hw_shown_y;  /* view at hw_start                */
+static int vram_row_width;          /* CRTC row width in addresses     */
+
+/*
+ * With MODEX_EMULATED, the port macros below and the copies into video
+ * memory go to the emulation in vga_emu.c instead of the hardware.
+ */
+static int vga_emulated;
+
+/*
+ * kernel used by copy_image, copy_image_status, and copy_image_span,
+ * chosen in set_mode_X; copies to video memory are timed at
+ * COPY_BENCH_ADDR, which lies past the second video page (in the third
+ * page when triple buffered) and is cleared after use
+ */
+static const copy_kernel_t* plane_copy = &copy_kernels[0];
+#define COPY_BENCH_ADDR         0x8000
+
+/*
+ * Tile cache (MODEX_TILE_CACHE).  Every block image is kept in video
+ * memory at TILE_CACHE_ADDR in four versions, one for each phase (the
+ * plane holding its leftmost pixel), as BLOCK_Y_DIM rows of TILE_X_WIDTH
+ * addresses.  draw_tile copies a cached block to the video pages in
+ * write mode 1, in which a read loads all four planes into the latches
+ * and a write stores them, so four pixels move per address.  Planes
+ * outside the block at its left and right edges are masked off.  The
+ * build buffer is still drawn so that it remains a full copy of the
+ * screen, but the pages filled by latch copies need not be copied from
+ * it.  Only the page that show_screen fills next is hidden, so only it
+ * gets latch copies; the other pages are marked dirty and get the block
+ * from the build buffer when their turn comes.  When scrolling in
+ * hardware, the one page is always on display, so the copies are queued
+ * and made by show_screen along with the dirty spans.
+ */
+#define TILE_CACHE_ADDR         0xE000
+#define TILE_SIZE               (TILE_X_WIDTH * BLOCK_Y_DIM)
+#define PAGE_ADDR(page)         (PAGE_BASE + (page) * 0x4000)
+#define MAX_QUEUED_TILES        512
+static int tile_cache;              /* 1 if block images are cached */
+
+/* a latch copy waiting for show_screen (see latch_tile) */
+typedef struct queued_tile_t {
+    int tile, phase, dst;
+    int r0, r1, k0, k1;
+} queued_tile_t;
+static queued_tile_t queued_tiles[MAX_QUEUED_TILES];
+static int num_queued_tiles;
 
 /*
  * functions provided by the caller to set_mode_X() and used to obtain
@@ -262,6 +491,14 @@ static unsigned short target_img;   /* offset of displayed screen image */
 static void (*horiz_line_fn)(int, int, unsigned char[SCROLL_X_DIM]);
 static void (*vert_line_fn)(int, int, unsigned char[SCROLL_Y_DIM]);
 
+/*
+ * function optionally provided by the caller (set_line_tiles) that gives
+ * the block number at each lattice point; when set, draw_horiz_line and
+ * draw_vert_line copy rows and columns of blocks straight into the build
+ * buffer planes instead of calling the fill functions
+ */
+static int (*line_tile_fn)(int, int);
+
 /*
  * macro used to target a specific video plane or planes when writing
  * to video memory in mode X; bits 8-11 in the mask_hi_bits enable writes
@@ -269,6 +506,9 @@ static void (*vert_line_fn)(int, int, unsigned char[SCROLL_Y_DIM]);
  */
 #define SET_WRITE_MASK(mask_hi_bits)                                \
 do {                                                                \
+    if (vga_emulated)                                               \
+        vga_emu_outw(0x03C4, ((mask_hi_bits) & 0xFF00) | 0x02);     \
+    else                                                            \
     asm volatile ("                                               \n\
         movw $0x03C4, %%dx    /* set write mask */                \n\
         movb $0x02, %b0                                           \n\
@@ -283,6 +523,9 @@ do {                                                                \
 /* macro used to write a byte to a port */
 #define OUTB(port, val)                                             \
 do {                                                                \
+    if (vga_emulated)                                               \
+        vga_emu_outb((port), (val));                                \
+    else                                                            \
     asm volatile ("outb %b1, (%w0)"                                 \
         : /* no outputs */                                          \
         : "d"((port)), "a"((val))                                   \
@@ -293,6 +536,9 @@ do {                                                                \
 /* macro used to write two bytes to two consecutive ports */
 #define OUTW(port, val)                                             \
 do {                                                                \
+    if (vga_emulated)                                               \
+        vga_emu_outw((port), (val));                                \
+    else                                                            \
     asm volatile ("outw %w1, (%w0)"                                 \
         : /* no outputs */                                          \
         : "d"((port)), "a"((val))                                   \
@@ -303,6 +549,11 @@ do {                                                                \
 /* macro used to write an array of two-byte values to two consecutive ports */
 #define REP_OUTSW(port, source, count)                              \
 do {                                                                \
+    int _i;                                                         \
+    if (vga_emulated) {                                             \
+        for (_i = 0; _i < (count); _i++)                            \
+            vga_emu_outw((port), ((unsigned short*)(source))[_i]);    \
+    } else                                                          \
     asm volatile ("                                               \n\
         1: movw 0(%1), %%ax                                       \n\
         outw %%ax, (%w2)                                          \n\
@@ -319,6 +570,11 @@ do {                                                                \
 /* macro used to write an array of one-byte values to two consecutive ports */
 #define REP_OUTSB(port, source, count)                              \
 do {                                                                \
+    int _i;                                                         \
+    if (vga_emulated) {                                             \
+        for (_i = 0; _i < (count); _i++)                            \
+            vga_emu_outb((port), ((unsigned char*)(source))[_i]);     \
+    } else                                                          \
     asm volatile ("                                               \n\
         1: movb 0(%1), %%al                                       \n\
         outb %%al, (%w2)                                          \n\
@@ -332,6 +588,19 @@ do {                                                                \
     );                                                              \
 } while (0)
 
+/* macro used to read a byte from a port (the value is discarded) */
+#define INB(port)                                                   \
+do {                                                                \
+    if (vga_emulated)                                               \
+        (void)vga_emu_inb((port));                                  \
+    else                                                            \
+    asm volatile ("inb (%w0), %%al"                                 \
+        : /* no outputs */                                          \
+        : "d"((port))                                               \
+        : "eax", "memory"                                           \
+    );                                                              \
+} while (0)
+
 /*
  * set_mode_X
  *   DESCRIPTION: Puts the VGA into mode X.
@@ -343,17 +612,22 @@ do {                                                                \
  *                    draw_vert_line) to obtain a graphical
  *                    image of a particular logical line for
  *                    drawing to the build buffer
+ *           options -- bitwise OR of MODEX_* options (see modex.h)
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
  *   SIDE EFFECTS: initializes the logical view window; maps video memory
  *                 and obtains permission for VGA ports; clears video memory
  */
 int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
-               void (*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM])) {
+               void (*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM]),
+               int options) {
 
     /* loop index for filling memory fence with magic numbers */
     int i;
 
+    /* CRT control register values, adjusted for the chosen options */
+    unsigned short crtc[NUM_CRTC_REGS];
+
     /*
      * Record callback functions for obtaining horizontal and vertical
      * line images.
@@ -362,6 +636,7 @@ int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
         return -1;
     horiz_line_fn = horiz_fill_fn;
     vert_line_fn = vert_fill_fn;
+    line_tile_fn = NULL;
 
     /* Initialize the logical view window to position (0,0). */
     show_x = show_y = 0;
@@ -375,11 +650,43 @@ int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
     }
 
 
-    /* One display page goes at the start of video memory. */
-    target_img = 0x0700;//STATUS_PLANE_BUILD_SIZE;
+    /* One display page goes just past the status bar. */
+    target_img = PAGE_ADDR(0);
+    cur_page = 0;
 
-    /* Map video memory and obtain permission for VGA port access. */
-    if (open_memory_and_ports() == -1)
+    /*
+     * Hardware scrolling uses a single page with wider rows; the CRTC
+     * offset register holds the row width in units of two addresses.
+     */
+    memcpy(crtc, mode_X_CRTC, sizeof (crtc));
+    set_line_compare(crtc);
+    hw_scroll = ((options & MODEX_HW_SCROLL) != 0);
+    if (hw_scroll) {
+        num_pages = 1;
+        vram_row_width = HW_ROW_WIDTH;
+        crtc[0x13] = ((HW_ROW_WIDTH / 2) << 8) | 0x13;
+    } else {
+        num_pages = ((options & MODEX_TRIPLE_BUFFER) ? 3 : 2);
+        vram_row_width = SCROLL_X_WIDTH;
+    }
+    triple = (num_pages == 3);
+    status_valid = 0;
+    pending_page = -1;
+    memset(&present_stats, 0, sizeof (present_stats));
+    hw_start = -1;
+    hw_pan = -1;
+    tile_cache = ((options & MODEX_TILE_CACHE) != 0);
+    build_block_atlas();
+    blend = blend_select();
+
+    /*
+     * Map video memory and obtain permission for VGA port access, or
+     * start the emulation in their place.
+     */
+    vga_emulated = ((options & MODEX_EMULATED) != 0);
+    if (vga_emulated)
+        vga_emu_init();
+    else if (open_memory_and_ports() == -1)
         return -1;
 
     /*
@@ -397,12 +704,15 @@ int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
 
     VGA_blank(1);                               /* blank the screen      */
     set_seq_regs_and_reset(mode_X_seq, 0x63);   /* sequencer registers   */
-    set_CRTC_registers(mode_X_CRTC);            /* CRT control registers */
+    set_CRTC_registers(crtc);                   /* CRT control registers */
     set_attr_registers(mode_X_attr);            /* attribute registers   */
     set_graphics_registers(mode_X_graphics);    /* graphics registers    */
     fill_palette();                             /* palette colors        */
+    init_shadow_palette();                      /* and their copy        */
+    select_copy_kernel();                       /* fastest plane copy    */
     clear_screens();                            /* zero video memory     */
     VGA_blank(0);                               /* unblank the screen    */
+    measure_refresh();                          /* retrace timing        */
 
     /* Return success. */
     return 0;
@@ -410,65 +720,84 @@ int set_mode_X(void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
 
 /*
  * draw_status_bar
- *   DESCRIPTION: create status build buffer and change
- *   INPUTS: text, status build buffer
+ *   DESCRIPTION: Draw the status bar text into the status build buffer
+ *                and copy it to the top of video memory.  The text and
+ *                colors last drawn are kept, so that unless the colors
+ *                change or video memory has been cleared, only the
+ *                character cells whose text changed are drawn and copied
+ *                (usually one digit of the time).  The same status_build
+ *                must be passed in every call.
+ *   INPUTS: status_bar_text -- STATUS_BAR_TEXT_SIZE characters to show
+ *           status_build -- status build buffer
+ *           statusColor1, statusColor2 -- background and text colors
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: TBD
+ *   SIDE EFFECTS: draws to status_build and video memory
  */
-
 void draw_status_bar(char * status_bar_text, unsigned char * status_build, int statusColor1, int statusColor2){
-	//text information
-  text_to_graphics(status_bar_text, status_build, statusColor1, statusColor2);
-  
-  
-  int p_off;
-
-  //  target_img = 0;
-
-  p_off = 3;
-
-//copy_image(addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), target_img);
-
-
-  /* Calculate the source address. */
-  //addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
-
-  /* Draw to each plane in the video memory. */
-  int i;
-  for (i = 0; i < 4; i++) {
-      SET_WRITE_MASK(1 << (i + 8));
-      //SET_WRITE_MASK(i);
-      copy_image_status(status_build + ((p_off - i + 4) & 3)* STATUS_PLANE_BUILD_SIZE , 0);
-      //change copy_image function
-
-
-  }
+    int i;              /* loop index over planes or cells */
+    int row;            /* loop index over rows            */
+    unsigned char* plane;
+
+    /* Copy only the changed cells if the bar on screen is still valid. */
+    if (status_valid && statusColor1 == status_colors[0] &&
+        statusColor2 == status_colors[1]) {
+        for (i = 0; i < STATUS_BAR_TEXT_SIZE; i++) {
+            if (status_bar_text[i] == status_text[i])
+                continue;
+            text_cell_to_graphics(status_bar_text[i], i, status_build,
+                                  statusColor1, statusColor2);
+            copy_status_cell(status_build, i);
+            status_text[i] = status_bar_text[i];
+        }
+        return;
+    }
 
-  /*
-   * Change the VGA registers to point the top left of the screen
-   * to the video memory that we just filled.
-   */
+    text_to_graphics(status_bar_text, status_build, statusColor1, statusColor2);
 
+    /* Draw to each plane in the video memory (plane 3 is first). */
+    for (i = 0; i < 4; i++) {
+        SET_WRITE_MASK(1 << (i + 8));
+        plane = status_build + (3 - i) * STATUS_PLANE_BUILD_SIZE;
+        if (vram_row_width == SCROLL_X_WIDTH) {
+            copy_image_status(plane, 0);
+            continue;
+        }
+        /* Rows are wider than the status bar when scrolling in hardware. */
+        for (row = 0; row < STATUS_BAR_HEIGHT; row++)
+            copy_image_span(plane + row * SCROLL_X_WIDTH, row * vram_row_width,
+                            SCROLL_X_WIDTH);
+    }
 
-   //only used when trying to write the game screen
-  //OUTW(0x03D4, (target_img & 0xFF00) | 0x0C);
-  //OUTW(0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
+    memcpy(status_text, status_bar_text, STATUS_BAR_TEXT_SIZE);
+    status_colors[0] = statusColor1;
+    status_colors[1] = statusColor2;
+    status_valid = 1;
 }
 
-
 /*
- * draw_fruit_text
- *   DESCRIPTION:  draws fruit text to screen
- *   INPUTS: fruitString, fruit_build,pos_x, pos_y, status colors
+ * copy_status_cell
+ *   DESCRIPTION: Copy one character cell of the status bar (two addresses
+ *                in each row of each plane) from the status build buffer
+ *                to video memory.
+ *   INPUTS: status_build -- status build buffer
+ *           cell -- cell number, from 0 to STATUS_BAR_TEXT_SIZE - 1
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: draws fruit to screen
+ *   SIDE EFFECTS: writes to video memory
  */
-void draw_fruit_text(char * fruitString, unsigned char * fruit_build, int pos_x, int pos_y, int statusColor1, int statusColor2){
-	text_to_graphics(fruitString, fruit_build, statusColor1, statusColor2);
-  //draw_fruit_text_block(pos_x-5, pos_y-5, fruit_build);
-  //show_screen();
+static void copy_status_cell(unsigned char* status_build, int cell) {
+    unsigned char* src; /* first byte of cell in plane */
+    int i;              /* loop index over planes      */
+    int row;            /* loop index over rows        */
+
+    for (i = 0; i < 4; i++) {
+        SET_WRITE_MASK(1 << (i + 8));
+        src = status_build + (3 - i) * STATUS_PLANE_BUILD_SIZE + 2 * cell;
+        for (row = 0; row < STATUS_BAR_HEIGHT; row++)
+            copy_image_span(src + row * SCROLL_X_WIDTH,
+                            row * vram_row_width + 2 * cell, 2);
+    }
 }
 
 
@@ -485,11 +814,14 @@ void clear_mode_X() {
     /* loop index for checking memory fence */
     int i;
 
-    /* Put VGA into text mode, restore font data, and clear screens. */
-    set_text_mode_3(1);
-
-    /* Unmap video memory. */
-    (void)munmap(mem_image, VID_MEM_SIZE);
+    /*
+     * Put VGA into text mode, restore font data, and clear screens,
+     * then unmap video memory.  The emulation has no text mode.
+     */
+    if (!vga_emulated) {
+        set_text_mode_3(1);
+        (void)munmap(mem_image, VID_MEM_SIZE);
+    }
 
     /* Check validity of build buffer memory fence.  Report breakage. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -540,6 +872,16 @@ void set_view_window(int scr_x, int scr_y) {
     show_x = scr_x;
     show_y = scr_y;
 
+    /*
+     * Every pixel on the screen moves, so both video pages are stale.
+     * When scrolling in hardware, pixels keep their place in video
+     * memory, and only the dirty spans move with the view.
+     */
+    if (hw_scroll)
+        shift_dirty((scr_x >> 2) - (old_x >> 2), scr_y - old_y);
+    else if (scr_x != old_x || scr_y != old_y)
+        mark_all_dirty();
+
     /*
      * If the new view window fits within the boundaries of the build
      * buffer, we need move nothing around.
@@ -637,22 +979,41 @@ void show_screen() {
     int p_off;              /* plane offset of first display plane */
     int i;                  /* loop index over video planes        */
 
+    if (hw_scroll) {
+        show_hw_scroll();
+        flush_palette();
+        if (vga_emulated)
+            vga_emu_end_frame();
+        return;
+    }
+
     /*
      * Calculate offset of build buffer plane to be mapped into plane 0
      * of display.
      */
     p_off = (3 - (show_x & 3));
 
-    /* Switch to the other target screen in video memory. */
-    target_img ^= 0x4000;
+    /* Switch to the next target screen in video memory. */
+    cur_page = (cur_page + 1) % num_pages;
+    target_img = PAGE_ADDR(cur_page);
 
     /* Calculate the source address. */
     addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
 
-    /* Draw to each plane in the video memory. */
-    for (i = 0; i < 4; i++) {
-        SET_WRITE_MASK(1 << (i + 8));
-        copy_image(addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), target_img);
+    /*
+     * If the view has moved since this page was last filled, every plane
+     * must be copied in full; otherwise, copy only the spans drawn since.
+     */
+    if (page_full[cur_page]) {
+        /* Draw to each plane in the video memory. */
+        for (i = 0; i < 4; i++) {
+            SET_WRITE_MASK(1 << (i + 8));
+            copy_image(addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), target_img);
+        }
+        page_full[cur_page] = 0;
+        memset(dirty_lo[cur_page], DIRTY_CLEAN, SCROLL_Y_DIM);
+    } else {
+        copy_dirty_spans(addr, p_off, cur_page);
     }
 
 
@@ -668,8 +1029,163 @@ void show_screen() {
 
 
 
+    flush_palette();
+    if (triple)
+        wait_for_latch();
     OUTW(0x03D4, (target_img & 0xFF00) | 0x0C);
     OUTW(0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
+    if (triple) {
+        pending_page = cur_page;
+        pending_since = now_usec();
+    }
+
+    if (vga_emulated)
+        vga_emu_end_frame();
+}
+
+/*
+ * read_input_status
+ *   DESCRIPTION: Read VGA input status register 1 (port 0x3DA), in which
+ *                bit 3 is set during vertical retrace.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the register value
+ *   SIDE EFFECTS: resets the attribute controller address flip-flop
+ */
+static unsigned char read_input_status() {
+    unsigned char val;  /* value read from the port */
+
+    if (vga_emulated)
+        return vga_emu_inb(0x03DA);
+    asm volatile ("inb (%w1), %b0"
+        : "=a"(val)
+        : "d"(0x03DA)
+        : "memory"
+    );
+    return val;
+}
+
+/*
+ * now_usec
+ *   DESCRIPTION: Read the time of day in microseconds.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: microseconds since the epoch
+ *   SIDE EFFECTS: none
+ */
+static long long now_usec() {
+    struct timeval tv;  /* current time */
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/*
+ * wait_for_retrace_start
+ *   DESCRIPTION: Wait for the start of the next vertical retrace, that is,
+ *                for bit 3 of input status register 1 to rise, giving up
+ *                after RETRACE_TIMEOUT microseconds.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if a retrace started, -1 on timeout
+ *   SIDE EFFECTS: sets last_retrace to the time the retrace was seen
+ */
+static int wait_for_retrace_start() {
+    long long start = now_usec();   /* time the wait began */
+    long long now;                  /* current time        */
+
+    /* Let any retrace in progress end, then wait for the next. */
+    do {
+        now = now_usec();
+        if (now - start > RETRACE_TIMEOUT)
+            return -1;
+    } while (read_input_status() & 0x08);
+    do {
+        now = now_usec();
+        if (now - start > RETRACE_TIMEOUT)
+            return -1;
+    } while (!(read_input_status() & 0x08));
+    last_retrace = now;
+    return 0;
+}
+
+/*
+ * measure_refresh
+ *   DESCRIPTION: When triple buffered, time a few display frames to find
+ *                the time between vertical retraces.  The time is left at
+ *                zero if no retrace is seen.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets refresh_usec and last_retrace
+ */
+static void measure_refresh() {
+    long long first;    /* time of the first retrace seen */
+    int i;              /* loop index over frames         */
+
+    refresh_usec = 0;
+    if (!triple || wait_for_retrace_start() == -1)
+        return;
+    first = last_retrace;
+    for (i = 0; i < 8; i++) {
+        if (wait_for_retrace_start() == -1)
+            return;
+    }
+    refresh_usec = (long)((last_retrace - first) / 8);
+    present_stats.refresh_usec = refresh_usec;
+}
+
+/*
+ * wait_for_latch
+ *   DESCRIPTION: When triple buffered, make sure that the start address
+ *                written by the last call to show_screen has been latched
+ *                by a vertical retrace, so that the page about to be
+ *                committed never replaces one that was not shown.  No
+ *                wait is needed if a full refresh period has passed since
+ *                the last commit or if a retrace is in progress (commits
+ *                are made outside retrace); otherwise, wait for the next
+ *                retrace to start.  Then wait for any retrace to end, so
+ *                that both bytes of the new start address are latched
+ *                together.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates present_stats
+ */
+static void wait_for_latch() {
+    long long start = now_usec();   /* time the wait began  */
+    long long now;                  /* current time         */
+    long waited;                    /* microseconds blocked */
+
+    present_stats.frames++;
+    if (pending_page >= 0 &&
+        (refresh_usec == 0 || start - pending_since < refresh_usec) &&
+        !(read_input_status() & 0x08))
+        (void)wait_for_retrace_start();
+    do {
+        now = now_usec();
+    } while ((read_input_status() & 0x08) && now - start < RETRACE_TIMEOUT);
+
+    waited = (long)(now - start);
+    if (waited > 0) {
+        present_stats.waits++;
+        present_stats.wait_usec += waited;
+        if (waited > present_stats.max_wait_usec)
+            present_stats.max_wait_usec = waited;
+    }
+}
+
+/*
+ * get_present_stats
+ *   DESCRIPTION: Read the time show_screen has spent waiting for a free
+ *                page when triple buffered (see MODEX_TRIPLE_BUFFER).
+ *   INPUTS: none
+ *   OUTPUTS: out -- the counts since set_mode_X
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void get_present_stats(present_stats_t* out) {
+    *out = present_stats;
 }
 
 /*
@@ -685,115 +1201,19 @@ void clear_screens() {
     SET_WRITE_MASK(0x0F00);
 
     /* Set 64kB to zero (times four planes = 256kB). */
-    memset(mem_image, 0, MODE_X_MEM_SIZE);
-}
+    if (vga_emulated)
+        vga_emu_fill(0, 0, MODE_X_MEM_SIZE);
+    else
+        memset(mem_image, 0, MODE_X_MEM_SIZE);
 
-/* bitmaskPlayerBlock
-// 	DESCRIPTION: produce modified player with background behind sprite
-//  INPUTS: player block, background block, bitmask, result ptr
-//	OUTPUTS: none
-//	RETURN VAL: NONE
-//	SIDE EFFECTS: NONE
-//
-//
-*/
- void bitmaskResultBlock(unsigned char* playerBlock, unsigned char * bitmaskBlock, unsigned char* backgroundBlock, unsigned char * bitmaskResult){
-
-	int i=0;
-	int j=0;
-
-	//unsigned char * bitmaskBlock = get_player_mask();
-
-	//background
-
-	for (i = 0; i < BLOCK_X_DIM; i++){
-      for (j = 0; j < BLOCK_Y_DIM; j++){
-		if(bitmaskBlock[i+j*BLOCK_X_DIM]==0){
-			//bitmaskResult[i+j*BLOCK_X_DIM] = backgroundBlock[(i+(play_x%BLOCK_X_DIM)%BLOCK_X_DIM)+j+play_y%BLOCK_*BLOCK_X_DIM + ];
-			bitmaskResult[i+j*BLOCK_X_DIM] = backgroundBlock[i+j*BLOCK_X_DIM];
-		}
-		else{
-			bitmaskResult[i+j*BLOCK_X_DIM] = playerBlock[i+j*BLOCK_X_DIM];
-		}
-	  }
-	}
- }
-
-
- /*
-  * draw_fruit_text_block
-  *   DESCRIPTION: Draw a TEXT_WIDTH*12 x TEXT_HEIGHT block at absolute
-  *                coordinates.  Mask any portion of the block not inside
-  *                the logical view window.
-  *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
-  *           blk -- image data for block (one byte per pixel, as a C array
-  *                  of dimensions [BLOCK_Y_DIM][BLOCK_X_DIM])
-  *   OUTPUTS: none
-  *   RETURN VALUE: none
-  *   SIDE EFFECTS: draws into the build buffer
-  */
- void draw_fruit_text_block(int pos_x, int pos_y, unsigned char* blk) {
-     int dx, dy;          /* loop indices for x and y traversal of block */
-     int x_left, x_right; /* clipping limits in horizontal dimension     */
-     int y_top, y_bottom; /* clipping limits in vertical dimension       */
-     int fruitTextWidth = 12 * TEXT_WIDTH;
-     int fruitTextHeight= TEXT_HEIGHT;
-
-     /* If block is completely off-screen, we do nothing. */
-     if (pos_x + fruitTextWidth <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
-         pos_y + fruitTextHeight <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
-         return;
-
-     /* Clip any pixels falling off the left side of screen. */
-     if ((x_left = show_x - pos_x) < 0)
-         x_left = 0;
-     /* Clip any pixels falling off the right side of screen. */
-     if ((x_right = show_x + SCROLL_X_DIM - pos_x) > fruitTextWidth)
-         x_right = fruitTextWidth;
-     /* Skip the first x_left pixels in both screen position and block data. */
-     pos_x += x_left;
-     blk += x_left;
-
-     /*
-      * Adjust x_right to hold the number of pixels to be drawn, and x_left
-      * to hold the amount to skip between rows in the block, which is the
-      * sum of the original left clip and (BLOCK_X_DIM - the original right
-      * clip).
-      */
-     x_right -= x_left;
-     x_left = fruitTextWidth - x_right;
-
-     /* Clip any pixels falling off the top of the screen. */
-     if ((y_top = show_y - pos_y) < 0)
-         y_top = 0;
-     /* Clip any pixels falling off the bottom of the screen. */
-     if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > fruitTextHeight)
-         y_bottom = fruitTextHeight;
-     /*
-      * Skip the first y_left pixel in screen position and the first
-      * y_left rows of pixels in the block data.
-      */
-     pos_y += y_top;
-     blk += y_top * fruitTextWidth;
-     /* Adjust y_bottom to hold the number of pixel rows to be drawn. */
-     y_bottom -= y_top;
-
-     /* Draw the clipped image. */
-     /*for (dy = 0; dy < y_bottom; dy++, pos_y++) {
-         for (dx = 0; dx < x_right; dx++, pos_x++, blk++)
-             *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
-             (3 - (pos_x & 3)) * SCROLL_SIZE) = *blk;
-         pos_x -= x_right;
-         blk += x_left;
-     }*/
-	 for (dy = 0; dy < y_bottom; dy++, pos_y++) {
-        for (dx = 0; dx < x_right; dx++, pos_x++, blk++)
-			*(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH) = *blk;
-			pos_x -= x_right;
-			blk += x_left;
-	 }
-}
+    /* Neither video page holds the build buffer image any longer. */
+    mark_all_dirty();
+    status_valid = 0;
 
+    /* Put the block images back. */
+    if (tile_cache)
+        upload_tile_cache();
+}
 
 /*
  * draw_full_block
@@ -808,6 +1228,115 @@ void clear_screens() {
  *   SIDE EFFECTS: draws into the build buffer
  */
 void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
+    draw_block(pos_x, pos_y, blk, 1);
+}
+
+/*
+ * draw_block
+ *   DESCRIPTION: Draw a BLOCK_X_DIM x BLOCK_Y_DIM block at absolute
+ *                coordinates into the build buffer, as described for
+ *                draw_full_block.
+ *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *           blk -- image data for block
+ *           mark -- 1 to mark the block's area dirty in the video pages,
+ *                   0 if the caller puts the block into the pages itself
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void draw_block(int pos_x, int pos_y, unsigned char* blk, int mark) {
+    int x_left, x_right;    /* pixels [x_left,x_right) are on screen    */
+    int y_top, y_bottom;    /* rows [y_top,y_bottom) are on screen      */
+    planar_block_t* entry;  /* the block's four phases in the atlas     */
+
+    /* If block is completely off-screen, we do nothing. */
+    if (!clip_block(pos_x, pos_y, &x_left, &x_right, &y_top, &y_bottom))
+        return;
+
+    /* Record the screen area to be copied to video memory. */
+    if (mark)
+        mark_dirty(pos_x + x_left - show_x, pos_y + y_top - show_y,
+                   x_right - x_left, y_bottom - y_top);
+
+    /*
+     * Images from blocks are taken from the atlas.  Any other image (such
+     * as a composited player) is drawn one pixel at a time, which is
+     * faster than converting it for a single use.
+     */
+    if ((entry = atlas_entry(blk)) == NULL) {
+        draw_block_pixels(pos_x, pos_y, blk);
+        return;
+    }
+    draw_planar(entry[pos_x & 3], pos_x, pos_y,
+                x_left, x_right, y_top, y_bottom);
+}
+
+/*
+ * draw_planar
+ *   DESCRIPTION: Copy part of a planar block image (see planarize_block)
+ *                into the build buffer.
+ *   INPUTS: img -- planar image for the phase pos_x & 3
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
+ *           x_left, x_right -- pixels [x_left,x_right) of each row are
+ *                              copied
+ *           y_top, y_bottom -- rows [y_top,y_bottom) are copied
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void draw_planar(planar_block_t img, int pos_x, int pos_y,
+                        int x_left, int x_right, int y_top, int y_bottom) {
+    unsigned char* row;     /* first address of a row in one plane      */
+    unsigned char* src;     /* the row's bytes in the planar image      */
+    int phase = (pos_x & 3);/* plane of the block's leftmost pixel      */
+    int k0, k1;             /* addresses [k0,k1) of a plane are drawn   */
+    int p;                  /* loop index over planes                   */
+    int dy, k;              /* loop indices over rows, addresses        */
+
+    /*
+     * Copy each plane's addresses: pixel dx = 4k + p - phase lies in
+     * [x_left,x_right) for k in [k0,k1).  Build buffer planes are stored
+     * in reverse order.
+     */
+    for (p = 0; p < 4; p++) {
+        k0 = (x_left - p + phase + 3) >> 2;
+        k1 = (x_right - p + phase + 3) >> 2;
+        row = img3 + (pos_x >> 2) + (pos_y + y_top) * SCROLL_X_WIDTH +
+              (3 - p) * SCROLL_SIZE;
+        src = img[p][y_top];
+        if (k1 - k0 == 3) {
+            /* the usual case: three bytes of a 12-pixel row per plane */
+            for (dy = y_top; dy < y_bottom; dy++) {
+                row[k0] = src[k0];
+                row[k0 + 1] = src[k0 + 1];
+                row[k0 + 2] = src[k0 + 2];
+                row += SCROLL_X_WIDTH;
+                src += TILE_X_WIDTH;
+            }
+        } else {
+            for (dy = y_top; dy < y_bottom; dy++) {
+                for (k = k0; k < k1; k++)
+                    row[k] = src[k];
+                row += SCROLL_X_WIDTH;
+                src += TILE_X_WIDTH;
+            }
+        }
+    }
+}
+
+/*
+ * draw_block_pixels
+ *   DESCRIPTION: Draw a block into the build buffer one pixel at a time,
+ *                clipped to the logical view window.  Used for images
+ *                not in the block atlas, and as the reference against
+ *                which report_block_speed checks and times the atlas.
+ *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *           blk -- image data for block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void draw_block_pixels(int pos_x, int pos_y, unsigned char* blk) {
     int dx, dy;          /* loop indices for x and y traversal of block */
     int x_left, x_right; /* clipping limits in horizontal dimension     */
     int y_top, y_bottom; /* clipping limits in vertical dimension       */
@@ -829,26 +1358,18 @@ void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
 
     /*
      * Adjust x_right to hold the number of pixels to be drawn, and x_left
-     * to hold the amount to skip between rows in the block, which is the
-     * sum of the original left clip and (BLOCK_X_DIM - the original right
-     * clip).
+     * to hold the amount to skip between rows in the block.
      */
     x_right -= x_left;
     x_left = BLOCK_X_DIM - x_right;
 
-    /* Clip any pixels falling off the top of the screen. */
+    /* Clip any pixels falling off the top and bottom of the screen. */
     if ((y_top = show_y - pos_y) < 0)
         y_top = 0;
-    /* Clip any pixels falling off the bottom of the screen. */
     if ((y_bottom = show_y + SCROLL_Y_DIM - pos_y) > BLOCK_Y_DIM)
         y_bottom = BLOCK_Y_DIM;
-    /*
-     * Skip the first y_left pixel in screen position and the first
-     * y_left rows of pixels in the block data.
-     */
     pos_y += y_top;
     blk += y_top * BLOCK_X_DIM;
-    /* Adjust y_bottom to hold the number of pixel rows to be drawn. */
     y_bottom -= y_top;
 
     /* Draw the clipped image. */
@@ -856,67 +1377,426 @@ void draw_full_block(int pos_x, int pos_y, unsigned char* blk) {
         for (dx = 0; dx < x_right; dx++, pos_x++, blk++)
             *(img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
             (3 - (pos_x & 3)) * SCROLL_SIZE) = *blk;
-			
-			//show_y * SCROLL_X_WIDTH;
         pos_x -= x_right;
         blk += x_left;
     }
 }
 
-
-//getplayermask()
-//draw_back_buff
-
 /*
- * The functions inside the preprocessor block below rely on functions
- * in maze.c to generate graphical images of the maze.  These functions
- * are neither available nor necessary for the text restoration program
- * based on this file, and are omitted to simplify linking that program.
+ * draw_sprite
+ *   DESCRIPTION: Draw a block image over the build buffer through a mask:
+ *                pixels where the mask is non-zero take the image, and
+ *                the rest keep the background already in the buffer
+ *                (maze, fruit, or text).  The background covered is
+ *                saved in spr for erase_sprite.  The sprite is read,
+ *                blended, and written in the planar order of the block
+ *                atlas, so the blend needs no per-pixel branches.
+ *   INPUTS: spr -- where to save the covered background
+ *           (pos_x,pos_y) -- coordinates of upper left corner of sprite
+ *           blk -- image data for sprite
+ *           mask -- mask for sprite (same layout as blk)
+ *   OUTPUTS: *spr -- the saved background
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
  */
-#ifndef TEXT_RESTORE_PROGRAM
+void draw_sprite(sprite_under_t* spr, int pos_x, int pos_y,
+                 unsigned char* blk, unsigned char* mask) {
+    planar_block_t tmp_blk;                 /* sprite not in atlas   */
+    unsigned char img[BLOCK_PLANAR_SIZE];   /* composited sprite     */
+    const unsigned char* src;               /* planar sprite image   */
+    planar_block_t* entry;                  /* atlas entry, if any   */
+    int phase;                              /* plane of leftmost pixel */
+
+    spr->drawn = 0;
+    if (!clip_block(pos_x, pos_y, &spr->x_left, &spr->x_right,
+                    &spr->y_top, &spr->y_bottom))
+        return;
+    spr->drawn = 1;
+    spr->x = pos_x;
+    spr->y = pos_y;
+
+    /* Find the planar images; images not in blocks are converted. */
+    phase = (pos_x & 3);
+    if ((entry = atlas_entry(blk)) != NULL) {
+        src = &entry[phase][0][0][0];
+    } else {
+        planarize_block(blk, phase, tmp_blk);
+        src = &tmp_blk[0][0][0];
+    }
+    if ((entry = atlas_entry(mask)) != NULL) {
+        spr->mask = &entry[phase][0][0][0];
+    } else {
+        planarize_block(mask, phase,
+                        (unsigned char (*)[BLOCK_Y_DIM][TILE_X_WIDTH])
+                        spr->own_mask);
+        spr->mask = spr->own_mask;
+    }
+
+    /* Save the background, blend the sprite over it, and write it back. */
+    move_planar(spr->under, pos_x, pos_y, spr->x_left, spr->x_right,
+                spr->y_top, spr->y_bottom, 0);
+    memcpy(img, spr->under, BLOCK_PLANAR_SIZE);
+    (*blend)(img, src, spr->mask, BLOCK_PLANAR_SIZE);
+    move_planar(img, pos_x, pos_y, spr->x_left, spr->x_right,
+                spr->y_top, spr->y_bottom, 1);
+
+    mark_dirty(pos_x + spr->x_left - show_x, pos_y + spr->y_top - show_y,
+               spr->x_right - spr->x_left, spr->y_bottom - spr->y_top);
+}
 
 /*
- * draw_vert_line
- *   DESCRIPTION: Draw a vertical map line into the build buffer.  The
- *                line should be offset from the left side of the logical
- *                view window screen by the given number of pixels.
- *   INPUTS: x -- the 0-based pixel column number of the line to be drawn
- *                within the logical view window (equivalent to the number
- *                of pixels from the leftmost pixel to the line to be
- *                drawn)
- *   OUTPUTS: none
- *   RETURN VALUE: Returns 0 on success.  If x is outside of the valid
- *                 SCROLL range, the function returns -1.
+ * erase_sprite
+ *   DESCRIPTION: Put back the background saved by draw_sprite under the
+ *                sprite's pixels.  Pixels outside the sprite's mask are
+ *                left alone, and only pixels on the screen both when the
+ *                sprite was drawn and now are restored (others have been
+ *                redrawn by draw_horiz_line or draw_vert_line).
+ *   INPUTS: spr -- sprite drawn by draw_sprite
+ *   OUTPUTS: spr -- marked as no longer drawn
+ *   RETURN VALUE: none
  *   SIDE EFFECTS: draws into the build buffer
  */
-int draw_vert_line(int x) {
-    /* to be written... */
-    unsigned char buf[SCROLL_Y_DIM];    /* buffer for graphical image of line */
-    unsigned char* addr;                /* address of first pixel in build    */
-                                        /*     buffer (without plane offset)  */
-    int p_off;                          /* offset of plane of first pixel     */
-    int i;                              /* loop index over pixels             */
+void erase_sprite(sprite_under_t* spr) {
+    unsigned char img[BLOCK_PLANAR_SIZE];   /* current buffer contents */
+    int x_left, x_right;                    /* pixels to restore       */
+    int y_top, y_bottom;                    /* rows to restore         */
 
-    /* Check whether requested line falls in the logical view window. */
-    if (x < 0 || x >= SCROLL_X_DIM)
-        return -1;
+    if (!spr->drawn)
+        return;
+    spr->drawn = 0;
+    if (!clip_block(spr->x, spr->y, &x_left, &x_right, &y_top, &y_bottom))
+        return;
+    if (x_left < spr->x_left)
+        x_left = spr->x_left;
+    if (x_right > spr->x_right)
+        x_right = spr->x_right;
+    if (y_top < spr->y_top)
+        y_top = spr->y_top;
+    if (y_bottom > spr->y_bottom)
+        y_bottom = spr->y_bottom;
+    if (x_left >= x_right || y_top >= y_bottom)
+        return;
 
-    /* Adjust y to the logical row value. */
-    x += show_x;
+    move_planar(img, spr->x, spr->y, x_left, x_right, y_top, y_bottom, 0);
+    (*blend)(img, spr->under, spr->mask, BLOCK_PLANAR_SIZE);
+    move_planar(img, spr->x, spr->y, x_left, x_right, y_top, y_bottom, 1);
 
-    /* Get the image of the line. and put into buffer */
-    (*vert_line_fn) (x, show_y, buf);
+    mark_dirty(spr->x + x_left - show_x, spr->y + y_top - show_y,
+               x_right - x_left, y_bottom - y_top);
+}
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (x>>2) + show_y * SCROLL_X_WIDTH;
+/*
+ * draw_text_overlay
+ *   DESCRIPTION: Draw a line of text over the build buffer.  The glyphs
+ *                come from the glyph cache as a mask (see text_to_planar),
+ *                shifted to the plane of the text's leftmost pixel; the
+ *                pixels under the characters are lifted into colors 64
+ *                to 127 (see fruit_text_RGB_avg) and blended over the
+ *                background, which is saved in ovl for erase_text_overlay.
+ *                Only the first TEXT_OVERLAY_LEN characters are drawn.
+ *   INPUTS: ovl -- where to save the covered background
+ *           (pos_x,pos_y) -- coordinates of upper left corner of text
+ *           text -- NUL-terminated string to draw
+ *   OUTPUTS: *ovl -- the mask and saved background
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer; may expand glyphs into the
+ *                 glyph cache
+ */
+void draw_text_overlay(text_overlay_t* ovl, int pos_x, int pos_y,
+                       const char* text) {
+    unsigned char glyphs[TEXT_OVERLAY_LEN * TEXT_CELL_PLANAR_SIZE];
+    unsigned char img[TEXT_OVERLAY_SIZE];   /* composited text         */
+    unsigned char lit[TEXT_OVERLAY_SIZE];   /* lightened background    */
+    unsigned char* src;     /* row of glyph plane in glyphs            */
+    unsigned char* dst;     /* row of a plane in the mask              */
+    int len;                /* number of characters drawn              */
+    int phase;              /* plane of the leftmost pixel             */
+    int p, q;               /* screen plane, matching glyph plane      */
+    int shift;              /* 1 if glyph address k - 1 is at k        */
+    int dy, k;              /* loop indices over rows, addresses       */
+
+    ovl->drawn = 0;
+    if ((len = strlen(text)) > TEXT_OVERLAY_LEN)
+        len = TEXT_OVERLAY_LEN;
+    if (len == 0)
+        return;
+    ovl->width = len * FONT_WIDTH;
+    if (!clip_rect(pos_x, pos_y, ovl->width, STATUS_BAR_HEIGHT,
+                   &ovl->x_left, &ovl->x_right, &ovl->y_top, &ovl->y_bottom))
+        return;
+    ovl->drawn = 1;
+    ovl->x = pos_x;
+    ovl->y = pos_y;
 
-    /* Calculate plane offset of first pixel.
-    Offset from tradition 01234 in (0,0) of logic window*/
-    //use x because that is the location of drawn line
-    p_off = (3 - (x & 3));
+    /*
+     * Glyph plane q holds pixels 4k + q of the text; at phase, screen
+     * plane p holds pixel 4k + p - phase, which is in glyph plane
+     * (p - phase) & 3, one address to the left when p < phase.
+     */
+    text_to_planar(text, len, glyphs, 0x00, 0xFF);
+    memset(ovl->mask, 0, TEXT_OVERLAY_SIZE);
+    phase = (pos_x & 3);
+    for (p = 0; p < 4; p++) {
+        q = ((p - phase) & 3);
+        shift = (p < phase);
+        for (dy = 0; dy < STATUS_BAR_HEIGHT; dy++) {
+            src = glyphs + (q * STATUS_BAR_HEIGHT + dy) * 2 * len;
+            dst = ovl->mask + (p * STATUS_BAR_HEIGHT + dy) *
+                  TEXT_OVERLAY_WIDTH;
+            for (k = 0; k < 2 * len; k++)
+                dst[k + shift] = src[k];
+        }
+    }
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
+    /* Save the background, blend the text over it, and write it back. */
+    memset(ovl->under, 0, TEXT_OVERLAY_SIZE);
+    move_planar_rect(ovl->under, TEXT_OVERLAY_WIDTH, STATUS_BAR_HEIGHT,
+                     pos_x, pos_y, ovl->x_left, ovl->x_right,
+                     ovl->y_top, ovl->y_bottom, 0);
+    for (k = 0; k < TEXT_OVERLAY_SIZE; k++)
+        lit[k] = (ovl->under[k] | 0x40);
+    memcpy(img, ovl->under, TEXT_OVERLAY_SIZE);
+    (*blend)(img, lit, ovl->mask, TEXT_OVERLAY_SIZE);
+    move_planar_rect(img, TEXT_OVERLAY_WIDTH, STATUS_BAR_HEIGHT,
+                     pos_x, pos_y, ovl->x_left, ovl->x_right,
+                     ovl->y_top, ovl->y_bottom, 1);
+
+    mark_dirty(pos_x + ovl->x_left - show_x, pos_y + ovl->y_top - show_y,
+               ovl->x_right - ovl->x_left, ovl->y_bottom - ovl->y_top);
+}
+
+/*
+ * erase_text_overlay
+ *   DESCRIPTION: Put back the background saved by draw_text_overlay under
+ *                the text's characters.  As with erase_sprite, only
+ *                pixels on the screen both when the text was drawn and
+ *                now are restored.
+ *   INPUTS: ovl -- text drawn by draw_text_overlay
+ *   OUTPUTS: ovl -- marked as no longer drawn
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+void erase_text_overlay(text_overlay_t* ovl) {
+    unsigned char img[TEXT_OVERLAY_SIZE];   /* current buffer contents */
+    int x_left, x_right;                    /* pixels to restore       */
+    int y_top, y_bottom;                    /* rows to restore         */
+
+    if (!ovl->drawn)
+        return;
+    ovl->drawn = 0;
+    if (!clip_rect(ovl->x, ovl->y, ovl->width, STATUS_BAR_HEIGHT,
+                   &x_left, &x_right, &y_top, &y_bottom))
+        return;
+    if (x_left < ovl->x_left)
+        x_left = ovl->x_left;
+    if (x_right > ovl->x_right)
+        x_right = ovl->x_right;
+    if (y_top < ovl->y_top)
+        y_top = ovl->y_top;
+    if (y_bottom > ovl->y_bottom)
+        y_bottom = ovl->y_bottom;
+    if (x_left >= x_right || y_top >= y_bottom)
+        return;
+
+    memset(img, 0, TEXT_OVERLAY_SIZE);
+    move_planar_rect(img, TEXT_OVERLAY_WIDTH, STATUS_BAR_HEIGHT, ovl->x,
+                     ovl->y, x_left, x_right, y_top, y_bottom, 0);
+    (*blend)(img, ovl->under, ovl->mask, TEXT_OVERLAY_SIZE);
+    move_planar_rect(img, TEXT_OVERLAY_WIDTH, STATUS_BAR_HEIGHT, ovl->x,
+                     ovl->y, x_left, x_right, y_top, y_bottom, 1);
+
+    mark_dirty(ovl->x + x_left - show_x, ovl->y + y_top - show_y,
+               x_right - x_left, y_bottom - y_top);
+}
+
+/*
+ * The functions inside the preprocessor block below rely on functions
+ * in maze.c or on the block images in blocks.c to generate graphical
+ * images of the maze.  These functions are neither available nor
+ * necessary for the text restoration program based on this file, and
+ * are omitted to simplify linking that program.
+ */
+#ifndef TEXT_RESTORE_PROGRAM
+
+/*
+ * draw_tile
+ *   DESCRIPTION: Draw one of the block images in blocks at absolute
+ *                coordinates, clipped to the logical view window.  With
+ *                the tile cache, the block is also latch-copied into the
+ *                hidden page that show_screen fills next (or queued for
+ *                show_screen when scrolling in hardware), so it need not
+ *                be copied from the build buffer.
+ *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *           tile -- block number (index into blocks)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer and possibly video memory
+ */
+void draw_tile(int pos_x, int pos_y, int tile) {
+    int sx, sy;     /* block position relative to the view           */
+    int phase;      /* plane of the block's leftmost pixel           */
+    int col;        /* address of block's first column, view-relative */
+    int dst;        /* video memory address of block's first column  */
+    int r0, r1;     /* rows of the block on the screen               */
+    int k0, k1;     /* columns (addresses) of the block on the screen */
+    int page;       /* loop index over video pages                   */
+    int next;       /* hidden page that show_screen fills next       */
+
+    if (!tile_cache) {
+        draw_full_block(pos_x, pos_y, (unsigned char*)blocks[tile]);
+        return;
+    }
+
+    /* If block is completely off-screen, we do nothing. */
+    if (pos_x + BLOCK_X_DIM <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
+        pos_y + BLOCK_Y_DIM <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+        return;
+
+    /* Keep the build buffer up to date. */
+    draw_block(pos_x, pos_y, (unsigned char*)blocks[tile], 0);
+
+    /* Clip rows to the screen. */
+    sx = pos_x - show_x;
+    sy = pos_y - show_y;
+    r0 = (sy < 0 ? -sy : 0);
+    r1 = (sy + BLOCK_Y_DIM > SCROLL_Y_DIM ? SCROLL_Y_DIM - sy : BLOCK_Y_DIM);
+
+    if (hw_scroll) {
+        /*
+         * Video memory addresses follow logical addresses, so the phase
+         * depends only on pos_x.  A page that will be copied in full
+         * needs nothing; a block in memory that the view cannot use
+         * without moving the image (or that finds the queue full) falls
+         * back to the dirty spans.
+         */
+        if (!page_full[0] && hw_start >= 0) {
+            phase = (pos_x & 3);
+            col = (pos_x >> 2) - (show_x >> 2);
+            k0 = (col < 0 ? -col : 0);
+            k1 = (col + TILE_X_WIDTH > HW_VIEW_WIDTH ?
+                  HW_VIEW_WIDTH - col : TILE_X_WIDTH);
+            dst = hw_start + (pos_y - hw_shown_y) * HW_ROW_WIDTH +
+                  (pos_x >> 2) - (hw_shown_x >> 2);
+            if (dst + r0 * HW_ROW_WIDTH + k0 < HW_MEM_START ||
+                dst + (r1 - 1) * HW_ROW_WIDTH + k1 > HW_MEM_END ||
+                queue_latch_tile(tile, phase, dst, r0, r1, k0, k1) != 0)
+                mark_dirty(sx, sy, BLOCK_X_DIM, BLOCK_Y_DIM);
+        }
+        return;
+    }
+
+    /* Pages start at the view's upper left pixel. */
+    phase = (sx & 3);
+    col = (sx - phase) / 4;
+    k0 = (col < 0 ? -col : 0);
+    k1 = (col + TILE_X_WIDTH > SCROLL_X_WIDTH ?
+          SCROLL_X_WIDTH - col : TILE_X_WIDTH);
+    next = (cur_page + 1) % num_pages;
+    for (page = 0; page < num_pages; page++) {
+        if (page_full[page])
+            continue;
+        if (page != next) {
+            mark_page_dirty(page, sx, sy, BLOCK_X_DIM, BLOCK_Y_DIM);
+            continue;
+        }
+        OUTW(0x03CE, 0x4105);   /* write mode 1 */
+        latch_tile(tile, phase, PAGE_ADDR(page) + sy * SCROLL_X_WIDTH + col,
+                   SCROLL_X_WIDTH, r0, r1, k0, k1);
+        OUTW(0x03CE, 0x4005);   /* write mode 0 */
+    }
+}
+
+/*
+ * draw_view_tiles
+ *   DESCRIPTION: Redraw the whole logical view window from block images,
+ *                one for each lattice point that is at least partly on
+ *                the screen.  With the tile cache (and page flipping),
+ *                the blocks cover every pixel of the page that
+ *                show_screen fills next, so that page is filled by latch
+ *                copies instead of being copied from the build buffer;
+ *                the other pages are copied in full when their turn
+ *                comes.
+ *   INPUTS: tile_fn -- returns the block number for a lattice point
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer and possibly video memory
+ */
+void draw_view_tiles(int (*tile_fn)(int, int)) {
+    int x0, y0;     /* first lattice point on the screen */
+    int x1, y1;     /* last lattice point on the screen  */
+    int x, y;       /* loop indices over lattice points  */
+    int page;       /* loop index over video pages       */
+
+    x0 = show_x / BLOCK_X_DIM;
+    y0 = show_y / BLOCK_Y_DIM;
+    x1 = (show_x + SCROLL_X_DIM - 1) / BLOCK_X_DIM;
+    y1 = (show_y + SCROLL_Y_DIM - 1) / BLOCK_Y_DIM;
+
+    if (tile_cache && !hw_scroll) {
+        for (page = 0; page < num_pages; page++)
+            page_full[page] = 1;
+        page = (cur_page + 1) % num_pages;
+        page_full[page] = 0;
+        memset(dirty_lo[page], DIRTY_CLEAN, SCROLL_Y_DIM);
+    }
+    for (y = y0; y <= y1; y++)
+        for (x = x0; x <= x1; x++)
+            draw_tile(x * BLOCK_X_DIM, y * BLOCK_Y_DIM, tile_fn(x, y));
+}
+
+
+//getplayermask()
+//draw_back_buff
+
+/*
+ * draw_vert_line
+ *   DESCRIPTION: Draw a vertical map line into the build buffer.  The
+ *                line should be offset from the left side of the logical
+ *                view window screen by the given number of pixels.
+ *   INPUTS: x -- the 0-based pixel column number of the line to be drawn
+ *                within the logical view window (equivalent to the number
+ *                of pixels from the leftmost pixel to the line to be
+ *                drawn)
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If x is outside of the valid
+ *                 SCROLL range, the function returns -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+int draw_vert_line(int x) {
+    /* to be written... */
+    unsigned char buf[SCROLL_Y_DIM];    /* buffer for graphical image of line */
+    unsigned char* addr;                /* address of first pixel in build    */
+                                        /*     buffer (without plane offset)  */
+    int p_off;                          /* offset of plane of first pixel     */
+    int i;                              /* loop index over pixels             */
+
+    /* Check whether requested line falls in the logical view window. */
+    if (x < 0 || x >= SCROLL_X_DIM)
+        return -1;
+
+    /* Adjust y to the logical row value. */
+    x += show_x;
+
+    /* Draw whole block columns if the content is made of blocks. */
+    if (line_tile_fn != NULL) {
+        draw_vert_tiles(x);
+        mark_dirty(x - show_x, 0, 1, SCROLL_Y_DIM);
+        return 0;
+    }
+
+    /* Get the image of the line. and put into buffer */
+    (*vert_line_fn) (x, show_y, buf);
+
+    /* Calculate starting address in build buffer. */
+    addr = img3 + (x>>2) + show_y * SCROLL_X_WIDTH;
+
+    /* Calculate plane offset of first pixel.
+    Offset from tradition 01234 in (0,0) of logic window*/
+    //use x because that is the location of drawn line
+    p_off = (3 - (x & 3));
+
+    /* Copy image data into appropriate planes in build buffer. */
+    for (i = 0; i < SCROLL_Y_DIM; i++) {
         addr[p_off * SCROLL_SIZE] = buf[i];//ASK TA ABOUT SCROLL_SIZE
         /*if (--p_off < 0) {
             p_off = 3;
@@ -924,6 +1804,9 @@ int draw_vert_line(int x) {
         }*/
         addr+=SCROLL_X_WIDTH;
     }
+
+    /* Record the column to be copied to video memory. */
+    mark_dirty(x - show_x, 0, 1, SCROLL_Y_DIM);
     return 0;
 }
 
@@ -954,6 +1837,13 @@ int draw_horiz_line(int y) {
     /* Adjust y to the logical row value. */
     y += show_y;
 
+    /* Draw whole block rows if the content is made of blocks. */
+    if (line_tile_fn != NULL) {
+        draw_tile_rect(0, y - show_y, SCROLL_X_DIM, 1);
+        mark_dirty(0, y - show_y, SCROLL_X_DIM, 1);
+        return 0;
+    }
+
     /* Get the image of the line. and put into buffer */
     (*horiz_line_fn) (show_x, y, buf);
 
@@ -973,10 +1863,169 @@ int draw_horiz_line(int y) {
         }
     }
 
+    /* Record the row to be copied to video memory. */
+    mark_dirty(0, y - show_y, SCROLL_X_DIM, 1);
+
     /* Return success. */
     return 0;
 }
 
+/*
+ * set_line_tiles
+ *   DESCRIPTION: Tell draw_horiz_line and draw_vert_line that the logical
+ *                image is made of blocks on the lattice of BLOCK_X_DIM x
+ *                BLOCK_Y_DIM squares, so that they can copy block rows
+ *                and columns directly into the build buffer planes.
+ *   INPUTS: tile_fn -- returns the block number (an index into blocks)
+ *                      at a lattice point, or NULL to go back to the
+ *                      line fill functions given to set_mode_X
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void set_line_tiles(int (*tile_fn)(int, int)) {
+    line_tile_fn = tile_fn;
+}
+
+/*
+ * draw_tile_rect
+ *   DESCRIPTION: Draw a rectangle of the logical view window from block
+ *                images: for each block the rectangle crosses, the part
+ *                inside the rectangle is copied from the block atlas a
+ *                plane row at a time.
+ *   INPUTS: (x,y) -- upper left pixel of rectangle relative to the
+ *                    logical view window (must be on the screen)
+ *           width, height -- size of rectangle in pixels (must fit on
+ *                            the screen)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void draw_tile_rect(int x, int y, int width, int height) {
+    int map_x, map_y;       /* lattice point of the current block      */
+    int pos_x, pos_y;       /* upper left pixel of the current block   */
+    int x_left, x_right;    /* pixels of the block in the rectangle    */
+    int y_top, y_bottom;    /* rows of the block in the rectangle      */
+
+    /* Make the rectangle absolute. */
+    x += show_x;
+    y += show_y;
+
+    for (map_y = y / BLOCK_Y_DIM;
+         (pos_y = map_y * BLOCK_Y_DIM) < y + height; map_y++) {
+        y_top = (pos_y < y ? y - pos_y : 0);
+        y_bottom = (pos_y + BLOCK_Y_DIM > y + height ?
+                    y + height - pos_y : BLOCK_Y_DIM);
+        for (map_x = x / BLOCK_X_DIM;
+             (pos_x = map_x * BLOCK_X_DIM) < x + width; map_x++) {
+            x_left = (pos_x < x ? x - pos_x : 0);
+            x_right = (pos_x + BLOCK_X_DIM > x + width ?
+                       x + width - pos_x : BLOCK_X_DIM);
+            draw_planar(block_atlas[(*line_tile_fn)(map_x, map_y)][pos_x & 3],
+                        pos_x, pos_y, x_left, x_right, y_top, y_bottom);
+        }
+    }
+}
+
+/*
+ * draw_view_rect
+ *   DESCRIPTION: Draw a rectangle of the logical view window that spans
+ *                the full width or full height of the screen, from block
+ *                images if set_line_tiles has been called, and otherwise
+ *                a line at a time through the fill functions.
+ *   INPUTS: (x,y) -- upper left pixel of rectangle relative to the
+ *                    logical view window
+ *           width, height -- size of rectangle in pixels; either width
+ *                            is SCROLL_X_DIM or height is SCROLL_Y_DIM
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void draw_view_rect(int x, int y, int width, int height) {
+    int i;      /* loop index over lines */
+
+    if (line_tile_fn != NULL) {
+        draw_tile_rect(x, y, width, height);
+        mark_dirty(x, y, width, height);
+    } else if (width == SCROLL_X_DIM) {
+        for (i = 0; i < height; i++)
+            (void)draw_horiz_line(y + i);
+    } else {
+        for (i = 0; i < width; i++)
+            (void)draw_vert_line(x + i);
+    }
+}
+
+/*
+ * draw_vert_tiles
+ *   DESCRIPTION: Draw one logical column of the view from block images.
+ *                The column lies in a single plane and address, so each
+ *                block crossed contributes a run of bytes one build
+ *                buffer row apart.
+ *   INPUTS: x -- logical column (absolute pixel coordinate)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void draw_vert_tiles(int x) {
+    unsigned char* addr;    /* build buffer address of the next pixel  */
+    unsigned char* src;     /* pixel in the current block image        */
+    int map_x, map_y;       /* lattice point of the current block      */
+    int sub_x, sub_y;       /* pixel within the current block          */
+    int y;                  /* logical row of the next pixel           */
+
+    map_x = x / BLOCK_X_DIM;
+    sub_x = x - map_x * BLOCK_X_DIM;
+    addr = img3 + (x >> 2) + show_y * SCROLL_X_WIDTH + (3 - (x & 3)) * SCROLL_SIZE;
+    for (y = show_y; y < show_y + SCROLL_Y_DIM; ) {
+        map_y = y / BLOCK_Y_DIM;
+        sub_y = y - map_y * BLOCK_Y_DIM;
+        src = &blocks[(*line_tile_fn)(map_x, map_y)][sub_y][sub_x];
+        for (; sub_y < BLOCK_Y_DIM && y < show_y + SCROLL_Y_DIM;
+             sub_y++, y++, src += BLOCK_X_DIM, addr += SCROLL_X_WIDTH)
+            *addr = *src;
+    }
+}
+
+/*
+ * scroll_view_window
+ *   DESCRIPTION: Move the logical view window by any distance and draw
+ *                the rows and columns that come onto the screen.  This
+ *                has the effect of calling set_view_window once per pixel
+ *                moved and drawing each new line, but shifts the build
+ *                buffer at most once and draws all new rows (and all new
+ *                columns) together, so a frame that catches up on
+ *                several moves costs about as much as a frame with one.
+ *   INPUTS: (scr_x,scr_y) -- new upper left pixel of logical view window
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may shift position of logical view window within build
+ *                 buffer; draws into the build buffer
+ */
+void scroll_view_window(int scr_x, int scr_y) {
+    int dx = scr_x - show_x;    /* pixels moved right */
+    int dy = scr_y - show_y;    /* pixels moved down  */
+
+    set_view_window(scr_x, scr_y);
+
+    /* A move of a screen or more leaves nothing worth keeping. */
+    if (dx <= -SCROLL_X_DIM || dx >= SCROLL_X_DIM ||
+        dy <= -SCROLL_Y_DIM || dy >= SCROLL_Y_DIM) {
+        draw_view_rect(0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+        return;
+    }
+
+    /* Draw the new columns, then the new rows. */
+    if (dx > 0)
+        draw_view_rect(SCROLL_X_DIM - dx, 0, dx, SCROLL_Y_DIM);
+    else if (dx < 0)
+        draw_view_rect(0, 0, -dx, SCROLL_Y_DIM);
+    if (dy > 0)
+        draw_view_rect(0, SCROLL_Y_DIM - dy, SCROLL_X_DIM, dy);
+    else if (dy < 0)
+        draw_view_rect(0, 0, SCROLL_X_DIM, -dy);
+}
+
 #endif /* !defined(TEXT_RESTORE_PROGRAM) */
 
 /*
@@ -1030,6 +2079,14 @@ static void VGA_blank(int blank_bit) {
      */
     blank_bit = ((blank_bit & 1) << 5);
 
+    if (vga_emulated) {
+        vga_emu_outb(0x03C4, 0x01);
+        vga_emu_outb(0x03C5, (vga_emu_inb(0x03C5) & 0xDF) | blank_bit);
+        (void)vga_emu_inb(0x03DA);
+        vga_emu_outb(0x03C0, 0x20);
+        return;
+    }
+
     asm volatile ("                                                    \n\
         movb $0x01, %%al         /* Set sequencer index to 1.       */ \n\
         movw $0x03C4, %%dx                                             \n\
@@ -1106,11 +2163,7 @@ static void set_CRTC_registers(unsigned short table[NUM_CRTC_REGS]) {
  */
 static void set_attr_registers(unsigned char table[NUM_ATTR_REGS * 2]) {
     /* Reset attribute register to write index next rather than data. */
-    asm volatile ("inb (%%dx),%%al"
-        :
-        : "d"(0x03DA)
-        : "eax", "memory"
-    );
+    INB(0x03DA);
     REP_OUTSB(0x03C0, table, NUM_ATTR_REGS * 2);
 }
 
@@ -1130,62 +2183,313 @@ static void set_graphics_registers(unsigned short table[NUM_GRAPHICS_REGS]) {
 
 /*
  * set_palette_color
- *   DESCRIPTION: sets palette color
- *
- *   INPUTS: Write address, R, G, B
+ *   DESCRIPTION: Set one palette color.  The color reaches the DAC at the
+ *                next show_screen (see flush_palette); setting a color to
+ *                its current value costs nothing.  May be called from any
+ *                thread.
+ *   INPUTS: writeAddress -- palette index
+ *           R, G, B -- 6-bit color components
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS:
-
-*/
-
-//to write to player head writeAddress should be x20
-
+ *   SIDE EFFECTS: changes the shadow palette
+ */
 void set_palette_color(unsigned char writeAddress, unsigned char R, unsigned char G, unsigned char B){
+    unsigned char RGB[1][3] = {{R, G, B}};
 
+    set_palette_range(writeAddress, 1, RGB);
+}
 
-	unsigned char RGB[3] = {R, G, B};
-
-	OUTB(0x03C8, writeAddress);
-
+/*
+ * set_palette_range
+ *   DESCRIPTION: Set a run of palette colors, as set_palette_color does
+ *                for one.
+ *   INPUTS: first -- first palette index
+ *           count -- number of colors
+ *           rgb -- 6-bit red, green, and blue for each color
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the shadow palette
+ */
+void set_palette_range(int first, int count, const unsigned char rgb[][3]) {
+    int i;  /* loop index over colors */
 
-//write one color
-    REP_OUTSB(0x03C9, RGB, 3);
+    pthread_mutex_lock(&palette_lock);
+    for (i = 0; i < count && first + i < PALETTE_SIZE; i++)
+        set_shadow_color(first + i, rgb[i]);
+    pthread_mutex_unlock(&palette_lock);
 }
 
-/*fruit_string*/
+/*
+ * fade_palette
+ *   DESCRIPTION: Fade a run of palette colors from their current values
+ *                to target values in equal steps, one step per call to
+ *                show_screen.  Any animation of the same colors stops.
+ *   INPUTS: first -- first palette index
+ *           count -- number of colors
+ *           target -- 6-bit red, green, and blue for each color at the end
+ *           frames -- number of frames the fade takes (at least 1)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if too many animations are running
+ *   SIDE EFFECTS: schedules the fade
+ */
+int fade_palette(int first, int count, const unsigned char target[][3],
+                 int frames) {
+    palette_anim_t* anim;   /* slot for the fade */
+
+    pthread_mutex_lock(&palette_lock);
+    anim = new_palette_anim(first, count);
+    if (anim != NULL) {
+        anim->kind = PALETTE_FADE;
+        anim->period = (frames < 1 ? 1 : frames);
+        memcpy(anim->from, shadow_palette[anim->first], anim->count * 3);
+        memcpy(anim->to, target, anim->count * 3);
+    }
+    pthread_mutex_unlock(&palette_lock);
+    return (anim == NULL ? -1 : 0);
+}
 
+/*
+ * cycle_palette
+ *   DESCRIPTION: Rotate a run of palette colors by one place (each color
+ *                moving to the next higher index, and the last to the
+ *                first) every few calls to show_screen, until stopped.
+ *                Any animation of the same colors stops.
+ *   INPUTS: first -- first palette index
+ *           count -- number of colors
+ *           frames -- number of frames between rotations (at least 1)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if too many animations are running
+ *   SIDE EFFECTS: schedules the cycle
+ */
+int cycle_palette(int first, int count, int frames) {
+    palette_anim_t* anim;   /* slot for the cycle */
+
+    pthread_mutex_lock(&palette_lock);
+    anim = new_palette_anim(first, count);
+    if (anim != NULL) {
+        anim->kind = PALETTE_CYCLE;
+        anim->period = (frames < 1 ? 1 : frames);
+    }
+    pthread_mutex_unlock(&palette_lock);
+    return (anim == NULL ? -1 : 0);
+}
 
+/*
+ * stop_palette_animation
+ *   DESCRIPTION: Stop every fade and cycle that changes any of a run of
+ *                palette colors, leaving the colors as they are.
+ *   INPUTS: first -- first palette index
+ *           count -- number of colors
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void stop_palette_animation(int first, int count) {
+    pthread_mutex_lock(&palette_lock);
+    stop_palette_anims(first, count);
+    pthread_mutex_unlock(&palette_lock);
+}
 
+/*
+ * set_shadow_color
+ *   DESCRIPTION: Change a shadow palette color, marking it dirty if it
+ *                differs.  The caller must hold palette_lock.
+ *   INPUTS: index -- palette index
+ *           rgb -- 6-bit red, green, and blue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the shadow palette
+ */
+static void set_shadow_color(int index, const unsigned char rgb[3]) {
+    if (memcmp(shadow_palette[index], rgb, 3) == 0)
+        return;
+    memcpy(shadow_palette[index], rgb, 3);
+    palette_dirty[index] = 1;
+    palette_changed = 1;
+}
 
+/*
+ * stop_palette_anims
+ *   DESCRIPTION: Stop the animations that overlap a run of colors.  The
+ *                caller must hold palette_lock.
+ *   INPUTS: first -- first palette index
+ *           count -- number of colors
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void stop_palette_anims(int first, int count) {
+    int i;  /* loop index over animations */
+
+    for (i = 0; i < MAX_PALETTE_ANIMS; i++) {
+        if (palette_anims[i].kind != PALETTE_IDLE &&
+            palette_anims[i].first < first + count &&
+            first < palette_anims[i].first + palette_anims[i].count)
+            palette_anims[i].kind = PALETTE_IDLE;
+    }
+}
 
+/*
+ * new_palette_anim
+ *   DESCRIPTION: Stop the animations that overlap a run of colors and
+ *                claim a free animation slot for the run, clipped to the
+ *                palette.  The caller must hold palette_lock and set the
+ *                kind and period.
+ *   INPUTS: first -- first palette index
+ *           count -- number of colors
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot, or NULL if the run is empty or none is free
+ *   SIDE EFFECTS: none
+ */
+static palette_anim_t* new_palette_anim(int first, int count) {
+    int i;  /* loop index over animations */
+
+    if (first < 0 || first >= PALETTE_SIZE || count < 1)
+        return NULL;
+    if (count > PALETTE_SIZE - first)
+        count = PALETTE_SIZE - first;
+    stop_palette_anims(first, count);
+    for (i = 0; i < MAX_PALETTE_ANIMS; i++) {
+        if (palette_anims[i].kind == PALETTE_IDLE) {
+            palette_anims[i].first = first;
+            palette_anims[i].count = count;
+            palette_anims[i].frame = 0;
+            return &palette_anims[i];
+        }
+    }
+    return NULL;
+}
 
 /*
- * set_palette_color
- *   DESCRIPTION: sets palette color
- *
- *   INPUTS: Write address, R, G, B
+ * step_palette_anims
+ *   DESCRIPTION: Advance every fade and cycle by one frame, changing the
+ *                shadow palette.  Finished fades are freed.  The caller
+ *                must hold palette_lock.
+ *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS:
-
-*/
+ *   SIDE EFFECTS: changes the shadow palette
+ */
+static void step_palette_anims() {
+    palette_anim_t* anim;   /* animation being advanced   */
+    unsigned char rgb[3];   /* color for one palette index */
+    unsigned char last[3];  /* color rotated to the front  */
+    int i, j, c;            /* loop indices                */
+
+    for (i = 0; i < MAX_PALETTE_ANIMS; i++) {
+        anim = &palette_anims[i];
+        if (anim->kind == PALETTE_IDLE)
+            continue;
+        anim->frame++;
+        if (anim->kind == PALETTE_FADE) {
+            for (j = 0; j < anim->count; j++) {
+                for (c = 0; c < 3; c++)
+                    rgb[c] = anim->from[j][c] +
+                             ((int)anim->to[j][c] - anim->from[j][c]) *
+                             anim->frame / anim->period;
+                set_shadow_color(anim->first + j, rgb);
+            }
+            if (anim->frame >= anim->period)
+                anim->kind = PALETTE_IDLE;
+        } else if (anim->frame >= anim->period) {
+            anim->frame = 0;
+            memcpy(last, shadow_palette[anim->first + anim->count - 1], 3);
+            for (j = anim->count - 1; j > 0; j--)
+                set_shadow_color(anim->first + j,
+                                 shadow_palette[anim->first + j - 1]);
+            set_shadow_color(anim->first, last);
+        }
+    }
+}
 
-//to write to player head writeAddress should be x20
+/*
+ * flush_palette
+ *   DESCRIPTION: Advance the palette animations and write the colors that
+ *                changed since the last flush to the DAC, as one run of
+ *                writes to 0x3C9 per contiguous range of dirty colors.  The
+ *                writes wait for vertical retrace so that no frame shows a
+ *                half-changed palette.  Frames in which no color changed
+ *                touch no ports.  Called once per frame by show_screen.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the DAC; may wait up to RETRACE_TIMEOUT
+ */
+static void flush_palette() {
+    static unsigned char rgb[PALETTE_SIZE][3];  /* colors to write      */
+    unsigned char dirty[PALETTE_SIZE];          /* 1 to write the color */
+    int first, last;                            /* run of dirty colors  */
+
+    pthread_mutex_lock(&palette_lock);
+    step_palette_anims();
+    if (!palette_changed) {
+        pthread_mutex_unlock(&palette_lock);
+        return;
+    }
+    memcpy(rgb, shadow_palette, sizeof (rgb));
+    memcpy(dirty, palette_dirty, sizeof (dirty));
+    memset(palette_dirty, 0, sizeof (palette_dirty));
+    palette_changed = 0;
+    pthread_mutex_unlock(&palette_lock);
+
+    if (!(read_input_status() & 0x08))
+        (void)wait_for_retrace_start();
+
+    for (first = 0; first < PALETTE_SIZE; first = last) {
+        if (!dirty[first]) {
+            last = first + 1;
+            continue;
+        }
+        for (last = first + 1; last < PALETTE_SIZE && dirty[last]; last++);
+        OUTB(0x03C8, first);
+        REP_OUTSB(0x03C9, rgb[first], (last - first) * 3);
+    }
+}
 
+/*
+ * fruit_text_RGB_avg
+ *   DESCRIPTION: Set palette colors 64 to 127 to the colors 0 to 63
+ *                averaged with white, for text drawn over the maze.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the shadow palette
+ */
 void fruit_text_RGB_avg(){
-  int i;
-  unsigned char writeAddress;
+  unsigned char avg[64][3];
+  int i,c;
 
   for(i=0; i<64;i++){
-    writeAddress= i+64; //the following 64 enteries in color pallete
-    set_palette_color(writeAddress, ((palette_RGB[i][0]+0x3f)/2), ((palette_RGB[i][1]+0x3f)/2), ((palette_RGB[i][2]+0x3f)/2));
+    for(c=0;c<3;c++){
+      avg[i][c]=(palette_RGB[i][c]+0x3f)/2;
+    }
   }
+  set_palette_range(64, 64, avg);
+}
 
 
+/*
+ * init_shadow_palette
+ *   DESCRIPTION: Start the shadow palette with the colors written by
+ *                fill_palette, and the rest of the 256 colors black (and
+ *                dirty, so that the first flush makes them so).  Stops
+ *                all palette animations.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: resets the shadow palette
+ */
+static void init_shadow_palette() {
+    pthread_mutex_lock(&palette_lock);
+    memset(shadow_palette, 0, sizeof (shadow_palette));
+    memcpy(shadow_palette, palette_RGB, sizeof (palette_RGB));
+    memset(palette_dirty, 0, sizeof (palette_dirty));
+    memset(palette_dirty + 64, 1, PALETTE_SIZE - 64);
+    palette_changed = 1;
+    stop_palette_anims(0, PALETTE_SIZE);
+    pthread_mutex_unlock(&palette_lock);
 }
 
-
 /*made palette_RGB a global varriable*/
 
 
@@ -1328,22 +2632,16 @@ static void set_text_mode_3(int clear_scr) {
  */
 static void copy_image(unsigned char* img, unsigned short scr_addr) {
     /*
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
+     * The copy itself is done by one of the kernels in copy_kernel.c
+     * (REP MOVSB, REP MOVSD, non-temporal vector stores, or memcpy),
+     * whichever was fastest when set_mode_X timed them.
      */
 
-    //new memory size is SCROLL_SIZE- STATUS_BUILD_SIZE=14560
-    //new memory=16000-1440=14560
-    asm volatile ("                                             \n\
-        cld                                                     \n\
-        movl $14560,%%ecx                                       \n\
-        rep movsb    /* copy ECX bytes from M[ESI] to M[EDI] */ \n\
-        "
-        : /* no outputs */
-        : "S"(img), "D"(mem_image + scr_addr)
-        : "eax", "ecx", "memory"
-    );
+    if (vga_emulated) {
+        vga_emu_write(scr_addr, img, SCROLL_SIZE);
+        return;
+    }
+    plane_copy->copy(mem_image + scr_addr, img, SCROLL_SIZE);
 }
 
 /*
@@ -1357,30 +2655,815 @@ static void copy_image(unsigned char* img, unsigned short scr_addr) {
  *   SIDE EFFECTS: copies a plane from the build buffer to video memory
  */
 static void copy_image_status(unsigned char* img, unsigned short scr_addr) {
+    /* See copy_image. */
+    if (vga_emulated) {
+        vga_emu_write(scr_addr, img, STATUS_PLANE_BUILD_SIZE);
+        return;
+    }
+    plane_copy->copy(mem_image + scr_addr, img, STATUS_PLANE_BUILD_SIZE);
+}
+
+/*
+ * copy_image_span
+ *   DESCRIPTION: Copy part of one row of one plane from the build buffer
+ *                to the video memory.
+ *   INPUTS: img -- a pointer to the first byte in the build buffer
+ *           scr_addr -- the destination offset in video memory
+ *           len -- number of bytes to copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: copies part of a plane from the build buffer to video memory
+ */
+static void copy_image_span(unsigned char* img, unsigned short scr_addr, int len) {
+    /* See copy_image. */
+    if (vga_emulated) {
+        vga_emu_write(scr_addr, img, len);
+        return;
+    }
+    plane_copy->copy(mem_image + scr_addr, img, len);
+}
+
+/*
+ * planarize_block
+ *   DESCRIPTION: Convert a block image into its planar form for one
+ *                phase: byte k of row r in plane p holds pixel 4k + p -
+ *                phase of the row, or zero if that pixel is outside the
+ *                block.
+ *   INPUTS: blk -- image data for block (one byte per pixel)
+ *           phase -- plane of the block's leftmost pixel (0 to 3)
+ *   OUTPUTS: out -- the planar image
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void planarize_block(const unsigned char* blk, int phase,
+                            planar_block_t out) {
+    int p;          /* loop index over planes          */
+    int r, k;       /* loop indices over rows, columns */
+    int x;          /* pixel within block row          */
+
+    for (p = 0; p < 4; p++)
+        for (r = 0; r < BLOCK_Y_DIM; r++)
+            for (k = 0; k < TILE_X_WIDTH; k++) {
+                x = 4 * k + p - phase;
+                out[p][r][k] = ((x >= 0 && x < BLOCK_X_DIM) ?
+                                blk[r * BLOCK_X_DIM + x] : 0);
+            }
+}
+
+#ifndef TEXT_RESTORE_PROGRAM
+
+/*
+ * build_block_atlas
+ *   DESCRIPTION: Convert every image in blocks into all four phases.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills block_atlas
+ */
+static void build_block_atlas() {
+    int b;          /* loop index over blocks */
+    int ph;         /* loop index over phases */
+
+    for (b = 0; b < NUM_BLOCKS; b++)
+        for (ph = 0; ph < 4; ph++)
+            planarize_block(&blocks[b][0][0], ph, block_atlas[b][ph]);
+}
+
+/*
+ * atlas_entry
+ *   DESCRIPTION: Find the atlas entry for a block image.
+ *   INPUTS: blk -- image data for block
+ *   OUTPUTS: none
+ *   RETURN VALUE: the image's four phases if blk is one of the images in
+ *                 blocks, or NULL
+ *   SIDE EFFECTS: none
+ */
+static planar_block_t* atlas_entry(const unsigned char* blk) {
+    long off = blk - &blocks[0][0][0];  /* offset of blk into blocks */
+
+    if (off < 0 || off >= (long)sizeof (blocks) ||
+        off % (BLOCK_X_DIM * BLOCK_Y_DIM) != 0)
+        return NULL;
+    return block_atlas[off / (BLOCK_X_DIM * BLOCK_Y_DIM)];
+}
+
+#else /* TEXT_RESTORE_PROGRAM */
+
+/* The text restoration program has no block images to convert. */
+static void build_block_atlas() {
+}
+
+static planar_block_t* atlas_entry(const unsigned char* blk) {
+    return NULL;
+}
+
+#endif /* TEXT_RESTORE_PROGRAM */
+
+/*
+ * clip_rect
+ *   DESCRIPTION: Clip a rectangle at absolute coordinates to the logical
+ *                view window.
+ *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner
+ *           width, height -- size of the rectangle in pixels
+ *   OUTPUTS: *x_left, *x_right -- pixels [x_left,x_right) of each row of
+ *                                 the rectangle are on the screen
+ *            *y_top, *y_bottom -- rows [y_top,y_bottom) are on the screen
+ *   RETURN VALUE: 1 if any of the rectangle is on the screen, 0 if none
+ *   SIDE EFFECTS: none
+ */
+static int clip_rect(int pos_x, int pos_y, int width, int height,
+                     int* x_left, int* x_right, int* y_top, int* y_bottom) {
+    if (pos_x + width <= show_x || pos_x >= show_x + SCROLL_X_DIM ||
+        pos_y + height <= show_y || pos_y >= show_y + SCROLL_Y_DIM)
+        return 0;
+    if ((*x_left = show_x - pos_x) < 0)
+        *x_left = 0;
+    if ((*x_right = show_x + SCROLL_X_DIM - pos_x) > width)
+        *x_right = width;
+    if ((*y_top = show_y - pos_y) < 0)
+        *y_top = 0;
+    if ((*y_bottom = show_y + SCROLL_Y_DIM - pos_y) > height)
+        *y_bottom = height;
+    return 1;
+}
+
+/*
+ * clip_block
+ *   DESCRIPTION: Clip a block at absolute coordinates to the logical
+ *                view window (see clip_rect).
+ *   INPUTS: (pos_x,pos_y) -- coordinates of upper left corner of block
+ *   OUTPUTS: *x_left, *x_right -- pixels [x_left,x_right) of each row of
+ *                                 the block are on the screen
+ *            *y_top, *y_bottom -- rows [y_top,y_bottom) are on the screen
+ *   RETURN VALUE: 1 if any of the block is on the screen, 0 if none
+ *   SIDE EFFECTS: none
+ */
+static int clip_block(int pos_x, int pos_y, int* x_left, int* x_right,
+                      int* y_top, int* y_bottom) {
+    return clip_rect(pos_x, pos_y, BLOCK_X_DIM, BLOCK_Y_DIM,
+                     x_left, x_right, y_top, y_bottom);
+}
+
+/*
+ * move_planar_rect
+ *   DESCRIPTION: Copy the build buffer area under a rectangle to or from
+ *                a planar image of it, limited to pixels [x_left,x_right)
+ *                of rows [y_top,y_bottom).  The planar image holds the
+ *                four planes in order, each height rows of row_width
+ *                bytes; address k of plane p is the pixel 4k + p - phase
+ *                of its row, where phase is (pos_x & 3), as for the block
+ *                atlas (see planarize_block).
+ *   INPUTS: planar -- planar image
+ *           row_width -- bytes in a row of one plane of planar
+ *           height -- rows in one plane of planar
+ *           (pos_x,pos_y) -- coordinates of upper left corner
+ *           x_left, x_right, y_top, y_bottom -- area to copy
+ *           to_build -- 1 to copy planar into the build buffer, 0 to copy
+ *                       the build buffer into planar
+ *   OUTPUTS: planar -- filled if to_build is 0
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the build buffer if to_build is 1
+ */
+static void move_planar_rect(unsigned char* planar, int row_width,
+                             int height, int pos_x, int pos_y,
+                             int x_left, int x_right, int y_top,
+                             int y_bottom, int to_build) {
+    unsigned char* row;     /* first address of a row in one plane     */
+    unsigned char* img;     /* the row in the planar image             */
+    int phase = (pos_x & 3);/* plane of the leftmost pixel             */
+    int k0, k1;             /* addresses [k0,k1) of a plane are copied */
+    int p;                  /* loop index over planes                  */
+    int dy, k;              /* loop indices over rows, addresses       */
+
+    for (p = 0; p < 4; p++) {
+        k0 = (x_left - p + phase + 3) >> 2;
+        k1 = (x_right - p + phase + 3) >> 2;
+        row = img3 + (pos_x >> 2) + (pos_y + y_top) * SCROLL_X_WIDTH +
+              (3 - p) * SCROLL_SIZE;
+        img = planar + (p * height + y_top) * row_width;
+        for (dy = y_top; dy < y_bottom; dy++) {
+            for (k = k0; k < k1; k++) {
+                if (to_build)
+                    row[k] = img[k];
+                else
+                    img[k] = row[k];
+            }
+            row += SCROLL_X_WIDTH;
+            img += row_width;
+        }
+    }
+}
+
+/*
+ * move_planar
+ *   DESCRIPTION: Copy the build buffer area under a block to or from a
+ *                planar block image (see planarize_block), limited to
+ *                pixels [x_left,x_right) of rows [y_top,y_bottom).  When
+ *                the whole block is on the screen, each plane row moves
+ *                as one four-byte word; bytes outside the block are
+ *                copied too, which is harmless as long as a blend leaves
+ *                them unchanged.  Otherwise see move_planar_rect.
+ *   INPUTS: planar -- planar block image
+ *           (pos_x,pos_y) -- coordinates of upper left corner of block
+ *           x_left, x_right, y_top, y_bottom -- area to copy
+ *           to_build -- 1 to copy planar into the build buffer, 0 to copy
+ *                       the build buffer into planar
+ *   OUTPUTS: planar -- filled if to_build is 0
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the build buffer if to_build is 1
+ */
+static void move_planar(unsigned char* planar, int pos_x, int pos_y,
+                        int x_left, int x_right, int y_top, int y_bottom,
+                        int to_build) {
+    unsigned char* row;     /* first address of a row in one plane     */
+    unsigned char* img;     /* the row in the planar image             */
+    int p;                  /* loop index over planes                  */
+    int dy;                 /* loop index over rows                    */
+
+    if (x_left != 0 || x_right != BLOCK_X_DIM || y_top != 0 ||
+        y_bottom != BLOCK_Y_DIM || TILE_X_WIDTH != 4) {
+        move_planar_rect(planar, TILE_X_WIDTH, BLOCK_Y_DIM, pos_x, pos_y,
+                         x_left, x_right, y_top, y_bottom, to_build);
+        return;
+    }
+    for (p = 0; p < 4; p++) {
+        row = img3 + (pos_x >> 2) + pos_y * SCROLL_X_WIDTH +
+              (3 - p) * SCROLL_SIZE;
+        img = planar + p * BLOCK_Y_DIM * TILE_X_WIDTH;
+        for (dy = 0; dy < BLOCK_Y_DIM; dy++) {
+            if (to_build)
+                memcpy(row, img, 4);
+            else
+                memcpy(img, row, 4);
+            row += SCROLL_X_WIDTH;
+            img += TILE_X_WIDTH;
+        }
+    }
+}
+
+/*
+ * upload_tile_cache
+ *   DESCRIPTION: Write the four phases of every block image from the
+ *                block atlas into the tile cache in video memory.
+ *                Address k of row r of a block at phase ph holds pixels
+ *                4k - ph to 4k - ph + 3 of the row in planes 0 to 3.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes video memory at TILE_CACHE_ADDR
+ */
+static void upload_tile_cache() {
+    static unsigned char plane_img[NUM_BLOCKS * 4 * TILE_SIZE];
+    unsigned char* out;     /* next byte of plane image */
+    int p;                  /* loop index over planes   */
+    int b;                  /* loop index over blocks   */
+    int ph;                 /* loop index over phases   */
+
+    for (p = 0; p < 4; p++) {
+        out = plane_img;
+        for (b = 0; b < NUM_BLOCKS; b++)
+            for (ph = 0; ph < 4; ph++, out += TILE_SIZE)
+                memcpy(out, block_atlas[b][ph][p], TILE_SIZE);
+        SET_WRITE_MASK(1 << (p + 8));
+        copy_image_span(plane_img, TILE_CACHE_ADDR, sizeof (plane_img));
+    }
+}
+
+/*
+ * latch_tile
+ *   DESCRIPTION: Copy rows [r0,r1) and columns [k0,k1) of a cached block
+ *                to video memory with latch copies.  The graphics
+ *                controller must be in write mode 1.
+ *   INPUTS: tile -- block number
+ *           phase -- plane of the block's leftmost pixel
+ *           dst -- video memory address of the block's first column in
+ *                  its first row (need not be on the screen)
+ *           row_width -- addresses between rows at dst
+ *           r0, r1 -- rows to copy
+ *           k0, k1 -- columns (addresses) to copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes video memory; changes the write mask
+ */
+static void latch_tile(int tile, int phase, int dst, int row_width,
+                       int r0, int r1, int k0, int k1) {
+    volatile unsigned char* vram = mem_image;
+    int src;        /* cache address of the block's first column */
+    int mask;       /* planes of one column inside the block     */
+    int p;          /* loop index over planes                    */
+    int r, k;       /* loop indices over rows, columns           */
+    unsigned short from, to;
+
+    src = TILE_CACHE_ADDR + (tile * 4 + phase) * TILE_SIZE;
+    for (k = k0; k < k1; k++) {
+        for (mask = 0, p = 0; p < 4; p++)
+            if (4 * k + p - phase >= 0 && 4 * k + p - phase < BLOCK_X_DIM)
+                mask |= (1 << p);
+        if (mask == 0)
+            continue;
+        SET_WRITE_MASK(mask << 8);
+        for (r = r0; r < r1; r++) {
+            from = src + r * TILE_X_WIDTH + k;
+            to = dst + r * row_width + k;
+            if (vga_emulated) {
+                (void)vga_emu_read(from);
+                vga_emu_fill(to, 0, 1);
+            } else {
+                (void)vram[from];   /* load the latches */
+                vram[to] = 0;       /* store them       */
+            }
+        }
+    }
+}
+
+#ifndef TEXT_RESTORE_PROGRAM
+
+/*
+ * queue_latch_tile
+ *   DESCRIPTION: Queue a latch copy of a cached block into the image used
+ *                when scrolling in hardware, for show_screen to make (see
+ *                latch_tile).
+ *   INPUTS: tile, phase, dst, r0, r1, k0, k1 -- as for latch_tile, with
+ *                 rows HW_ROW_WIDTH addresses apart
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the queue is full
+ *   SIDE EFFECTS: adds to the queue
+ */
+static int queue_latch_tile(int tile, int phase, int dst,
+                            int r0, int r1, int k0, int k1) {
+    queued_tile_t* q;
+
+    if (num_queued_tiles == MAX_QUEUED_TILES)
+        return -1;
+    q = &queued_tiles[num_queued_tiles++];
+    q->tile = tile;
+    q->phase = phase;
+    q->dst = dst;
+    q->r0 = r0;
+    q->r1 = r1;
+    q->k0 = k0;
+    q->k1 = k1;
+    return 0;
+}
+
+#endif /* !defined(TEXT_RESTORE_PROGRAM) */
+
+/*
+ * flush_latch_tiles
+ *   DESCRIPTION: Make the latch copies queued by queue_latch_tile.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes video memory; empties the queue; changes the
+ *                 write mask
+ */
+static void flush_latch_tiles() {
+    queued_tile_t* q;   /* loop index over queued copies */
+
+    if (num_queued_tiles == 0)
+        return;
+    OUTW(0x03CE, 0x4105);   /* write mode 1 */
+    for (q = queued_tiles; q < queued_tiles + num_queued_tiles; q++)
+        latch_tile(q->tile, q->phase, q->dst, HW_ROW_WIDTH,
+                   q->r0, q->r1, q->k0, q->k1);
+    OUTW(0x03CE, 0x4005);   /* write mode 0 */
+    num_queued_tiles = 0;
+}
+
+/*
+ * select_copy_kernel
+ *   DESCRIPTION: Choose the kernel for copy_image, copy_image_status, and
+ *                copy_image_span by timing plane-sized copies into unused
+ *                video memory (or into ordinary memory when the VGA is
+ *                emulated).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites video memory at COPY_BENCH_ADDR
+ */
+static void select_copy_kernel() {
+    if (vga_emulated) {
+        plane_copy = copy_kernel_select(NULL, SCROLL_SIZE);
+        return;
+    }
+    SET_WRITE_MASK(0x0F00);
+    plane_copy = copy_kernel_select(mem_image + COPY_BENCH_ADDR, SCROLL_SIZE);
+}
+
+/*
+ * report_copy_kernels
+ *   DESCRIPTION: Print the name of the plane copy kernel in use and the
+ *                speed of every kernel into ordinary and video memory.
+ *                Must be called in mode X.
+ *   INPUTS: f -- output stream
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears the screens and marks all pages full
+ */
+void report_copy_kernels(FILE* f) {
+    fprintf(f, "plane copy kernel: %s\n", plane_copy->name);
+    if (vga_emulated) {
+        copy_kernel_report(f, NULL, SCROLL_SIZE);
+        return;
+    }
+    SET_WRITE_MASK(0x0F00);
+    copy_kernel_report(f, mem_image + COPY_BENCH_ADDR, SCROLL_SIZE);
+    clear_screens();
+}
+
+#ifndef TEXT_RESTORE_PROGRAM
+
+/*
+ * report_block_speed
+ *   DESCRIPTION: Print the number of blocks per second drawn into the
+ *                build buffer one pixel at a time (the original
+ *                draw_full_block) and from the block atlas.  Blocks are
+ *                drawn at every phase, partly off each edge of the
+ *                screen as well as inside it, and the build buffer
+ *                produced by the atlas is checked against the original.
+ *                Must be called in mode X.
+ *   INPUTS: f -- output stream
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws over the build buffer and marks both pages full
+ */
+void report_block_speed(FILE* f) {
+    static unsigned char expect[BUILD_BUF_SIZE];
+    static const char* const names[2] = {"per pixel", "atlas"};
+    struct timeval start, end;
+    double secs;
+    int method;     /* 0: per pixel, 1: atlas            */
+    int rep;        /* loop index over passes            */
+    int n;          /* blocks drawn                      */
+    int x, y;       /* loop indices over block positions */
+    int b;          /* block drawn at a position         */
+    int reps = 200; /* passes timed per method           */
+
+    for (method = 0; method < 2; method++) {
+        memset(build + MEM_FENCE_WIDTH, 0, BUILD_BUF_SIZE);
+        n = 0;
+        gettimeofday(&start, NULL);
+        for (rep = 0; rep < reps; rep++) {
+            for (y = show_y - BLOCK_Y_DIM / 2;
+                 y < show_y + SCROLL_Y_DIM; y += BLOCK_Y_DIM - 1)
+                for (x = show_x - BLOCK_X_DIM / 2;
+                     x < show_x + SCROLL_X_DIM; x += BLOCK_X_DIM - 1, n++) {
+                    b = (x + y) % NUM_BLOCKS;
+                    if (method == 0)
+                        draw_block_pixels(x, y, (unsigned char*)blocks[b]);
+                    else
+                        draw_block(x, y, (unsigned char*)blocks[b], 0);
+                }
+        }
+        gettimeofday(&end, NULL);
+        secs = (end.tv_sec - start.tv_sec) +
+               (end.tv_usec - start.tv_usec) / 1000000.0;
+        if (method == 0)
+            memcpy(expect, build + MEM_FENCE_WIDTH, BUILD_BUF_SIZE);
+        else if (memcmp(expect, build + MEM_FENCE_WIDTH,
+                        BUILD_BUF_SIZE) != 0) {
+            fprintf(f, "%-10s  wrong image\n", names[method]);
+            continue;
+        }
+        fprintf(f, "%-10s  %10.0f blocks/s\n", names[method],
+                (secs > 0 ? n / secs : 0));
+    }
+
+    /* The build buffer no longer matches either page. */
+    mark_all_dirty();
+}
+
+#endif /* !defined(TEXT_RESTORE_PROGRAM) */
+
+/*
+ * mark_dirty
+ *   DESCRIPTION: Record that a rectangle of the logical view window has
+ *                been drawn in the build buffer and must be copied to all
+ *                video pages.  The rectangle is clipped to the screen.
+ *   INPUTS: (x,y) -- upper left pixel of rectangle relative to the
+ *                    logical view window
+ *           width, height -- size of rectangle in pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: widens the dirty spans of all video pages
+ */
+static void mark_dirty(int x, int y, int width, int height) {
+    int page;       /* loop index over video pages */
+
+    for (page = 0; page < num_pages; page++)
+        mark_page_dirty(page, x, y, width, height);
+}
+
+/*
+ * mark_page_dirty
+ *   DESCRIPTION: Record that a rectangle of the logical view window has
+ *                been drawn in the build buffer and must be copied to one
+ *                video page.  The rectangle is clipped to the screen.
+ *   INPUTS: page -- the video page
+ *           (x,y) -- upper left pixel of rectangle relative to the
+ *                    logical view window
+ *           width, height -- size of rectangle in pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: widens the dirty spans of the page
+ */
+static void mark_page_dirty(int page, int x, int y, int width, int height) {
+    int lo, hi;     /* first and last screen address in each row */
+    int row;        /* loop index over rows                      */
+
+    /* A page to be copied in full needs no more detail. */
+    if (page_full[page])
+        return;
+
+    /* Clip the rectangle to the scrolling region. */
+    if (x < 0) {
+        width += x;
+        x = 0;
+    }
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+    if (x + width > SCROLL_X_DIM)
+        width = SCROLL_X_DIM - x;
+    if (y + height > SCROLL_Y_DIM)
+        height = SCROLL_Y_DIM - y;
+    if (width <= 0 || height <= 0)
+        return;
+
     /*
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
+     * Convert pixel columns into screen addresses.  When scrolling in
+     * hardware, addresses are counted from the one holding the leftmost
+     * pixel of the view, which need not be the first pixel it holds.
      */
+    if (hw_scroll) {
+        lo = ((show_x + x) >> 2) - (show_x >> 2);
+        hi = ((show_x + x + width - 1) >> 2) - (show_x >> 2);
+    } else {
+        lo = (x >> 2);
+        hi = ((x + width - 1) >> 2);
+    }
 
-    //new memory size is SCROLL_SIZE- STATUS_BUILD_SIZE=14560
-    //new memory=1440
-    asm volatile ("                                             \n\
-        cld                                                     \n\
-        movl $1440,%%ecx                                       \n\
-        rep movsb    /* copy ECX bytes from M[ESI] to M[EDI] */ \n\
-        "
-        : /* no outputs */
-        : "S"(img), "D"(mem_image + scr_addr)
-        : "eax", "ecx", "memory"
-    );
+    for (row = y; row < y + height; row++) {
+        if (dirty_lo[page][row] == DIRTY_CLEAN) {
+            dirty_lo[page][row] = lo;
+            dirty_hi[page][row] = hi;
+            continue;
+        }
+        if (dirty_lo[page][row] > lo)
+            dirty_lo[page][row] = lo;
+        if (dirty_hi[page][row] < hi)
+            dirty_hi[page][row] = hi;
+    }
 }
 
+/*
+ * mark_all_dirty
+ *   DESCRIPTION: Record that both video pages must be copied in full at
+ *                the next calls to show_screen.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks all video pages full
+ */
+static void mark_all_dirty() {
+    int page;       /* loop index over video pages */
 
+    for (page = 0; page < NUM_PAGES; page++)
+        page_full[page] = 1;
+}
 
+/*
+ * copy_dirty_spans
+ *   DESCRIPTION: Copy the dirty spans of each row of the logical view
+ *                window from the build buffer to one video page, then
+ *                mark the page clean.
+ *   INPUTS: addr -- build buffer address of the upper left screen pixel
+ *                   (without plane offset)
+ *           p_off -- plane offset of the first display plane
+ *           page -- index of the video page being filled (at target_img)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: copies from the build buffer to video memory
+ */
+static void copy_dirty_spans(unsigned char* addr, int p_off, int page) {
+    unsigned char* plane;   /* build buffer image of one display plane */
+    int i;                  /* loop index over video planes            */
+    int row;                /* loop index over rows                    */
+    int off;                /* offset of span within a plane           */
 
-#ifdef TEXT_RESTORE_PROGRAM
+    for (i = 0; i < 4; i++) {
+        SET_WRITE_MASK(1 << (i + 8));
+        plane = addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i);
+        for (row = 0; row < SCROLL_Y_DIM; row++) {
+            if (dirty_lo[page][row] == DIRTY_CLEAN)
+                continue;
+            off = row * SCROLL_X_WIDTH + dirty_lo[page][row];
+            copy_image_span(plane + off, target_img + off,
+                            dirty_hi[page][row] - dirty_lo[page][row] + 1);
+        }
+    }
+    memset(dirty_lo[page], DIRTY_CLEAN, SCROLL_Y_DIM);
+}
 
+/*
+ * shift_dirty
+ *   DESCRIPTION: Move the dirty spans of page 0 along with the logical
+ *                view window when scrolling in hardware, so that they
+ *                keep naming the same video memory.  Spans that leave
+ *                the screen are dropped; a move by more than a screen
+ *                marks the page full.
+ *   INPUTS: d_col -- change in the address of the leftmost view pixel
+ *           d_row -- change in the top row of the view
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates the dirty spans of page 0
+ */
+static void shift_dirty(int d_col, int d_row) {
+    int row;        /* loop index over rows            */
+    int lo, hi;     /* span after the move, unclipped  */
+
+    if (page_full[0] || (d_col == 0 && d_row == 0))
+        return;
+    if (d_col <= -HW_VIEW_WIDTH || d_col >= HW_VIEW_WIDTH ||
+        d_row <= -SCROLL_Y_DIM || d_row >= SCROLL_Y_DIM) {
+        page_full[0] = 1;
+        return;
+    }
+
+    /* Move rows up (view moved down) or down (view moved up). */
+    if (d_row > 0) {
+        memmove(dirty_lo[0], dirty_lo[0] + d_row, SCROLL_Y_DIM - d_row);
+        memmove(dirty_hi[0], dirty_hi[0] + d_row, SCROLL_Y_DIM - d_row);
+        memset(dirty_lo[0] + SCROLL_Y_DIM - d_row, DIRTY_CLEAN, d_row);
+    } else if (d_row < 0) {
+        memmove(dirty_lo[0] - d_row, dirty_lo[0], SCROLL_Y_DIM + d_row);
+        memmove(dirty_hi[0] - d_row, dirty_hi[0], SCROLL_Y_DIM + d_row);
+        memset(dirty_lo[0], DIRTY_CLEAN, -d_row);
+    }
+
+    /* Move columns, clipping to the addresses read by the CRTC. */
+    if (d_col == 0)
+        return;
+    for (row = 0; row < SCROLL_Y_DIM; row++) {
+        if (dirty_lo[0][row] == DIRTY_CLEAN)
+            continue;
+        lo = dirty_lo[0][row] - d_col;
+        hi = dirty_hi[0][row] - d_col;
+        if (lo < 0)
+            lo = 0;
+        if (hi >= HW_VIEW_WIDTH)
+            hi = HW_VIEW_WIDTH - 1;
+        if (lo > hi) {
+            dirty_lo[0][row] = DIRTY_CLEAN;
+            continue;
+        }
+        dirty_lo[0][row] = lo;
+        dirty_hi[0][row] = hi;
+    }
+}
+
+/*
+ * show_hw_scroll
+ *   DESCRIPTION: Show the logical view window when scrolling in hardware.
+ *                Makes the queued latch copies and copies the dirty
+ *                spans (or, after the image is moved back to the middle
+ *                of video memory, the whole screen) to video memory, then
+ *                points the CRTC at the view.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: copies from the build buffer to video memory; changes
+ *                 the CRTC start address and the pixel panning register;
+ *                 may wait for vertical retrace (see set_display_start)
+ */
+static void show_hw_scroll() {
+    unsigned char* addr;    /* build buffer address of view          */
+    unsigned char* plane;   /* build buffer image of one video plane */
+    int start;              /* video memory offset of view           */
+    int i;                  /* loop index over video planes          */
+    int row;                /* loop index over rows                  */
+    int lo, hi;             /* span to copy in one row               */
+
+    /*
+     * Find where the view lies in video memory.  The image is moved
+     * back to the middle when the view would leave the memory set
+     * aside for it, or when the view has moved so far to the side
+     * that one address would be on the screen twice (once at each
+     * end of adjacent rows).
+     */
+    start = hw_start + (show_y - hw_shown_y) * HW_ROW_WIDTH +
+            (show_x >> 2) - (hw_shown_x >> 2);
+    if (hw_start < 0 || start < HW_MEM_START ||
+        start + HW_VIEW_SIZE > HW_MEM_END ||
+        (show_x >> 2) - (hw_shown_x >> 2) > HW_ROW_WIDTH - HW_VIEW_WIDTH ||
+        (hw_shown_x >> 2) - (show_x >> 2) > HW_ROW_WIDTH - HW_VIEW_WIDTH) {
+        start = (HW_MEM_START + HW_MEM_END - HW_VIEW_SIZE) / 2;
+        page_full[0] = 1;
+    }
+    hw_start = start;
+    hw_shown_x = show_x;
+    hw_shown_y = show_y;
+
+    /*
+     * Make the latch copies queued by draw_tile (which a full copy
+     * makes unnecessary) before the spans, which may have been drawn
+     * over the blocks since.
+     */
+    if (page_full[0])
+        num_queued_tiles = 0;
+    else
+        flush_latch_tiles();
+
+    /*
+     * Address b of row r in video plane i holds logical pixel
+     * ((show_x & ~3) + 4 * b + i, show_y + r), which is kept in build
+     * buffer plane 3 - i.
+     */
+    addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
+    for (i = 0; i < 4; i++) {
+        SET_WRITE_MASK(1 << (i + 8));
+        plane = addr + (3 - i) * SCROLL_SIZE;
+        for (row = 0; row < SCROLL_Y_DIM; row++) {
+            if (page_full[0]) {
+                lo = 0;
+                hi = HW_VIEW_WIDTH - 1;
+            } else if (dirty_lo[0][row] != DIRTY_CLEAN) {
+                lo = dirty_lo[0][row];
+                hi = dirty_hi[0][row];
+            } else {
+                continue;
+            }
+            copy_image_span(plane + row * SCROLL_X_WIDTH + lo,
+                            start + row * HW_ROW_WIDTH + lo, hi - lo + 1);
+        }
+    }
+    page_full[0] = 0;
+    memset(dirty_lo[0], DIRTY_CLEAN, SCROLL_Y_DIM);
+
+    set_display_start(start, show_x & 3);
+}
+
+/*
+ * set_display_start
+ *   DESCRIPTION: Point the CRTC at the upper left of the screen image and
+ *                set the horizontal pixel panning.  The status bar below
+ *                the line compare split is not panned (the attribute mode
+ *                control register has pixel panning mode set).  The start
+ *                address is latched at the next vertical retrace, but the
+ *                panning takes effect on the next scan line, so a change
+ *                of panning is written in that retrace; flush_palette,
+ *                called next by show_screen, then uses the same retrace.
+ *   INPUTS: addr -- video memory offset of the upper left screen address
+ *           pan -- number of pixels (0 to 3) to skip at that address
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes CRTC and attribute controller registers; may
+ *                 wait up to RETRACE_TIMEOUT
+ */
+static void set_display_start(unsigned short addr, int pan) {
+    OUTW(0x03D4, (addr & 0xFF00) | 0x0C);
+    OUTW(0x03D4, ((addr & 0x00FF) << 8) | 0x0D);
+    if (pan == hw_pan)
+        return;
+    (void)wait_for_retrace_start();
+
+    /*
+     * Reset the attribute controller to expect an index, then write the
+     * panning register (0x13) with the palette address source bit (0x20)
+     * set so that the display stays on.  In 256-color modes, panning is
+     * counted in half pixels.
+     */
+    INB(0x03DA);
+    OUTB(0x03C0, 0x33);
+    OUTB(0x03C0, pan << 1);
+    hw_pan = pan;
+}
+
+/*
+ * set_line_compare
+ *   DESCRIPTION: Set the line compare field of a table of CRTC register
+ *                values so that the screen splits just above the status
+ *                bar.  Every pixel row is scanned twice, so the status bar
+ *                starts at scan line 2 * SCROLL_Y_DIM; the split takes
+ *                effect on the line after the one matching the register.
+ *   INPUTS: crtc -- CRTC register values (index in the low byte)
+ *   OUTPUTS: crtc -- registers 0x07, 0x09, and 0x18 updated
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void set_line_compare(unsigned short crtc[NUM_CRTC_REGS]) {
+    int line = 2 * SCROLL_Y_DIM - 1;    /* last scan line before split */
+
+    crtc[0x18] = ((line & 0xFF) << 8) | 0x18;
+    crtc[0x07] = (crtc[0x07] & ~0x1000) | ((line & 0x100) << 4);
+    crtc[0x09] = (crtc[0x09] & ~0x4000) | ((line & 0x200) << 5);
+}
+
+
+
+
+#ifdef TEXT_RESTORE_PROGRAM
 /*
  * main -- for the "tr" program
  *   DESCRIPTION: Put the VGA into text mode 3 without clearing the screens,
@@ -37,6 +37,9 @@
 #ifndef MODEX_H
 #define MODEX_H
 
+#include <stdio.h>
+
+#include "blocks.h"
 #include "text.h"
 
 /*
@@ -52,9 +55,22 @@
 #define IMAGE_Y_DIM     200   /* pixels                                     */
 #define IMAGE_X_WIDTH   (IMAGE_X_DIM / 4)          /* addresses (bytes)     */
 #define SCROLL_X_DIM    IMAGE_X_DIM                /* full image width      */
-#define SCROLL_Y_DIM    (IMAGE_Y_DIM-18)               /* full image width      */
+#define SCROLL_Y_DIM    (IMAGE_Y_DIM - STATUS_BAR_HEIGHT) /* above status */
 #define SCROLL_X_WIDTH  (IMAGE_X_DIM / 4)          /* addresses (bytes)     */
-//#define STATUS_BAR_LOCATION 200-18
+
+/*
+ * The status bar occupies the bottom STATUS_BAR_HEIGHT rows of the screen
+ * and shows STATUS_BAR_TEXT_SIZE characters.  It is a split screen: the
+ * CRTC line compare register (set from STATUS_BAR_HEIGHT in set_mode_X)
+ * restarts the display at video memory address 0 below the scrolling
+ * region, so the status bar stays put while the pages flip and scroll.
+ * Its build buffer holds the four planes in reverse order (plane 3 first),
+ * each STATUS_PLANE_BUILD_SIZE bytes.
+ */
+#define STATUS_BAR_HEIGHT       18
+#define STATUS_BAR_TEXT_SIZE    (IMAGE_X_DIM / FONT_WIDTH)
+#define STATUS_BUILD_SIZE       (STATUS_BAR_HEIGHT * IMAGE_X_DIM)
+#define STATUS_PLANE_BUILD_SIZE (STATUS_BUILD_SIZE / 4)
 
 /*
  * NOTES
@@ -107,17 +123,70 @@
  * is drawn.  Other data are left untouched in most cases.
  */
 
+/*
+ * Options for set_mode_X, combined with bitwise OR.  With no options,
+ * show_screen copies the build buffer into one of two video pages and
+ * flips between them.  MODEX_HW_SCROLL instead keeps a single image in
+ * video memory that is wider than the screen and scrolls it by changing
+ * the CRTC start address and the horizontal pixel panning register, so
+ * only newly exposed lines are written to video memory.
+ *
+ * MODEX_EMULATED sends all port and video memory accesses to the
+ * emulation in vga_emu.c instead of the hardware, so the program needs
+ * neither port permissions nor /dev/mem; see vga_emu.h for the access
+ * counts it keeps.
+ *
+ * MODEX_TILE_CACHE keeps the block images in otherwise unused video
+ * memory, and draw_tile and draw_view_tiles copy them to the screen
+ * within video memory (four pixels per byte access) rather than from
+ * the build buffer.
+ *
+ * MODEX_TRIPLE_BUFFER adds a third video page, so that show_screen can
+ * fill a page while the one it committed last waits for the vertical
+ * retrace; the start address is changed only after that retrace and
+ * outside retrace.  It has no effect with MODEX_HW_SCROLL.
+ */
+#define MODEX_HW_SCROLL     0x0001
+#define MODEX_EMULATED      0x0002
+#define MODEX_TILE_CACHE    0x0004
+#define MODEX_TRIPLE_BUFFER 0x0008
+
+/* time show_screen spent waiting for a free page (triple buffered) */
+typedef struct present_stats_t {
+    unsigned long frames;           /* frames shown                     */
+    unsigned long waits;            /* frames that waited for retrace   */
+    unsigned long wait_usec;        /* total time waited                */
+    long max_wait_usec;             /* longest single wait              */
+    long refresh_usec;              /* measured refresh period, or 0    */
+} present_stats_t;
+
 /* configure VGA for mode X; initializes logical view to (0,0) */
 extern int set_mode_X(
         void (*horiz_fill_fn)(int, int, unsigned char[SCROLL_X_DIM]),
-        void (*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM]));
+        void (*vert_fill_fn)(int, int, unsigned char[SCROLL_Y_DIM]),
+        int options);
+
+/* read the triple buffering wait times since set_mode_X */
+extern void get_present_stats(present_stats_t* out);
 
 /* return to text mode */
 extern void clear_mode_X();
 
+/* print the speed of each plane copy kernel (see copy_kernel.h) */
+extern void report_copy_kernels(FILE* f);
+
+/* print the speed of drawing blocks into the build buffer */
+extern void report_block_speed(FILE* f);
+
 /* set logical view window coordinates */
 extern void set_view_window(int scr_x, int scr_y);
 
+/*
+ * set logical view window coordinates and draw the lines that come onto
+ * the screen, however far the window moves
+ */
+extern void scroll_view_window(int scr_x, int scr_y);
+
 /* show the logical view window on the monitor */
 extern void show_screen();
 
@@ -131,19 +200,97 @@ extern void clear_screens();
  */
 extern void draw_full_block(int pos_x, int pos_y, unsigned char* blk);
 
+/* draw block number tile (see blocks.h) like draw_full_block */
+extern void draw_tile(int pos_x, int pos_y, int tile);
+
+/*
+ * redraw the logical view window from blocks; tile_fn gives the block
+ * number for each lattice point (pixel / block size)
+ */
+extern void draw_view_tiles(int (*tile_fn)(int, int));
+
 /* draw a horizontal line at vertical pixel y within the logical view window */
 extern int draw_horiz_line(int y);
 
 /* draw a vertical line at horizontal pixel x within the logical view window */
 extern int draw_vert_line(int x);
 
+/*
+ * draw lines from block images rather than the fill functions; tile_fn
+ * gives the block number for each lattice point (NULL to stop)
+ */
+extern void set_line_tiles(int (*tile_fn)(int, int));
+
 extern void draw_status_bar(char * status_bar_text, unsigned char * status_build, int statusColor1, int statusColor2);
 
-extern void bitmaskResultBlock(unsigned char* playerBlock, unsigned char* bitmaskBlock, unsigned char* backgroundBlock, unsigned char * bitmaskResult);
+/*
+ * A sprite is a block image drawn over the build buffer through a mask
+ * (non-zero where the sprite shows).  draw_sprite keeps the background
+ * it covers here, so that erase_sprite can put it back; the bytes are in
+ * the planar order used to draw blocks (four planes of BLOCK_Y_DIM rows
+ * of BLOCK_PLANE_WIDTH bytes).
+ */
+#define BLOCK_PLANE_WIDTH ((BLOCK_X_DIM + 3 + 3) / 4)
+#define BLOCK_PLANAR_SIZE (4 * BLOCK_Y_DIM * BLOCK_PLANE_WIDTH)
+typedef struct sprite_under_t {
+    int drawn;                  /* 1 while the sprite is in the buffer */
+    int x, y;                   /* upper left corner of the sprite     */
+    int x_left, x_right;        /* pixels [x_left,x_right) and rows    */
+    int y_top, y_bottom;        /*   [y_top,y_bottom) were on screen   */
+    const unsigned char* mask;  /* planar mask the sprite was drawn by */
+    unsigned char under[BLOCK_PLANAR_SIZE];
+    unsigned char own_mask[BLOCK_PLANAR_SIZE];  /* mask not in blocks  */
+} sprite_under_t;
+
+/* draw blk over the build buffer where mask is non-zero, saving the rest */
+extern void draw_sprite(sprite_under_t* spr, int pos_x, int pos_y,
+                        unsigned char* blk, unsigned char* mask);
 
+/* restore the background under a sprite drawn by draw_sprite */
+extern void erase_sprite(sprite_under_t* spr);
+
+/*
+ * Text drawn over the maze, such as the name of a fruit the player has
+ * eaten.  The characters come from the glyph cache (see text_to_planar)
+ * as a mask, and each pixel under a character is lifted into colors 64
+ * to 127, which hold colors 0 to 63 lightened (see fruit_text_RGB_avg).
+ * As with a sprite, the background covered is kept so that the text can
+ * be erased.  Planes hold one address more than the text for its phase.
+ */
+#define TEXT_OVERLAY_LEN      12
+#define TEXT_CELL_PLANAR_SIZE (4 * STATUS_BAR_HEIGHT * 2)
+#define TEXT_OVERLAY_WIDTH    (2 * TEXT_OVERLAY_LEN + 1)
+#define TEXT_OVERLAY_SIZE     ((4 * STATUS_BAR_HEIGHT * TEXT_OVERLAY_WIDTH + 15) & ~15)
+typedef struct text_overlay_t {
+    int drawn;                  /* 1 while the text is in the buffer   */
+    int x, y;                   /* upper left corner of the text       */
+    int width;                  /* width of the text in pixels         */
+    int x_left, x_right;        /* pixels [x_left,x_right) and rows    */
+    int y_top, y_bottom;        /*   [y_top,y_bottom) were on screen   */
+    unsigned char mask[TEXT_OVERLAY_SIZE];  /* glyphs at the phase     */
+    unsigned char under[TEXT_OVERLAY_SIZE];
+} text_overlay_t;
+
+/* draw up to TEXT_OVERLAY_LEN characters of text over the build buffer */
+extern void draw_text_overlay(text_overlay_t* ovl, int pos_x, int pos_y,
+                              const char* text);
+
+/* restore the background under text drawn by draw_text_overlay */
+extern void erase_text_overlay(text_overlay_t* ovl);
+
+/*
+ * Palette changes go to a shadow palette, and the colors that changed
+ * reach the DAC during the vertical retrace in the next show_screen.
+ * These may be called from any thread.  Fades and cycles advance one step
+ * per show_screen; starting one stops any other animating the same colors.
+ */
 extern void set_palette_color(unsigned char writeAddress, unsigned char R, unsigned char G, unsigned char B);
+extern void set_palette_range(int first, int count, const unsigned char rgb[][3]);
+extern int fade_palette(int first, int count, const unsigned char target[][3],
+                        int frames);
+extern int cycle_palette(int first, int count, int frames);
+extern void stop_palette_animation(int first, int count);
 extern void fruit_text_RGB_avg();
-extern void draw_fruit_text_block(int pos_x, int pos_y, unsigned char* blk);
 
 
 
@@ -0,0 +1,258 @@
+/*
+ * tab:4
+ *
+ * replay.c - recording and replaying the input of a game
+ *
+ * See replay.h for the file format.  A recording is read into memory as
+ * a whole before the game starts; events are then consumed in order as
+ * the game logic reaches their ticks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+/* one dir or ticks event */
+typedef struct replay_event_t {
+    unsigned long tick;
+    int value;
+} replay_event_t;
+
+/* events of one kind, and the next to be replayed */
+typedef struct replay_list_t {
+    replay_event_t* ev;
+    int n, cap;
+    int next;
+} replay_list_t;
+
+static replay_mode_t mode = REPLAY_OFF;
+static FILE* out;                   /* recording being written          */
+static int seen_dir = -1;           /* next_dir last recorded, or -1    */
+static replay_list_t dirs;          /* recorded directions              */
+static replay_list_t frames;        /* recorded frame tick counts       */
+static unsigned long end_tick;      /* tick at which the game ended     */
+
+/* local functions--see function headers for details */
+static int add_event(replay_list_t* list, unsigned long tick, int value);
+static int next_event(replay_list_t* list, unsigned long tick, int* value);
+
+/*
+ * add_event
+ *   DESCRIPTION: Append an event to a list.
+ *   INPUTS: list -- the list
+ *           tick, value -- the event
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if out of memory
+ *   SIDE EFFECTS: may grow the list
+ */
+static int add_event(replay_list_t* list, unsigned long tick, int value) {
+    replay_event_t* ev;
+
+    if (list->n == list->cap) {
+        list->cap = (list->cap == 0 ? 256 : 2 * list->cap);
+        ev = realloc(list->ev, list->cap * sizeof (*ev));
+        if (ev == NULL)
+            return -1;
+        list->ev = ev;
+    }
+    list->ev[list->n].tick = tick;
+    list->ev[list->n].value = value;
+    list->n++;
+    return 0;
+}
+
+/*
+ * next_event
+ *   DESCRIPTION: Consume the next event of a list if it is at a tick.
+ *   INPUTS: list -- the list
+ *           tick -- current tick
+ *   OUTPUTS: value -- the event's value, if there is one
+ *   RETURN VALUE: 1 if an event was consumed, 0 if not
+ *   SIDE EFFECTS: advances the list
+ */
+static int next_event(replay_list_t* list, unsigned long tick, int* value) {
+    if (list->next == list->n || list->ev[list->next].tick != tick)
+        return 0;
+    *value = list->ev[list->next++].value;
+    return 1;
+}
+
+/*
+ * replay_record
+ *   DESCRIPTION: Start recording a game.
+ *   INPUTS: path -- file to write
+ *           seed -- maze seed used by the game
+ *           gen -- maze generator used by the game (a maze_gen_t)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates or replaces the file
+ */
+int replay_record(const char* path, unsigned int seed, int gen) {
+    if ((out = fopen(path, "w")) == NULL)
+        return -1;
+    fprintf(out, "maze-replay 2\nseed %u\ngen %d\n", seed, gen);
+    mode = REPLAY_RECORD;
+    return 0;
+}
+
+/*
+ * replay_play
+ *   DESCRIPTION: Load a recording to replay.
+ *   INPUTS: path -- file to read
+ *   OUTPUTS: seed -- maze seed of the recorded game
+ *            gen -- maze generator of the recorded game, or -1 for a
+ *                   version 1 recording, which does not say
+ *   RETURN VALUE: 0 on success, -1 on failure (with a message printed)
+ *   SIDE EFFECTS: allocates the event lists
+ */
+int replay_play(const char* path, unsigned int* seed, int* gen) {
+    char line[80], kind[16];
+    unsigned long tick;
+    int value, version = 0, have_seed = 0, have_end = 0, n, lineno = 0;
+    FILE* in;
+
+    *gen = -1;
+    if ((in = fopen(path, "r")) == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof (line), in) != NULL) {
+        lineno++;
+        if (lineno == 1) {
+            if (sscanf(line, "maze-replay %d", &version) != 1 ||
+                version < 1 || version > 2)
+                break;
+            continue;
+        }
+        n = sscanf(line, "%15s %lu %d", kind, &tick, &value);
+        if (n == 2 && strcmp(kind, "seed") == 0) {
+            *seed = (unsigned int)tick;
+            have_seed = 1;
+        } else if (n == 2 && strcmp(kind, "gen") == 0) {
+            *gen = (int)tick;
+        } else if (n == 3 && strcmp(kind, "dir") == 0) {
+            if (add_event(&dirs, tick, value) != 0)
+                break;
+        } else if (n == 3 && strcmp(kind, "ticks") == 0) {
+            if (add_event(&frames, tick, value) != 0)
+                break;
+        } else if (n == 2 && strcmp(kind, "end") == 0) {
+            end_tick = tick;
+            have_end = 1;
+        } else {
+            break;
+        }
+    }
+    fclose(in);
+    if (!have_seed || !have_end || (version == 2 && *gen < 0)) {
+        fprintf(stderr, "%s: not a complete recording (line %d)\n",
+                path, lineno);
+        return -1;
+    }
+    mode = REPLAY_PLAY;
+    return 0;
+}
+
+/*
+ * replay_mode
+ *   DESCRIPTION: Get the recording or replay mode.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: REPLAY_OFF, REPLAY_RECORD, or REPLAY_PLAY
+ *   SIDE EFFECTS: none
+ */
+replay_mode_t replay_mode() {
+    return mode;
+}
+
+/*
+ * replay_level_start
+ *   DESCRIPTION: Note that the game logic has set next_dir itself for a
+ *                new level, so that the next direction seen is recorded
+ *                even if it matches the last one recorded.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void replay_level_start() {
+    seen_dir = -1;
+}
+
+/*
+ * replay_dir
+ *   DESCRIPTION: Called with the direction requested by the keyboard each
+ *                time the game logic reads it.  When recording, a change
+ *                is written out; when replaying, the recorded direction
+ *                is returned in place of the keyboard's.
+ *   INPUTS: tick -- game logic tick
+ *           next_dir -- direction requested
+ *   OUTPUTS: none
+ *   RETURN VALUE: the direction the game logic should use
+ *   SIDE EFFECTS: writes to the recording
+ */
+int replay_dir(unsigned long tick, int next_dir) {
+    int value;
+
+    if (mode == REPLAY_PLAY) {
+        if (next_event(&dirs, tick, &value))
+            next_dir = value;
+    } else if (mode == REPLAY_RECORD && next_dir != seen_dir) {
+        fprintf(out, "dir %lu %d\n", tick, next_dir);
+    }
+    seen_dir = next_dir;
+    return next_dir;
+}
+
+/*
+ * replay_ticks
+ *   DESCRIPTION: Called with the number of RTC ticks a frame handles.
+ *                When recording, counts other than one are written out;
+ *                when replaying, the recorded count is returned.
+ *   INPUTS: tick -- game logic tick before the frame
+ *           ticks -- RTC ticks since the last frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of ticks the frame should handle
+ *   SIDE EFFECTS: writes to the recording
+ */
+int replay_ticks(unsigned long tick, int ticks) {
+    int value;
+
+    if (mode == REPLAY_PLAY)
+        return (next_event(&frames, tick, &value) ? value : 1);
+    if (mode == REPLAY_RECORD && ticks != 1)
+        fprintf(out, "ticks %lu %d\n", tick, ticks);
+    return ticks;
+}
+
+/*
+ * replay_ended
+ *   DESCRIPTION: Check whether a replayed game has reached the tick at
+ *                which the recorded game ended (by quitting).
+ *   INPUTS: tick -- game logic tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if replaying and the game has ended, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int replay_ended(unsigned long tick) {
+    return (mode == REPLAY_PLAY && tick >= end_tick);
+}
+
+/*
+ * replay_finish
+ *   DESCRIPTION: Write the end of a recording and close it.
+ *   INPUTS: tick -- game logic tick at which the game ended
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: closes the recording
+ */
+void replay_finish(unsigned long tick) {
+    if (mode != REPLAY_RECORD)
+        return;
+    fprintf(out, "end %lu\n", tick);
+    fclose(out);
+    out = NULL;
+    mode = REPLAY_OFF;
+}
@@ -0,0 +1,59 @@
+/*
+ * tab:4
+ *
+ * replay.h - recording and replaying the input of a game
+ *
+ * A recording holds everything that makes one run of the game differ from
+ * another: the maze seed and generator, each change of the direction
+ * requested from the keyboard as the game logic saw it, the frames that
+ * handled more than one RTC tick, and the tick at which the game ended.
+ * Times are counted in ticks of game logic (one per movement step), so a
+ * replay runs the same logic on the same ticks with no RTC, keyboard, or
+ * terminal, and as fast as the machine allows.
+ *
+ * The file is text, one event per line:
+ *   maze-replay 2
+ *   seed <seed>
+ *   gen <generator>           (a maze_gen_t value)
+ *   dir <tick> <direction>    (next_dir seen at tick, a dir_t value)
+ *   ticks <tick> <count>      (frame starting after tick handled count)
+ *   end <tick>
+ * Version 1 recordings have no gen line; they replay with the generator
+ * given on the command line.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+typedef enum {
+    REPLAY_OFF,                 /* normal play                     */
+    REPLAY_RECORD,              /* play, writing a recording       */
+    REPLAY_PLAY                 /* replay a recording              */
+} replay_mode_t;
+
+/* start recording to a file; returns 0, or -1 on failure */
+extern int replay_record(const char* path, unsigned int seed, int gen);
+
+/* load a recording and get its seed and generator (-1 if not recorded);
+   returns 0, or -1 on failure */
+extern int replay_play(const char* path, unsigned int* seed, int* gen);
+
+/* current mode */
+extern replay_mode_t replay_mode();
+
+/* note that the game logic has reset next_dir for a new level */
+extern void replay_level_start();
+
+/* record, or replace with the recording, next_dir as seen at a tick */
+extern int replay_dir(unsigned long tick, int next_dir);
+
+/* record, or replace with the recording, the RTC ticks of a frame */
+extern int replay_ticks(unsigned long tick, int ticks);
+
+/* when replaying, 1 if the recorded game ended by this tick */
+extern int replay_ended(unsigned long tick);
+
+/* finish a recording with the tick at which the game ended */
+extern void replay_finish(unsigned long tick);
+
+#endif /* REPLAY_H */
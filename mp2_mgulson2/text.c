@@ -36,6 +36,7 @@
 
 #include <string.h>
 
+#include "modex.h"
 #include "text.h"
 
 /*
@@ -47,17 +48,8 @@
  * Each character is 8x16 pixels and occupies two lines in the table below.
  * Each byte represents a single bitmapped line of a single character.
  */
-#define SCROLL_X_WIDTH            (IMAGE_X_DIM / 4)          /* addresses (bytes)     */
-#define STATUS_BAR_TEXT_SIZE      40
-#define STATUS_BAR_HEIGHT		      18
-#define TEXT_WIDTH                8
-#define TEXT_WIDTH_DIM            8/4
-#define TEXT_HEIGHT               16
-#define STATUS_BUILD_SIZE  		    (STATUS_BAR_HEIGHT*IMAGE_X_DIM)
-#define STATUS_PLANE_BUILD_SIZE   STATUS_BUILD_SIZE/4
-#define IMAGE_X_DIM               320   /* pixels; must be divisible by 4             */
-#define IMAGE_Y_DIM               200   /* pixels                                     */
-#define IMAGE_X_WIDTH             (IMAGE_X_DIM / 4)          /* addresses (bytes)*/
+#define TEXT_WIDTH                FONT_WIDTH
+#define TEXT_HEIGHT               FONT_HEIGHT
 
 /*void concatenatePlanes(unsigned char * plane0, unsigned char* plane1, unsigned char * plane2, unsigned char * plane3, unsigned char * status_buffer){
   int i;
@@ -89,81 +81,147 @@
 
 
 void text_to_graphics(char * text, unsigned char * status_buffer, int statusColor1, int statusColor2){
-  //////TEXT to graphics
-  //pad zeros on each side
-  //planes
-  //status_buffer[((3-j)%4)*(STATUS_BUILD_SIZE/4)+(j/4)+(k*IMAGE_X_WIDTH)+(2*i)] = convert_to_bitmask[j+(k-1)*TEXT_WIDTH+i*TEXT_WIDTH*TEXT_HEIGHT];
+  int i;
 
-  /*int statusColor1, statusColor2;
-  statusColor1=1;
-  statusColor2=5;*/
-  //TEXT_WIDTH? OR TEXT_WIDTH_DIM
+  for(i=0;i<STATUS_BAR_TEXT_SIZE;i++){
+    text_cell_to_graphics(text[i], i, status_buffer, statusColor1, statusColor2);
+  }
+}
+
+/*
+ * Glyph cache.  Each font_data glyph is expanded once per color pair
+ * into the planar form of a status bar cell: for each plane, the two
+ * bytes of each of the STATUS_BAR_HEIGHT rows (the rows below the font
+ * are background).  Drawing a cell then copies 4 x 18 x 2 bytes.  The
+ * status bar and the fruit text use different colors, so a few color
+ * pairs are cached at once; the least recently used pair is replaced
+ * when the colors change (once per level).  Glyphs are expanded only
+ * when first drawn.
+ */
+#define GLYPH_CACHE_PAIRS         2
+typedef unsigned char glyph_t[4][STATUS_BAR_HEIGHT][2];
+static struct {
+  int color1, color2;             /* background and text colors      */
+  unsigned long last_use;         /* use_count at last lookup, 0 if  */
+                                  /*   the slot is empty             */
+  unsigned char valid[256];       /* 1 if the glyph has been built   */
+  glyph_t glyph[256];
+} glyph_cache[GLYPH_CACHE_PAIRS];
+static unsigned long use_count;
+
+/*
+ * get_glyph
+ *   DESCRIPTION: find the planar image of a character in the glyph cache,
+ *                building it (and claiming a slot for the color pair) if
+ *                necessary
+ *   INPUTS: c -- character
+ *           statusColor1 -- background color
+ *           statusColor2 -- foreground color
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the glyph
+ *   SIDE EFFECTS: may replace the cached glyphs of another color pair
+ */
+static glyph_t* get_glyph(unsigned char c, int statusColor1, int statusColor2){
   unsigned char char_data;
-//  unsigned char temp_buffer[STATUS_BAR_TEXT_SIZE*STATUS_BAR_HEIGHT*TEXT_WIDTH];
-  unsigned char convert_to_bitmask[IMAGE_X_DIM*STATUS_BAR_HEIGHT];
-  int stringSize= 40;
-  int i,j,k;
-  int txtIdx;
-  //, plane;
-  for(i=0;i<stringSize;i++){
-    //status_buffer
-    txtIdx=(int)text[i];
+  int slot,lru,plane,k,j;
+
+  /* Find the color pair, or replace the least recently used one. */
+  lru=0;
+  for(slot=0;slot<GLYPH_CACHE_PAIRS;slot++){
+    if(glyph_cache[slot].last_use!=0 &&
+       glyph_cache[slot].color1==statusColor1 &&
+       glyph_cache[slot].color2==statusColor2){
+      break;
+    }
+    if(glyph_cache[slot].last_use<glyph_cache[lru].last_use){
+      lru=slot;
+    }
+  }
+  if(slot==GLYPH_CACHE_PAIRS){
+    slot=lru;
+    glyph_cache[slot].color1=statusColor1;
+    glyph_cache[slot].color2=statusColor2;
+    memset(glyph_cache[slot].valid,0,sizeof(glyph_cache[slot].valid));
+  }
+  glyph_cache[slot].last_use=++use_count;
+
+  if(!glyph_cache[slot].valid[c]){
     for(k=0;k<STATUS_BAR_HEIGHT;k++){
-      for(j=0;j<TEXT_WIDTH;j++){    //TEXT_WIDTH or TEXT_WIDTH_DIM
-        //warning array subscript has type char
-        char_data=font_data[txtIdx][k];
-        if(k==0||k==STATUS_BAR_HEIGHT-1){
-          convert_to_bitmask[j+k*IMAGE_X_DIM+i*TEXT_WIDTH]=statusColor1;
-        }
-        if((char_data<<j)&0x80){
-          convert_to_bitmask[j+k*IMAGE_X_DIM+i*TEXT_WIDTH]=statusColor2;
-        }
-        else{
-          convert_to_bitmask[j+k*IMAGE_X_DIM+i*TEXT_WIDTH]=statusColor1;
+      char_data=(k<FONT_HEIGHT ? font_data[c][k] : 0);
+      for(plane=0;plane<4;plane++){
+        for(j=0;j<2;j++){
+          /* pixel 4j+plane of the cell; bit 7 of the font row is pixel 0 */
+          glyph_cache[slot].glyph[c][plane][k][j]=
+            ((char_data<<(4*j+plane))&0x80) ? statusColor2 : statusColor1;
         }
       }
     }
+    glyph_cache[slot].valid[c]=1;
   }
-  //create background of pallette 1
-  for(i=0;i<STATUS_BUILD_SIZE;i++){
-    //status_buffer is 18x320
-    status_buffer[i]=1;
-  }
-  /*for(i=0; i<stringSize; i++){
-      for(j=0;j<TEXT_WIDTH;j++){    //TEXT_WIDTH or TEXT_WIDTH_DIM
-        for(k=0;k<STATUS_BAR_HEIGHT;k++){
-  */
-/*unsigned char plane0[STATUS_PLANE_BUILD_SIZE];  //plane 0
-unsigned char plane1[STATUS_PLANE_BUILD_SIZE];  //plane 1
-unsigned char plane2[STATUS_PLANE_BUILD_SIZE];  //plane 2
-unsigned char plane3[STATUS_PLANE_BUILD_SIZE];  //plane 3
-*/
-//int plane;
-/*for(i=0; i<STATUS_BAR_TEXT_SIZE; i++){
-    for(j=0;j<TEXT_WIDTH;j++){    //TEXT_WIDTH or TEXT_WIDTH_DIM
-      for(k=1;k<STATUS_BAR_HEIGHT-1;k++){*/
-        /*plane = j%4;
-        if(plane==0){
-          plane0[(j/4)+(k*2*STATUS_BAR_TEXT_SIZE)+(2*i)] = convert_to_bitmask[j+(k-1)*IMAGE_X_DIM+i*TEXT_WIDTH];
-        }
-        else if(plane==1){
-          plane1[(j/4)+(k*2*STATUS_BAR_TEXT_SIZE)+(2*i)] = convert_to_bitmask[j+(k-1)*IMAGE_X_DIM+i*TEXT_WIDTH];
-        }
-        else if(plane==2){
-          plane2[(j/4)+(k*2*STATUS_BAR_TEXT_SIZE)+(2*i)] = convert_to_bitmask[j+(k-1)*IMAGE_X_DIM+i*TEXT_WIDTH];
-        }
-        else{
-          plane3[(j/4)+(k*2*STATUS_BAR_TEXT_SIZE)+(2*i)] = convert_to_bitmask[j+(k-1)*IMAGE_X_DIM+i*TEXT_WIDTH];
-        }*/
-        //status_buffer[((j)%4)*(STATUS_BUILD_SIZE/4)+(j/4)+(k*IMAGE_X_DIM)+(2*i)] = convert_to_bitmask[j+(k-1)*IMAGE_X_DIM+i*TEXT_WIDTH];
+  return &glyph_cache[slot].glyph[c];
+}
 
-    for(i=0; i<4; i++){
-      for(j=0;j<STATUS_PLANE_BUILD_SIZE;j++){
+/*
+ * text_cell_to_graphics
+ *   DESCRIPTION: draw one character cell of the status bar into a status
+ *                build buffer.  The buffer holds the four planes of the
+ *                bar in reverse order (plane 3 first), each STATUS_BAR_HEIGHT
+ *                rows of IMAGE_X_WIDTH bytes; the character at cell i
+ *                covers bytes 2i and 2i+1 of every row of every plane.
+ *                The font is FONT_HEIGHT rows tall, and the rows below
+ *                it are background.
+ *   INPUTS: c -- character to draw
+ *           cell -- cell number, from 0 to STATUS_BAR_TEXT_SIZE - 1
+ *           status_buffer -- status build buffer
+ *           statusColor1 -- background color
+ *           statusColor2 -- foreground color
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: overwrites the cell's bytes in status_buffer; may
+ *                 expand the glyph into the glyph cache
+ */
+void text_cell_to_graphics(char c, int cell, unsigned char * status_buffer, int statusColor1, int statusColor2){
+  glyph_t* glyph=get_glyph((unsigned char)c,statusColor1,statusColor2);
+  unsigned char* dst;
+  int plane,k;
 
-        status_buffer[(3-i)*1440+j] = convert_to_bitmask[i+j*4];
+  for(plane=0;plane<4;plane++){
+    dst=status_buffer+(3-plane)*STATUS_PLANE_BUILD_SIZE+2*cell;
+    for(k=0;k<STATUS_BAR_HEIGHT;k++,dst+=IMAGE_X_WIDTH){
+      memcpy(dst,(*glyph)[plane][k],2);
+    }
+  }
+}
 
+/*
+ * text_to_planar
+ *   DESCRIPTION: draw a line of text into a planar image with the glyph
+ *                cache, as for the status bar but with rows only as wide
+ *                as the text.  The image holds four planes (plane 0
+ *                first), each STATUS_BAR_HEIGHT rows of 2*len bytes; byte
+ *                b of a row of plane p holds pixel 4b+p of the row.
+ *   INPUTS: text -- characters to draw
+ *           len -- number of characters
+ *           statusColor1 -- background color
+ *           statusColor2 -- foreground color
+ *   OUTPUTS: planar -- the image, len * TEXT_CELL_PLANAR_SIZE bytes
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may expand glyphs into the glyph cache
+ */
+void text_to_planar(const char * text, int len, unsigned char * planar, int statusColor1, int statusColor2){
+  glyph_t* glyph;
+  unsigned char* dst;
+  int i,plane,k;
+
+  for(i=0;i<len;i++){
+    glyph=get_glyph((unsigned char)text[i],statusColor1,statusColor2);
+    for(plane=0;plane<4;plane++){
+      dst=planar+plane*STATUS_BAR_HEIGHT*2*len+2*i;
+      for(k=0;k<STATUS_BAR_HEIGHT;k++,dst+=2*len){
+        memcpy(dst,(*glyph)[plane][k],2);
       }
     }
+  }
 }
 
 
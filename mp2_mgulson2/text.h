@@ -49,3 +49,5 @@ extern unsigned char font_data[256][16];
 //void text_to_graphics(char * text, unsigned char * status_buffer);
 void concatenatePlanes(unsigned char * plane0, unsigned char* plane1, unsigned char * plane2, unsigned char * plane3, unsigned char * status_buffer);
 void text_to_graphics(char * text, unsigned char * status_buffer, int statusColor1, int statusColor2);
+void text_cell_to_graphics(char c, int cell, unsigned char * status_buffer, int statusColor1, int statusColor2);
+void text_to_planar(const char * text, int len, unsigned char * planar, int statusColor1, int statusColor2);
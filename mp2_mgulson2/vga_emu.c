@@ -0,0 +1,359 @@
+/*
+ * tab:4
+ *
+ * vga_emu.c - memory-backed emulation of the VGA state used in mode X
+ *
+ * Only the parts of the VGA that modex.c relies upon are modeled:
+ * writes to video memory go to the planes enabled in the sequencer map
+ * mask register (write mode 0 with the default data rotate, logical
+ * operation, and bit mask, or write mode 1, which stores the latches
+ * loaded by the last read), the CRTC and attribute registers decide what
+ * vga_emu_render shows, and the DAC palette is recorded.  Reads of the
+ * input status register (0x3DA) reset the attribute controller flip-flop
+ * and alternate between display and vertical retrace.
+ */
+
+#include <string.h>
+
+#include "modex.h"
+#include "vga_emu.h"
+
+#define NUM_SEQ_REGS      5
+#define NUM_CRTC_REGS     25
+#define NUM_GRAPHICS_REGS 9
+#define NUM_ATTR_REGS     21
+
+static unsigned char planes[4][VGA_EMU_PLANE_SIZE];
+
+static unsigned char seq_index, seq[NUM_SEQ_REGS];
+static unsigned char crtc_index, crtc[NUM_CRTC_REGS];
+static unsigned char gfx_index, gfx[NUM_GRAPHICS_REGS];
+static unsigned char attr_index, attr[NUM_ATTR_REGS];
+static int attr_data_next;          /* 1 if next 0x3C0 write is data */
+static unsigned char misc_output;
+static unsigned char dac_index, dac_component;
+static unsigned char dac[256][3];
+static unsigned char input_status;  /* last value read from 0x3DA   */
+static unsigned char latch[4];      /* one byte per plane            */
+
+static vga_emu_stats_t stats;
+static vga_emu_stats_t frame_start; /* totals at start of frame     */
+
+/*
+ * vga_emu_init
+ *   DESCRIPTION: Reset the emulated VGA: clear video memory, registers,
+ *                palette, and access counts.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: resets all emulated state
+ */
+void vga_emu_init() {
+    memset(planes, 0, sizeof (planes));
+    seq_index = crtc_index = gfx_index = attr_index = 0;
+    memset(seq, 0, sizeof (seq));
+    memset(crtc, 0, sizeof (crtc));
+    memset(gfx, 0, sizeof (gfx));
+    memset(attr, 0, sizeof (attr));
+    attr_data_next = 0;
+    misc_output = 0;
+    dac_index = dac_component = 0;
+    memset(dac, 0, sizeof (dac));
+    input_status = 0;
+    memset(latch, 0, sizeof (latch));
+    memset(&stats, 0, sizeof (stats));
+    frame_start = stats;
+}
+
+/*
+ * vga_emu_outb
+ *   DESCRIPTION: Emulate an OUTB instruction to a VGA port.  Writes to
+ *                ports that modex.c does not use are counted and ignored.
+ *   INPUTS: port -- I/O port
+ *           val -- byte written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated register state
+ */
+void vga_emu_outb(unsigned short port, unsigned char val) {
+    stats.port_writes++;
+    switch (port) {
+        case 0x03C0:
+            /* The attribute controller alternates index and data. */
+            if (attr_data_next) {
+                if (attr_index < NUM_ATTR_REGS)
+                    attr[attr_index] = val;
+            } else {
+                attr_index = (val & 0x1F);
+            }
+            attr_data_next = !attr_data_next;
+            break;
+        case 0x03C2: misc_output = val; break;
+        case 0x03C4: seq_index = val; break;
+        case 0x03C5:
+            if (seq_index < NUM_SEQ_REGS)
+                seq[seq_index] = val;
+            break;
+        case 0x03C8:
+            dac_index = val;
+            dac_component = 0;
+            break;
+        case 0x03C9:
+            dac[dac_index][dac_component] = (val & 0x3F);
+            if (++dac_component == 3) {
+                dac_component = 0;
+                dac_index++;
+            }
+            break;
+        case 0x03CE: gfx_index = val; break;
+        case 0x03CF:
+            if (gfx_index < NUM_GRAPHICS_REGS)
+                gfx[gfx_index] = val;
+            break;
+        case 0x03D4: crtc_index = val; break;
+        case 0x03D5:
+            if (crtc_index < NUM_CRTC_REGS)
+                crtc[crtc_index] = val;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * vga_emu_outw
+ *   DESCRIPTION: Emulate an OUTW instruction, which writes the low byte
+ *                to a port and the high byte to the next port.  Counted
+ *                as a single port write.
+ *   INPUTS: port -- I/O port (index register of the pair)
+ *           val -- two bytes written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated register state
+ */
+void vga_emu_outw(unsigned short port, unsigned short val) {
+    vga_emu_outb(port, val & 0xFF);
+    vga_emu_outb(port + 1, val >> 8);
+    stats.port_writes--;
+}
+
+/*
+ * vga_emu_inb
+ *   DESCRIPTION: Emulate an INB instruction from a VGA port.
+ *   INPUTS: port -- I/O port
+ *   OUTPUTS: none
+ *   RETURN VALUE: byte read; 0xFF for ports that are not modeled
+ *   SIDE EFFECTS: reading 0x3DA resets the attribute controller flip-flop
+ */
+unsigned char vga_emu_inb(unsigned short port) {
+    stats.port_reads++;
+    switch (port) {
+        case 0x03C0: return attr_index;
+        case 0x03C1:
+            return (attr_index < NUM_ATTR_REGS ? attr[attr_index] : 0xFF);
+        case 0x03C5:
+            return (seq_index < NUM_SEQ_REGS ? seq[seq_index] : 0xFF);
+        case 0x03CC: return misc_output;
+        case 0x03CF:
+            return (gfx_index < NUM_GRAPHICS_REGS ? gfx[gfx_index] : 0xFF);
+        case 0x03D5:
+            return (crtc_index < NUM_CRTC_REGS ? crtc[crtc_index] : 0xFF);
+        case 0x03DA:
+            /*
+             * Alternate between active display and vertical retrace
+             * (bits 3 and 0) so that loops waiting for either finish.
+             */
+            attr_data_next = 0;
+            input_status ^= 0x09;
+            return input_status;
+        default:
+            return 0xFF;
+    }
+}
+
+/*
+ * vga_emu_write
+ *   DESCRIPTION: Write bytes to emulated video memory.  Each byte goes
+ *                to the same address in every plane enabled by the map
+ *                mask (sequencer register 2).
+ *   INPUTS: addr -- video memory address
+ *           src -- bytes to write
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated video memory; addresses wrap at 64kB
+ */
+void vga_emu_write(unsigned short addr, const unsigned char* src, int len) {
+    int p;      /* loop index over planes          */
+    int n;      /* bytes to copy before wrapping   */
+    int done;   /* bytes copied so far             */
+
+    stats.vram_bytes += len;
+    for (p = 0; p < 4; p++) {
+        if (!(seq[2] & (1 << p)))
+            continue;
+        if ((gfx[5] & 3) == 1) {
+            /* Write mode 1 ignores the data and stores the latches. */
+            for (done = 0; done < len; done++)
+                planes[p][(addr + done) & 0xFFFF] = latch[p];
+            continue;
+        }
+        for (done = 0; done < len; done += n) {
+            n = VGA_EMU_PLANE_SIZE - ((addr + done) & 0xFFFF);
+            if (n > len - done)
+                n = len - done;
+            memcpy(planes[p] + ((addr + done) & 0xFFFF), src + done, n);
+        }
+    }
+}
+
+/*
+ * vga_emu_fill
+ *   DESCRIPTION: Fill emulated video memory with a single value in every
+ *                plane enabled by the map mask.
+ *   INPUTS: addr -- video memory address
+ *           val -- value to write
+ *           len -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated video memory; addresses wrap at 64kB
+ */
+void vga_emu_fill(unsigned short addr, unsigned char val, int len) {
+    int p;      /* loop index over planes          */
+    int n;      /* bytes to fill before wrapping   */
+    int done;   /* bytes filled so far             */
+
+    stats.vram_bytes += len;
+    for (p = 0; p < 4; p++) {
+        if (!(seq[2] & (1 << p)))
+            continue;
+        if ((gfx[5] & 3) == 1)
+            val = latch[p];
+        for (done = 0; done < len; done += n) {
+            n = VGA_EMU_PLANE_SIZE - ((addr + done) & 0xFFFF);
+            if (n > len - done)
+                n = len - done;
+            memset(planes[p] + ((addr + done) & 0xFFFF), val, n);
+        }
+    }
+}
+
+/*
+ * vga_emu_read
+ *   DESCRIPTION: Read a byte of emulated video memory.  As on the VGA,
+ *                every read loads the four latches from the address;
+ *                the byte returned comes from the plane selected by the
+ *                read map select register (graphics register 4).
+ *   INPUTS: addr -- video memory address
+ *   OUTPUTS: none
+ *   RETURN VALUE: the byte read
+ *   SIDE EFFECTS: loads the latches
+ */
+unsigned char vga_emu_read(unsigned short addr) {
+    int p;      /* loop index over planes */
+
+    stats.vram_reads++;
+    for (p = 0; p < 4; p++)
+        latch[p] = planes[p][addr];
+    return latch[gfx[4] & 3];
+}
+
+/*
+ * vga_emu_end_frame
+ *   DESCRIPTION: Close the counts for the current frame (modex.c calls
+ *                this at the end of show_screen).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates the per-frame counts
+ */
+void vga_emu_end_frame() {
+    stats.frames++;
+    stats.frame_vram_bytes = stats.vram_bytes - frame_start.vram_bytes;
+    stats.frame_port_writes = stats.port_writes - frame_start.port_writes;
+    stats.frame_port_reads = stats.port_reads - frame_start.port_reads;
+    stats.frame_vram_reads = stats.vram_reads - frame_start.vram_reads;
+    frame_start = stats;
+}
+
+/*
+ * vga_emu_get_stats
+ *   DESCRIPTION: Read the access counts.
+ *   INPUTS: none
+ *   OUTPUTS: out -- totals and last frame's counts
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vga_emu_get_stats(vga_emu_stats_t* out) {
+    *out = stats;
+}
+
+/*
+ * vga_emu_render
+ *   DESCRIPTION: Produce the picture that the emulated VGA displays.  Rows
+ *                up to the line compare register come from the CRTC start
+ *                address, rows after it from address 0; rows are the CRTC
+ *                offset register times two addresses apart, and each row
+ *                is shifted by the pixel panning register (except below
+ *                the split when pixel panning mode is set).
+ *   INPUTS: none
+ *   OUTPUTS: pixels -- IMAGE_X_DIM * IMAGE_Y_DIM palette indices
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vga_emu_render(unsigned char* pixels) {
+    int start;          /* CRTC start address                  */
+    int row_width;      /* addresses between rows              */
+    int line_compare;   /* scan line ending the top of screen  */
+    int split_row;      /* first pixel row below the split     */
+    int pan;            /* pixels skipped at start of each row */
+    int x, y;           /* loop indices over pixels            */
+    int addr;           /* address of first pixel in a row     */
+    int p;              /* pixel index within a row            */
+
+    start = (crtc[0x0C] << 8) | crtc[0x0D];
+    row_width = crtc[0x13] * 2;
+    line_compare = crtc[0x18] | ((crtc[0x07] & 0x10) << 4) |
+                   ((crtc[0x09] & 0x40) << 3);
+    split_row = line_compare / ((crtc[0x09] & 0x1F) + 1) + 1;
+
+    for (y = 0; y < IMAGE_Y_DIM; y++) {
+        pan = ((attr[0x13] >> 1) & 3);
+        if (y < split_row) {
+            addr = start + y * row_width;
+        } else {
+            addr = (y - split_row) * row_width;
+            if (attr[0x10] & 0x20)
+                pan = 0;
+        }
+        for (x = 0; x < IMAGE_X_DIM; x++) {
+            p = x + pan;
+            pixels[y * IMAGE_X_DIM + x] =
+                planes[p & 3][(addr + (p >> 2)) & 0xFFFF];
+        }
+    }
+}
+
+/*
+ * vga_emu_palette
+ *   DESCRIPTION: Read the emulated DAC palette.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to 256 entries of 6-bit red, green, and blue
+ *   SIDE EFFECTS: none
+ */
+const unsigned char (*vga_emu_palette())[3] {
+    return (const unsigned char (*)[3])dac;
+}
+
+/*
+ * vga_emu_plane
+ *   DESCRIPTION: Read one plane of emulated video memory.
+ *   INPUTS: plane -- plane number (0 to 3)
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to VGA_EMU_PLANE_SIZE bytes
+ *   SIDE EFFECTS: none
+ */
+const unsigned char* vga_emu_plane(int plane) {
+    return planes[plane & 3];
+}
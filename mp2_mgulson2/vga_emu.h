@@ -0,0 +1,70 @@
+/*
+ * tab:4
+ *
+ * vga_emu.h - memory-backed emulation of the VGA state used in mode X
+ *
+ * The emulation lets modex.c run without ioperm and /dev/mem (see
+ * MODEX_EMULATED in modex.h).  It keeps the four 64kB planes of video
+ * memory and the sequencer, CRTC, graphics, attribute, and DAC registers,
+ * and counts the video memory bytes and port accesses made by the caller
+ * so that different drawing strategies can be compared exactly.
+ */
+
+#ifndef VGA_EMU_H
+#define VGA_EMU_H
+
+#define VGA_EMU_PLANE_SIZE 65536
+
+/* access counts; totals since vga_emu_init, and for the last frame */
+typedef struct vga_emu_stats_t {
+    unsigned long frames;             /* calls to vga_emu_end_frame      */
+    unsigned long vram_bytes;         /* bytes written to video memory   */
+    unsigned long vram_reads;         /* bytes read from video memory    */
+    unsigned long port_writes;        /* OUT instructions (OUTW is one)  */
+    unsigned long port_reads;         /* IN instructions                 */
+    unsigned long frame_vram_bytes;   /* vram_bytes in last frame        */
+    unsigned long frame_port_writes;  /* port_writes in last frame       */
+    unsigned long frame_port_reads;   /* port_reads in last frame        */
+    unsigned long frame_vram_reads;   /* vram_reads in last frame        */
+} vga_emu_stats_t;
+
+/* reset the emulated registers, video memory, and counters */
+extern void vga_emu_init();
+
+/* port access; OUTW writes the low byte to port and the high to port + 1 */
+extern void vga_emu_outb(unsigned short port, unsigned char val);
+extern void vga_emu_outw(unsigned short port, unsigned short val);
+extern unsigned char vga_emu_inb(unsigned short port);
+
+/*
+ * write len bytes at a video memory address to the planes in the map mask
+ * (in write mode 1, the latches are written instead of the bytes)
+ */
+extern void vga_emu_write(unsigned short addr, const unsigned char* src, int len);
+
+/* fill len bytes at a video memory address in the planes in the map mask */
+extern void vga_emu_fill(unsigned short addr, unsigned char val, int len);
+
+/* read a byte of video memory, loading the latches from all four planes */
+extern unsigned char vga_emu_read(unsigned short addr);
+
+/* close the current frame's counts */
+extern void vga_emu_end_frame();
+
+/* read the access counts */
+extern void vga_emu_get_stats(vga_emu_stats_t* out);
+
+/*
+ * render the picture the emulated VGA would display (320x200 palette
+ * indices), following the CRTC start address, row width, line compare
+ * split, and pixel panning
+ */
+extern void vga_emu_render(unsigned char* pixels);
+
+/* emulated DAC palette: 256 entries of 6-bit red, green, and blue */
+extern const unsigned char (*vga_emu_palette())[3];
+
+/* emulated video memory plane (0 to 3) */
+extern const unsigned char* vga_emu_plane(int plane);
+
+#endif /* VGA_EMU_H */